@@ -0,0 +1,135 @@
+#include "arcade.h"
+#include <cinttypes>
+
+namespace Intcode {
+
+namespace {
+
+char GetTileChar(Arcade::Tile tile)
+{
+  switch (tile)
+  {
+    case Arcade::Tile::Wall:
+      return '*';
+    case Arcade::Tile::Block:
+      return '#';
+    case Arcade::Tile::Paddle:
+      return '-';
+    case Arcade::Tile::Ball:
+      return 'o';
+    default:
+      return ' ';
+  }
+}
+
+} // namespace
+
+int Arcade::GetAutopilotInput() const
+{
+  if (!m_has_ball || !m_has_paddle || m_paddle.x == m_ball.x)
+    return 0;
+
+  return (m_paddle.x < m_ball.x) ? 1 : -1;
+}
+
+bool Arcade::OnOutput(MemoryCellType x, MemoryCellType y, MemoryCellType value)
+{
+  if (x == -1 && y == 0)
+  {
+    m_score = value;
+    m_score_dirty = true;
+    return true;
+  }
+
+  if (value < 0 || value >= static_cast<MemoryCellType>(Tile::Count))
+    return false;
+
+  const Tile tile = static_cast<Tile>(value);
+  const int ix = static_cast<int>(x);
+  const int iy = static_cast<int>(y);
+  if (tile == Tile::Block || m_screen.Get(ix, iy) == Tile::Block)
+    m_score_dirty = true;
+
+  m_screen.Set(ix, iy, tile);
+  MarkRowDirty(iy);
+
+  if (tile == Tile::Ball)
+  {
+    m_ball = Position{ix, iy};
+    m_has_ball = true;
+  }
+  else if (tile == Tile::Paddle)
+  {
+    m_paddle = Position{ix, iy};
+    m_has_paddle = true;
+  }
+
+  return true;
+}
+
+void Arcade::MarkRowDirty(int y)
+{
+  if (m_full_redraw)
+    return;
+
+  // anything outside the rendered screen moves it, so everything has to be redrawn
+  const auto& bounds = m_screen.GetBounds();
+  if (bounds.min_x != m_rendered_bounds.min_x || bounds.min_y != m_rendered_bounds.min_y ||
+      bounds.max_x != m_rendered_bounds.max_x || bounds.max_y != m_rendered_bounds.max_y)
+  {
+    m_full_redraw = true;
+    return;
+  }
+
+  m_dirty_rows[y - bounds.min_y] = 1;
+}
+
+void Arcade::Render(std::FILE* fp)
+{
+  if (m_screen.IsEmpty())
+    return;
+
+  const auto& bounds = m_screen.GetBounds();
+  const int width = bounds.max_x - bounds.min_x + 1;
+  const int height = bounds.max_y - bounds.min_y + 1;
+  if (m_full_redraw)
+  {
+    m_rendered_bounds = bounds;
+    m_dirty_rows.assign(height, 1);
+    m_row.resize(width);
+    m_output = "\x1b[H\x1b[2J";
+    m_score_dirty = true;
+    m_full_redraw = false;
+  }
+  else
+  {
+    m_output.clear();
+  }
+
+  for (int row = 0; row < height; row++)
+  {
+    if (!m_dirty_rows[row])
+      continue;
+
+    m_screen.CopyRow(bounds.min_y + row, bounds.min_x, bounds.max_x, m_row.data());
+    m_output += "\x1b[" + std::to_string(row + 1) + ";1H";
+    for (const Tile tile : m_row)
+      m_output += GetTileChar(tile);
+
+    m_dirty_rows[row] = 0;
+  }
+
+  if (m_score_dirty)
+  {
+    char line[64];
+    std::snprintf(line, sizeof(line), "\x1b[%d;1Hscore: %" PRId64 "  blocks: %zu\x1b[K", height + 1, m_score,
+                  GetBlockCount());
+    m_output += line;
+    m_score_dirty = false;
+  }
+
+  std::fwrite(m_output.data(), 1, m_output.size(), fp);
+  std::fflush(fp);
+}
+
+} // namespace Intcode
@@ -0,0 +1,73 @@
+#pragma once
+#include "grid.h"
+#include "intcode.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Intcode {
+
+// Host side of the arcade cabinet from day 13. The game outputs x, y, tile triples, or -1, 0, score, and the arcade
+// keeps the screen and everything the player needs to know up to date as each triple arrives, so a frame costs the
+// tiles which changed rather than the whole screen.
+//
+// Rendering is optional. Rows written since the last Render() are marked dirty, and only those are redrawn, using
+// ANSI cursor movement.
+class Arcade
+{
+public:
+  enum class Tile : u8
+  {
+    Empty,
+    Wall,
+    Block,
+    Paddle,
+    Ball,
+    Count
+  };
+
+  struct Position
+  {
+    int x;
+    int y;
+  };
+
+  Tile GetTile(int x, int y) const { return m_screen.Get(x, y); }
+  size_t GetBlockCount() const { return m_screen.GetCount(Tile::Block); }
+  MemoryCellType GetScore() const { return m_score; }
+
+  // Where the ball and paddle were last drawn, only meaningful once they have been.
+  bool HasBall() const { return m_has_ball; }
+  bool HasPaddle() const { return m_has_paddle; }
+  const Position& GetBallPosition() const { return m_ball; }
+  const Position& GetPaddlePosition() const { return m_paddle; }
+
+  // Joystick input which keeps the paddle under the ball: -1 for left, 1 for right, 0 to stay.
+  int GetAutopilotInput() const;
+
+  // Handles one output triple. Returns false if the tile is not one the arcade knows, leaving the screen as it was.
+  bool OnOutput(MemoryCellType x, MemoryCellType y, MemoryCellType value);
+
+  // Draws the dirty rows and the score line. The first frame, and any frame after the screen grows, is drawn in full.
+  void Render(std::FILE* fp);
+
+private:
+  void MarkRowDirty(int y);
+
+  Grid<Tile, static_cast<size_t>(Tile::Count)> m_screen;
+  MemoryCellType m_score = 0;
+  Position m_ball = {};
+  Position m_paddle = {};
+  bool m_has_ball = false;
+  bool m_has_paddle = false;
+
+  // one flag per screen row, from the top of the screen as it was last rendered
+  std::vector<u8> m_dirty_rows;
+  Grid<Tile, static_cast<size_t>(Tile::Count)>::Bounds m_rendered_bounds = {};
+  bool m_full_redraw = true;
+  bool m_score_dirty = true; // the score line, which shows the block count too
+  std::vector<Tile> m_row;
+  std::string m_output;
+};
+
+} // namespace Intcode
@@ -0,0 +1,810 @@
+#include "batch_computer.h"
+#include <algorithm>
+#include <climits>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace Intcode {
+
+namespace {
+
+// Lockstep kernels, one value per lane. dst may alias lhs or rhs.
+void AddValues(MemoryCellType* dst, const MemoryCellType* lhs, const MemoryCellType* rhs, u32 count)
+{
+  u32 i = 0;
+#if defined(__AVX2__)
+  for (; (i + 4) <= count; i += 4)
+  {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i));
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi64(a, b));
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = lhs[i] + rhs[i];
+}
+
+// AVX2 has no 64-bit multiply, leave this one to the compiler.
+void MulValues(MemoryCellType* dst, const MemoryCellType* lhs, const MemoryCellType* rhs, u32 count)
+{
+  for (u32 i = 0; i < count; i++)
+    dst[i] = lhs[i] * rhs[i];
+}
+
+void LessThanValues(MemoryCellType* dst, const MemoryCellType* lhs, const MemoryCellType* rhs, u32 count)
+{
+  u32 i = 0;
+#if defined(__AVX2__)
+  for (; (i + 4) <= count; i += 4)
+  {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i));
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_srli_epi64(_mm256_cmpgt_epi64(b, a), 63));
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = lhs[i] < rhs[i] ? 1 : 0;
+}
+
+void EqualValues(MemoryCellType* dst, const MemoryCellType* lhs, const MemoryCellType* rhs, u32 count)
+{
+  u32 i = 0;
+#if defined(__AVX2__)
+  for (; (i + 4) <= count; i += 4)
+  {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i));
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_srli_epi64(_mm256_cmpeq_epi64(a, b), 63));
+  }
+#endif
+  for (; i < count; i++)
+    dst[i] = lhs[i] == rhs[i] ? 1 : 0;
+}
+
+bool IsWriteOperand(Opcode opcode, u32 index)
+{
+  return (opcode == Opcode::in) ? (index == 0) :
+                                  (index == 2 && (opcode == Opcode::add || opcode == Opcode::mul ||
+                                                  opcode == Opcode::slt || opcode == Opcode::seq));
+}
+
+bool AddWithoutOverflow(s64 lhs, s64 rhs, s64* result)
+{
+  if ((rhs > 0 && lhs > std::numeric_limits<s64>::max() - rhs) ||
+      (rhs < 0 && lhs < std::numeric_limits<s64>::min() - rhs))
+  {
+    return false;
+  }
+
+  *result = lhs + rhs;
+  return true;
+}
+
+} // namespace
+
+BatchComputer::BatchComputer(const CodeVector& code, u32 num_lanes, u32 memory_size)
+  : m_code(code), m_num_lanes(num_lanes), m_memory_size(memory_size),
+    m_memory(static_cast<size_t>(memory_size) * num_lanes), m_pcs(num_lanes), m_relative_bases(num_lanes),
+    m_states(num_lanes), m_faults(num_lanes), m_input_queues(num_lanes), m_output_queues(num_lanes), m_cell_may_differ(memory_size)
+{
+  assert(!code.empty() && "has code to execute");
+  assert(num_lanes > 0 && "has lanes to execute");
+  assert(memory_size >= code.size() && "code size smaller than memory size");
+
+  m_group.reserve(num_lanes);
+  for (std::vector<MemoryCellType>& buffer : m_operand_buffers)
+    buffer.resize(num_lanes);
+
+  Reset();
+}
+
+BatchComputer::~BatchComputer() = default;
+
+void BatchComputer::Reset()
+{
+  std::fill(m_memory.begin(), m_memory.end(), 0);
+  for (u32 address = 0; address < m_code.size(); address++)
+    std::fill_n(m_memory.begin() + GetCellIndex(address, 0), m_num_lanes, m_code[address]);
+
+  std::fill(m_cell_may_differ.begin(), m_cell_may_differ.end(), u8(0));
+  std::fill(m_pcs.begin(), m_pcs.end(), 0);
+  std::fill(m_relative_bases.begin(), m_relative_bases.end(), 0);
+  std::fill(m_states.begin(), m_states.end(), State::Paused);
+  std::fill(m_faults.begin(), m_faults.end(), Fault::None);
+  for (u32 lane = 0; lane < m_num_lanes; lane++)
+  {
+    m_input_queues[lane].Clear();
+    m_output_queues[lane].Clear();
+  }
+}
+
+void BatchComputer::Run()
+{
+  for (State& state : m_states)
+  {
+    if (state != State::Halted && state != State::Faulted)
+      state = State::Executing;
+  }
+
+  while (BuildGroup())
+  {
+    if (m_group.size() == 1)
+      RunLane(m_group[0]);
+    else
+      RunGroup();
+  }
+}
+
+void BatchComputer::SetInputQueueCapacity(u32 capacity)
+{
+  for (RingBuffer<MemoryCellType>& queue : m_input_queues)
+    queue.SetCapacity(capacity);
+}
+
+void BatchComputer::SetOutputQueueCapacity(u32 capacity)
+{
+  for (RingBuffer<MemoryCellType>& queue : m_output_queues)
+    queue.SetCapacity(capacity);
+}
+
+bool BatchComputer::BuildGroup()
+{
+  u32 min_pc = UINT32_MAX;
+  bool any_executing = false;
+  for (u32 lane = 0; lane < m_num_lanes; lane++)
+  {
+    if (m_states[lane] == State::Executing)
+    {
+      min_pc = std::min(min_pc, m_pcs[lane]);
+      any_executing = true;
+    }
+  }
+
+  if (!any_executing)
+    return false;
+
+  // Lanes which have run ahead wait for the ones behind, which is where diverged lanes usually meet again.
+  m_group.clear();
+  m_next_pc = UINT32_MAX;
+  for (u32 lane = 0; lane < m_num_lanes; lane++)
+  {
+    if (m_states[lane] != State::Executing)
+      continue;
+
+    if (m_pcs[lane] == min_pc)
+      m_group.push_back(lane);
+    else
+      m_next_pc = std::min(m_next_pc, m_pcs[lane]);
+  }
+
+  return true;
+}
+
+void BatchComputer::RunGroup()
+{
+  const u32 count = static_cast<u32>(m_group.size());
+  u32 pc = m_pcs[m_group[0]];
+  for (;;)
+  {
+    Instruction instr;
+    if (!DecodeGroupInstruction(pc, &instr) || !CheckGroupOperands(instr))
+    {
+      // the lanes' code differs here, or some of them would fault, so they cannot share the decoded instruction
+      SetGroupPC(pc);
+      for (const u32 lane : m_group)
+        StepLane(lane);
+
+      return;
+    }
+
+    m_lockstep_instruction_count += count;
+    switch (instr.opcode)
+    {
+      case Opcode::add:
+      case Opcode::mul:
+      case Opcode::slt:
+      case Opcode::seq:
+        ExecuteGroupArithmetic(instr);
+        pc += instr.length;
+        break;
+
+      case Opcode::rbaddr:
+      {
+        if (!ExecuteGroupRelativeBase(instr))
+        {
+          // leave the overflowing lanes to fault on their own
+          SetGroupPC(pc);
+          for (const u32 lane : m_group)
+            ExecuteLane(lane, instr);
+
+          return;
+        }
+
+        pc += instr.length;
+      }
+      break;
+
+      case Opcode::jnz:
+      case Opcode::jz:
+      {
+        // lanes which branched differently have their own PCs now
+        if (!ExecuteGroupBranch(instr, pc, &pc))
+          return;
+      }
+      break;
+
+      default:
+      {
+        // I/O and halt act on per-lane queues and states, which can split the group
+        SetGroupPC(pc);
+        for (const u32 lane : m_group)
+          ExecuteLane(lane, instr);
+
+        return;
+      }
+    }
+
+    if (pc >= m_next_pc)
+    {
+      SetGroupPC(pc);
+      return;
+    }
+  }
+}
+
+void BatchComputer::RunLane(u32 lane)
+{
+  // alone at the lowest PC, keep going until the lane catches up with the others
+  do
+  {
+    StepLane(lane);
+  } while (m_states[lane] == State::Executing && m_pcs[lane] < m_next_pc);
+}
+
+void BatchComputer::SetGroupPC(u32 pc)
+{
+  for (const u32 lane : m_group)
+    m_pcs[lane] = pc;
+}
+
+bool BatchComputer::DecodeGroupInstruction(u32 pc, Instruction* instr)
+{
+  const auto cell_matches = [this](u64 address) {
+    if (address >= m_memory_size || !m_cell_may_differ[address])
+      return true;
+
+    const MemoryCellType* values = &m_memory[GetCellIndex(address, 0)];
+    if (std::all_of(values, values + m_num_lanes, [values](MemoryCellType value) { return value == values[0]; }))
+    {
+      m_cell_may_differ[address] = 0;
+      return true;
+    }
+
+    const MemoryCellType group_value = values[m_group[0]];
+    return std::all_of(m_group.begin(), m_group.end(),
+                       [values, group_value](u32 lane) { return values[lane] == group_value; });
+  };
+
+  if (!cell_matches(pc))
+    return false;
+
+  MemoryCellType cells[MAX_OPERANDS_PER_INSTRUCTION + 1];
+  for (u32 i = 0; i <= MAX_OPERANDS_PER_INSTRUCTION; i++)
+  {
+    const u64 address = u64(pc) + i;
+    cells[i] = (address < m_memory_size) ? m_memory[GetCellIndex(address, m_group[0])] : 0;
+  }
+
+  DecodeInstruction(cells, instr);
+  for (u32 i = 1; i < instr->length; i++)
+  {
+    if (!cell_matches(u64(pc) + i))
+      return false;
+  }
+
+  return true;
+}
+
+bool BatchComputer::CheckGroupOperands(const Instruction& instr) const
+{
+  // the lockstep kernels index memory directly, so every address they will touch has to be checked up front
+  for (u32 i = 0; (i + 1) < instr.length; i++)
+  {
+    const MemoryCellType value = instr.operand_values[i];
+    switch (instr.operand_modes[i])
+    {
+      case OperandMode::Positional:
+      {
+        if (!IsValidAddress(value))
+          return false;
+      }
+      break;
+
+      case OperandMode::Immediate:
+      {
+        if (IsWriteOperand(instr.opcode, i))
+          return false;
+      }
+      break;
+
+      case OperandMode::Relative:
+      {
+        for (const u32 lane : m_group)
+        {
+          s64 address;
+          if (!AddWithoutOverflow(m_relative_bases[lane], value, &address) || !IsValidAddress(address))
+            return false;
+        }
+      }
+      break;
+
+      default:
+        return false;
+    }
+  }
+
+  return true;
+}
+
+const MemoryCellType* BatchComputer::LoadGroupOperand(const Instruction& instr, u32 index,
+                                                      MemoryCellType* buffer) const
+{
+  const u32 count = static_cast<u32>(m_group.size());
+  const MemoryCellType value = instr.operand_values[index];
+  switch (instr.operand_modes[index])
+  {
+    case OperandMode::Positional:
+    {
+      assert(IsValidAddress(value));
+      const MemoryCellType* column = &m_memory[GetCellIndex(static_cast<u64>(value), 0)];
+      if (count == m_num_lanes)
+        return column;
+
+      for (u32 i = 0; i < count; i++)
+        buffer[i] = column[m_group[i]];
+
+      return buffer;
+    }
+
+    case OperandMode::Immediate:
+    {
+      std::fill_n(buffer, count, value);
+      return buffer;
+    }
+
+    case OperandMode::Relative:
+    {
+      for (u32 i = 0; i < count; i++)
+      {
+        const u32 lane = m_group[i];
+        const MemoryCellType address = m_relative_bases[lane] + value;
+        assert(IsValidAddress(address));
+        buffer[i] = m_memory[GetCellIndex(static_cast<u64>(address), lane)];
+      }
+
+      return buffer;
+    }
+
+    default:
+    {
+      assert(false && "Unknown operand type");
+      return buffer;
+    }
+  }
+}
+
+MemoryCellType* BatchComputer::GetGroupDestination(const Instruction& instr, u32 index)
+{
+  // only a positional operand written by every lane is a contiguous run of cells
+  const MemoryCellType value = instr.operand_values[index];
+  if (m_group.size() != m_num_lanes || instr.operand_modes[index] != OperandMode::Positional)
+    return nullptr;
+
+  assert(IsValidAddress(value));
+  m_cell_may_differ[static_cast<size_t>(value)] = 1;
+  return &m_memory[GetCellIndex(static_cast<u64>(value), 0)];
+}
+
+void BatchComputer::StoreGroupOperand(const Instruction& instr, u32 index, const MemoryCellType* values)
+{
+  const u32 count = static_cast<u32>(m_group.size());
+  const MemoryCellType value = instr.operand_values[index];
+  switch (instr.operand_modes[index])
+  {
+    case OperandMode::Positional:
+    {
+      assert(IsValidAddress(value));
+      MemoryCellType* column = &m_memory[GetCellIndex(static_cast<u64>(value), 0)];
+      for (u32 i = 0; i < count; i++)
+        column[m_group[i]] = values[i];
+
+      m_cell_may_differ[static_cast<size_t>(value)] = 1;
+    }
+    break;
+
+    case OperandMode::Immediate:
+    {
+      assert(false && "immediate write operand");
+    }
+    break;
+
+    case OperandMode::Relative:
+    {
+      for (u32 i = 0; i < count; i++)
+        WriteMemory(m_group[i], static_cast<u64>(m_relative_bases[m_group[i]] + value), values[i]);
+    }
+    break;
+
+    default:
+    {
+      assert(false && "Unknown operand type");
+    }
+    break;
+  }
+}
+
+void BatchComputer::ExecuteGroupArithmetic(const Instruction& instr)
+{
+  const u32 count = static_cast<u32>(m_group.size());
+  const MemoryCellType* lhs = LoadGroupOperand(instr, 0, m_operand_buffers[0].data());
+  const MemoryCellType* rhs = LoadGroupOperand(instr, 1, m_operand_buffers[1].data());
+  MemoryCellType* dst = GetGroupDestination(instr, 2);
+  MemoryCellType* result = dst ? dst : m_operand_buffers[2].data();
+
+  switch (instr.opcode)
+  {
+    case Opcode::add:
+      AddValues(result, lhs, rhs, count);
+      break;
+
+    case Opcode::mul:
+      MulValues(result, lhs, rhs, count);
+      break;
+
+    case Opcode::slt:
+      LessThanValues(result, lhs, rhs, count);
+      break;
+
+    case Opcode::seq:
+      EqualValues(result, lhs, rhs, count);
+      break;
+
+    default:
+      assert(false && "not an arithmetic instruction");
+      break;
+  }
+
+  if (!dst)
+    StoreGroupOperand(instr, 2, result);
+}
+
+bool BatchComputer::ExecuteGroupBranch(const Instruction& instr, u32 pc, u32* target_pc)
+{
+  const u32 count = static_cast<u32>(m_group.size());
+  const MemoryCellType* values = LoadGroupOperand(instr, 0, m_operand_buffers[0].data());
+  const MemoryCellType* targets = LoadGroupOperand(instr, 1, m_operand_buffers[1].data());
+  const bool jump_if_nonzero = (instr.opcode == Opcode::jnz);
+
+  bool uniform = true;
+  for (u32 i = 0; i < count; i++)
+  {
+    u32 new_pc = pc + 3;
+    if ((values[i] != 0) == jump_if_nonzero)
+    {
+      if (targets[i] < 0 || targets[i] > std::numeric_limits<u32>::max())
+      {
+        // the group has to split, the faulted lane stays at the jump
+        FaultLane(m_group[i], Fault::InvalidJumpTarget);
+        new_pc = pc;
+        uniform = false;
+      }
+      else
+      {
+        new_pc = static_cast<u32>(targets[i]);
+      }
+    }
+
+    m_pcs[m_group[i]] = new_pc;
+    uniform &= (new_pc == m_pcs[m_group[0]]);
+  }
+
+  *target_pc = m_pcs[m_group[0]];
+  return uniform;
+}
+
+bool BatchComputer::ExecuteGroupRelativeBase(const Instruction& instr)
+{
+  const u32 count = static_cast<u32>(m_group.size());
+  const MemoryCellType* values = LoadGroupOperand(instr, 0, m_operand_buffers[0].data());
+  MemoryCellType* new_bases = m_operand_buffers[1].data();
+  for (u32 i = 0; i < count; i++)
+  {
+    if (!AddWithoutOverflow(m_relative_bases[m_group[i]], values[i], &new_bases[i]))
+      return false;
+  }
+
+  for (u32 i = 0; i < count; i++)
+    m_relative_bases[m_group[i]] = new_bases[i];
+
+  return true;
+}
+
+void BatchComputer::StepLane(u32 lane)
+{
+  const u32 pc = m_pcs[lane];
+  MemoryCellType cells[MAX_OPERANDS_PER_INSTRUCTION + 1];
+  for (u32 i = 0; i <= MAX_OPERANDS_PER_INSTRUCTION; i++)
+  {
+    const u64 address = u64(pc) + i;
+    cells[i] = (address < m_memory_size) ? m_memory[GetCellIndex(address, lane)] : 0;
+  }
+
+  Instruction instr;
+  DecodeInstruction(cells, &instr);
+  ExecuteLane(lane, instr);
+  m_scalar_instruction_count++;
+}
+
+BatchComputer::Fault BatchComputer::CheckLaneInstruction(u32 lane, const Instruction& instr) const
+{
+  // same rules as a Strict computer, plus the end of the lane's memory
+  for (u32 i = 0; (i + 1) < instr.length; i++)
+  {
+    s64 address = instr.operand_values[i];
+    switch (instr.operand_modes[i])
+    {
+      case OperandMode::Positional:
+        break;
+
+      case OperandMode::Immediate:
+        if (IsWriteOperand(instr.opcode, i))
+          return Fault::InvalidInstruction;
+        continue;
+
+      case OperandMode::Relative:
+        if (!AddWithoutOverflow(m_relative_bases[lane], instr.operand_values[i], &address))
+          return Fault::InvalidAddress;
+        break;
+
+      default:
+        return Fault::InvalidInstruction;
+    }
+
+    if (!IsValidAddress(address))
+      return Fault::InvalidAddress;
+  }
+
+  switch (instr.opcode)
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::in:
+    case Opcode::out:
+    case Opcode::slt:
+    case Opcode::seq:
+    case Opcode::halt:
+      break;
+
+    case Opcode::jnz:
+    case Opcode::jz:
+    {
+      const MemoryCellType value = ReadLaneOperand(lane, instr, 0);
+      const MemoryCellType new_pc = ReadLaneOperand(lane, instr, 1);
+      const bool taken = (instr.opcode == Opcode::jnz) ? (value != 0) : (value == 0);
+      if (taken && (new_pc < 0 || new_pc > std::numeric_limits<u32>::max()))
+        return Fault::InvalidJumpTarget;
+    }
+    break;
+
+    case Opcode::rbaddr:
+    {
+      s64 relative_base;
+      if (!AddWithoutOverflow(m_relative_bases[lane], ReadLaneOperand(lane, instr, 0), &relative_base))
+        return Fault::InvalidAddress;
+    }
+    break;
+
+    default:
+      return Fault::InvalidInstruction;
+  }
+
+  return Fault::None;
+}
+
+void BatchComputer::FaultLane(u32 lane, Fault fault)
+{
+  m_states[lane] = State::Faulted;
+  m_faults[lane] = fault;
+}
+
+void BatchComputer::ExecuteLane(u32 lane, const Instruction& instr)
+{
+  // everything an instruction accesses is known before it runs, so a faulting instruction has no effect
+  const Fault fault = CheckLaneInstruction(lane, instr);
+  if (fault != Fault::None)
+  {
+    FaultLane(lane, fault);
+    return;
+  }
+
+  u32& pc = m_pcs[lane];
+  switch (instr.opcode)
+  {
+    case Opcode::add:
+    {
+      const MemoryCellType lhs = ReadLaneOperand(lane, instr, 0);
+      const MemoryCellType rhs = ReadLaneOperand(lane, instr, 1);
+      WriteLaneOperand(lane, instr, 2, lhs + rhs);
+      pc += 4;
+    }
+    break;
+
+    case Opcode::mul:
+    {
+      const MemoryCellType lhs = ReadLaneOperand(lane, instr, 0);
+      const MemoryCellType rhs = ReadLaneOperand(lane, instr, 1);
+      WriteLaneOperand(lane, instr, 2, lhs * rhs);
+      pc += 4;
+    }
+    break;
+
+    case Opcode::in:
+    {
+      RingBuffer<MemoryCellType>& queue = m_input_queues[lane];
+      if (queue.IsEmpty())
+      {
+        // leave pc as-is so we re-execute after input is provided
+        m_states[lane] = State::WaitingForInput;
+        return;
+      }
+
+      WriteLaneOperand(lane, instr, 0, queue.Pop());
+      pc += 2;
+    }
+    break;
+
+    case Opcode::out:
+    {
+      RingBuffer<MemoryCellType>& queue = m_output_queues[lane];
+      if (queue.IsFull())
+      {
+        // leave pc as-is so we re-execute after consuming output
+        m_states[lane] = State::WaitingForOutput;
+        return;
+      }
+
+      queue.Push(ReadLaneOperand(lane, instr, 0));
+      if (queue.IsFull())
+        m_states[lane] = State::WaitingForOutput;
+
+      pc += 2;
+    }
+    break;
+
+    case Opcode::jnz:
+    case Opcode::jz:
+    {
+      const MemoryCellType value = ReadLaneOperand(lane, instr, 0);
+      if ((instr.opcode == Opcode::jnz) ? (value != 0) : (value == 0))
+      {
+        const MemoryCellType new_pc = ReadLaneOperand(lane, instr, 1);
+        assert(new_pc >= 0 && new_pc <= std::numeric_limits<u32>::max());
+        pc = static_cast<u32>(new_pc);
+      }
+      else
+      {
+        // branch not taken
+        pc += 3;
+      }
+    }
+    break;
+
+    case Opcode::slt:
+    {
+      const MemoryCellType lhs = ReadLaneOperand(lane, instr, 0);
+      const MemoryCellType rhs = ReadLaneOperand(lane, instr, 1);
+      WriteLaneOperand(lane, instr, 2, lhs < rhs ? 1 : 0);
+      pc += 4;
+    }
+    break;
+
+    case Opcode::seq:
+    {
+      const MemoryCellType lhs = ReadLaneOperand(lane, instr, 0);
+      const MemoryCellType rhs = ReadLaneOperand(lane, instr, 1);
+      WriteLaneOperand(lane, instr, 2, lhs == rhs ? 1 : 0);
+      pc += 4;
+    }
+    break;
+
+    case Opcode::rbaddr:
+    {
+      m_relative_bases[lane] += ReadLaneOperand(lane, instr, 0);
+      pc += 2;
+    }
+    break;
+
+    case Opcode::halt:
+    {
+      m_states[lane] = State::Halted;
+      pc++;
+    }
+    break;
+
+    default:
+    {
+      assert(false && "Unknown opcode");
+    }
+    break;
+  }
+}
+
+MemoryCellType BatchComputer::ReadLaneOperand(u32 lane, const Instruction& instr, u32 index) const
+{
+  switch (instr.operand_modes[index])
+  {
+    case OperandMode::Positional:
+    {
+      const MemoryCellType address = instr.operand_values[index];
+      assert(IsValidAddress(address));
+      return ReadMemory(lane, static_cast<u64>(address));
+    }
+
+    case OperandMode::Immediate:
+    {
+      return instr.operand_values[index];
+    }
+
+    case OperandMode::Relative:
+    {
+      const MemoryCellType address = m_relative_bases[lane] + instr.operand_values[index];
+      assert(IsValidAddress(address));
+      return ReadMemory(lane, static_cast<u64>(address));
+    }
+
+    default:
+    {
+      assert(false && "Unknown operand type");
+      return 0;
+    }
+  }
+}
+
+void BatchComputer::WriteLaneOperand(u32 lane, const Instruction& instr, u32 index, MemoryCellType value)
+{
+  switch (instr.operand_modes[index])
+  {
+    case OperandMode::Positional:
+    {
+      const MemoryCellType address = instr.operand_values[index];
+      assert(IsValidAddress(address));
+      WriteMemory(lane, static_cast<u64>(address), value);
+    }
+    break;
+
+    case OperandMode::Immediate:
+    {
+      assert(false && "immediate write operand");
+    }
+    break;
+
+    case OperandMode::Relative:
+    {
+      const MemoryCellType address = m_relative_bases[lane] + instr.operand_values[index];
+      assert(IsValidAddress(address));
+      WriteMemory(lane, static_cast<u64>(address), value);
+    }
+    break;
+
+    default:
+    {
+      assert(false && "Unknown operand type");
+    }
+    break;
+  }
+}
+
+} // namespace Intcode
@@ -0,0 +1,120 @@
+#pragma once
+#include "intcode.h"
+#include <cassert>
+#include <vector>
+
+namespace Intcode {
+
+// Runs many instances ("lanes") of the same program side by side. State is kept as structure-of-arrays, with the
+// memory of all lanes interleaved per address, so an instruction which every lane is executing is decoded once and
+// executed as a loop over contiguous lane values (AVX2 when the compiler targets it).
+//
+// Lanes which reach different PCs are reconverged by always running the lanes at the lowest PC, and a lane which is
+// on its own, or whose code differs from the rest of its group, falls back to scalar execution. As long as a lane stays
+// within memory_size, the result is the same as running it through a Computer, instruction for instruction.
+//
+// Unlike Computer, batch memory is flat: every lane has memory_size cells and cannot grow past them. A lane which would
+// access a cell outside that range, or do anything else a Strict computer faults on, stops with State::Faulted and its
+// PC left at the instruction, see GetFault(). The other lanes keep running.
+class BatchComputer
+{
+public:
+  using State = Computer::State;
+  using Fault = Computer::Fault;
+
+  BatchComputer(const CodeVector& code, u32 num_lanes, u32 memory_size = 16384);
+  ~BatchComputer();
+
+  u32 GetNumLanes() const { return m_num_lanes; }
+  u32 GetMemorySize() const { return m_memory_size; }
+
+  u32 GetPC(u32 lane) const { return m_pcs[lane]; }
+  s64 GetRelativeBase(u32 lane) const { return m_relative_bases[lane]; }
+  State GetState(u32 lane) const { return m_states[lane]; }
+  Fault GetFault(u32 lane) const { return m_faults[lane]; }
+
+  // Cells past memory_size read as zero, and writes to them are dropped.
+  MemoryCellType ReadMemory(u32 lane, u64 address) const
+  {
+    return (address < m_memory_size) ? m_memory[GetCellIndex(address, lane)] : 0;
+  }
+  bool WriteMemory(u32 lane, u64 address, MemoryCellType value)
+  {
+    if (address >= m_memory_size)
+      return false;
+
+    m_memory[GetCellIndex(address, lane)] = value;
+    m_cell_may_differ[address] = 1;
+    return true;
+  }
+
+  void Reset();
+
+  // Runs every lane which has not halted until it halts or blocks on input or output, see Computer::Run().
+  void Run();
+
+  // Queues work as in Computer, every lane has its own input and output queue.
+  void SetInputQueueCapacity(u32 capacity);
+  void SetOutputQueueCapacity(u32 capacity);
+  bool CanPushInput(u32 lane) const { return !m_input_queues[lane].IsFull(); }
+  bool HasOutput(u32 lane) const { return !m_output_queues[lane].IsEmpty(); }
+  void SetInput(u32 lane, MemoryCellType value) { m_input_queues[lane].Push(value); }
+  MemoryCellType GetOutput(u32 lane) { return m_output_queues[lane].Pop(); }
+
+  // Lane-instructions executed by the lockstep kernels and by the scalar fallback, for tuning batch sizes.
+  u64 GetLockstepInstructionCount() const { return m_lockstep_instruction_count; }
+  u64 GetScalarInstructionCount() const { return m_scalar_instruction_count; }
+
+private:
+  size_t GetCellIndex(u64 address, u32 lane) const { return static_cast<size_t>(address) * m_num_lanes + lane; }
+  bool IsValidAddress(s64 address) const { return address >= 0 && address < static_cast<s64>(m_memory_size); }
+
+  bool BuildGroup();
+  void RunGroup();
+  void RunLane(u32 lane);
+  void SetGroupPC(u32 pc);
+
+  bool DecodeGroupInstruction(u32 pc, Instruction* instr);
+  bool CheckGroupOperands(const Instruction& instr) const;
+  const MemoryCellType* LoadGroupOperand(const Instruction& instr, u32 index, MemoryCellType* buffer) const;
+  MemoryCellType* GetGroupDestination(const Instruction& instr, u32 index);
+  void StoreGroupOperand(const Instruction& instr, u32 index, const MemoryCellType* values);
+  void ExecuteGroupArithmetic(const Instruction& instr);
+  bool ExecuteGroupBranch(const Instruction& instr, u32 pc, u32* target_pc);
+  bool ExecuteGroupRelativeBase(const Instruction& instr);
+
+  void StepLane(u32 lane);
+  Fault CheckLaneInstruction(u32 lane, const Instruction& instr) const;
+  void FaultLane(u32 lane, Fault fault);
+  void ExecuteLane(u32 lane, const Instruction& instr);
+  MemoryCellType ReadLaneOperand(u32 lane, const Instruction& instr, u32 index) const;
+  void WriteLaneOperand(u32 lane, const Instruction& instr, u32 index, MemoryCellType value);
+
+  CodeVector m_code;
+  u32 m_num_lanes;
+  u32 m_memory_size;
+
+  std::vector<MemoryCellType> m_memory;
+  std::vector<u32> m_pcs;
+  std::vector<s64> m_relative_bases;
+  std::vector<State> m_states;
+  std::vector<Fault> m_faults;
+  std::vector<RingBuffer<MemoryCellType>> m_input_queues;
+  std::vector<RingBuffer<MemoryCellType>> m_output_queues;
+
+  // Set when lanes may have written different values to a cell. Instructions are only decoded once for a group if the
+  // cells they occupy hold the same value in every lane of it.
+  std::vector<u8> m_cell_may_differ;
+
+  // Lanes executing together at the lowest PC, and the next higher PC of any other executing lane.
+  std::vector<u32> m_group;
+  u32 m_next_pc = 0;
+
+  // per-lane scratch values for the lockstep kernels
+  std::vector<MemoryCellType> m_operand_buffers[MAX_OPERANDS_PER_INSTRUCTION];
+
+  u64 m_lockstep_instruction_count = 0;
+  u64 m_scalar_instruction_count = 0;
+};
+
+} // namespace Intcode
@@ -0,0 +1,295 @@
+#include "call_memoizer.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Intcode {
+
+void CallMemoizer::Execute(Computer& comp)
+{
+  // Calls left over from the last run were interrupted by I/O, which already rules them out, and the host may have
+  // changed memory since.
+  MarkAllNotMemoizable();
+  while (m_num_active_calls > 0)
+    PopCall(comp);
+
+  const u64 cache_size = comp.m_instruction_cache_flags.size();
+  while (comp.m_state == Computer::State::Executing)
+  {
+    const u32 pc = comp.m_pc;
+    const Computer::CachedInstruction& cached = comp.FetchCachedInstruction();
+    const Instruction& instr = cached.instr;
+
+    if (m_first_memoizable_call < m_num_active_calls)
+    {
+      // writes to code outside the instruction cache would not clear the results
+      if ((u64(pc) + MAX_OPERANDS_PER_INSTRUCTION) >= cache_size)
+        MarkAllNotMemoizable();
+      else
+        RecordOperandAccesses(comp, instr);
+    }
+
+    // a taken jump with its own return address at [rb + 0] is a call
+    const u32 return_pc = pc + instr.length;
+    if ((instr.opcode == Opcode::jnz || instr.opcode == Opcode::jz) && comp.m_relative_base >= 0 &&
+        comp.ReadMemory(static_cast<u64>(comp.m_relative_base)) == return_pc &&
+        ((instr.opcode == Opcode::jnz) == (comp.ReadOperand(instr, 0) != 0)))
+    {
+      const MemoryCellType target = comp.ReadOperand(instr, 1);
+      if (target >= 0 && static_cast<u64>(target) < cache_size && target != return_pc)
+      {
+        m_call_count++;
+
+        const s64 frame = comp.m_relative_base;
+        if (const Result* result = FindResult(comp, static_cast<u32>(target), frame))
+        {
+          SkipCall(comp, *result, return_pc, frame);
+          continue;
+        }
+
+        PushCall(static_cast<u32>(target), return_pc, frame);
+      }
+    }
+
+    cached.handler(comp, instr);
+
+    if (m_num_active_calls > 0)
+    {
+      const ActiveCall& call = m_active_calls[m_num_active_calls - 1];
+      if (comp.m_pc == call.return_pc && comp.m_relative_base == call.frame)
+        PopCall(comp);
+    }
+  }
+}
+
+void CallMemoizer::Clear()
+{
+  m_functions.clear();
+  m_result_index.clear();
+  m_results.clear();
+
+  // calls in progress may have run the old code
+  MarkAllNotMemoizable();
+}
+
+u64 CallMemoizer::HashInputs(u32 entry_pc, u32 layout, const std::vector<MemoryCellType>& input_values)
+{
+  u64 hash = (u64(entry_pc) << 32) | layout;
+  for (const MemoryCellType value : input_values)
+    hash ^= static_cast<u64>(value) + UINT64_C(0x9E3779B97F4A7C15) + (hash << 6) + (hash >> 2);
+
+  return hash;
+}
+
+const CallMemoizer::Result* CallMemoizer::FindResult(const Computer& comp, u32 entry_pc, s64 frame)
+{
+  const auto it = m_functions.find(entry_pc);
+  if (it == m_functions.end())
+    return nullptr;
+
+  const std::vector<std::vector<u32>>& layouts = it->second.input_layouts;
+  for (u32 layout = 0; layout < layouts.size(); layout++)
+  {
+    m_input_values.clear();
+    for (const u32 offset : layouts[layout])
+      m_input_values.push_back(comp.ReadMemory(static_cast<u64>(frame) + offset));
+
+    const auto range = m_result_index.equal_range(HashInputs(entry_pc, layout, m_input_values));
+    for (auto result = range.first; result != range.second; ++result)
+    {
+      const Result& candidate = m_results[result->second];
+      if (candidate.entry_pc == entry_pc && candidate.layout == layout && candidate.input_values == m_input_values)
+        return &candidate;
+    }
+  }
+
+  return nullptr;
+}
+
+void CallMemoizer::StoreResult(const Computer& comp, const ActiveCall& call)
+{
+  if (m_results.size() >= MAX_RESULTS)
+    return;
+
+  Function& function = m_functions[call.entry_pc];
+  u32 layout = 0;
+  for (; layout < function.input_layouts.size(); layout++)
+  {
+    const std::vector<u32>& offsets = function.input_layouts[layout];
+    if (std::equal(offsets.begin(), offsets.end(), call.inputs.begin(), call.inputs.end(),
+                   [](u32 offset, const std::pair<u32, MemoryCellType>& input) { return offset == input.first; }))
+    {
+      break;
+    }
+  }
+  if (layout == function.input_layouts.size())
+  {
+    if (layout == MAX_LAYOUTS_PER_FUNCTION)
+      return;
+
+    std::vector<u32>& offsets = function.input_layouts.emplace_back();
+    for (const auto& input : call.inputs)
+      offsets.push_back(input.first);
+  }
+
+  Result result;
+  result.entry_pc = call.entry_pc;
+  result.layout = layout;
+  for (const auto& input : call.inputs)
+    result.input_values.push_back(input.second);
+  for (const u32 offset : call.outputs)
+    result.outputs.emplace_back(offset, comp.ReadMemory(static_cast<u64>(call.frame) + offset));
+
+  m_result_index.emplace(HashInputs(result.entry_pc, layout, result.input_values), static_cast<u32>(m_results.size()));
+  m_results.push_back(std::move(result));
+}
+
+void CallMemoizer::PushCall(u32 entry_pc, u32 return_pc, s64 frame)
+{
+  // deeper calls still count towards the calls below them, but are not memoized themselves
+  if (m_num_active_calls == MAX_ACTIVE_CALLS)
+    return;
+
+  if (m_num_active_calls == m_active_calls.size())
+    m_active_calls.emplace_back();
+
+  ActiveCall& call = m_active_calls[m_num_active_calls++];
+  call.entry_pc = entry_pc;
+  call.return_pc = return_pc;
+  call.frame = frame;
+  call.memoizable = true;
+}
+
+void CallMemoizer::PopCall(const Computer& comp)
+{
+  ActiveCall& call = m_active_calls[--m_num_active_calls];
+  if (call.memoizable)
+    StoreResult(comp, call);
+
+  for (const auto& input : call.inputs)
+    call.cell_state[input.first] = 0;
+  for (const u32 offset : call.outputs)
+    call.cell_state[offset] = 0;
+
+  call.inputs.clear();
+  call.outputs.clear();
+  m_first_memoizable_call = std::min(m_first_memoizable_call, m_num_active_calls);
+}
+
+void CallMemoizer::SkipCall(Computer& comp, const Result& result, u32 return_pc, s64 frame)
+{
+  m_skipped_call_count++;
+
+  // the calls in progress see the skipped call's reads and writes as their own
+  const std::vector<u32>& offsets = m_functions[result.entry_pc].input_layouts[result.layout];
+  for (u32 i = 0; i < offsets.size(); i++)
+    RecordAccess(frame + offsets[i], false, result.input_values[i]);
+
+  // writing can clear the results if the frame overlaps code, so apply them from a copy
+  m_outputs = result.outputs;
+  for (const auto& [offset, value] : m_outputs)
+  {
+    RecordAccess(frame + offset, true, value);
+    comp.WriteMemory(static_cast<u64>(frame) + offset, value);
+  }
+
+  comp.m_pc = return_pc;
+}
+
+void CallMemoizer::RecordAccess(s64 address, bool write, MemoryCellType value)
+{
+  for (u32 i = m_first_memoizable_call; i < m_num_active_calls; i++)
+  {
+    ActiveCall& call = m_active_calls[i];
+    if (!call.memoizable)
+      continue;
+
+    const s64 offset = address - call.frame;
+    if (offset < 0 || offset >= MAX_FRAME_CELLS)
+    {
+      MarkNotMemoizable(i);
+      continue;
+    }
+
+    if (static_cast<u64>(offset) >= call.cell_state.size())
+      call.cell_state.resize(static_cast<size_t>(offset) + 1 + call.cell_state.size() / 2);
+
+    u8& state = call.cell_state[static_cast<size_t>(offset)];
+    if (write)
+    {
+      if (!(state & CELL_WRITTEN))
+      {
+        state |= CELL_WRITTEN;
+        call.outputs.push_back(static_cast<u32>(offset));
+      }
+    }
+    else if (state == 0)
+    {
+      state = CELL_READ;
+      call.inputs.emplace_back(static_cast<u32>(offset), value);
+    }
+  }
+}
+
+void CallMemoizer::RecordOperandAccesses(const Computer& comp, const Instruction& instr)
+{
+  // Only relative operands can be followed from one frame to another, positional operands reach the same cell
+  // whatever the frame is.
+  const auto access = [this, &comp, &instr](u32 index, bool write) {
+    if (instr.operand_modes[index] == OperandMode::Immediate && !write)
+      return;
+
+    const s64 address = comp.m_relative_base + instr.operand_values[index];
+    if (instr.operand_modes[index] != OperandMode::Relative || address < 0)
+    {
+      MarkAllNotMemoizable();
+      return;
+    }
+
+    RecordAccess(address, write, write ? 0 : comp.ReadMemory(static_cast<u64>(address)));
+  };
+
+  switch (instr.opcode)
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::slt:
+    case Opcode::seq:
+      access(0, false);
+      access(1, false);
+      access(2, true);
+      break;
+
+    case Opcode::jnz:
+    case Opcode::jz:
+      access(0, false);
+      if ((instr.opcode == Opcode::jnz) == (comp.ReadOperand(instr, 0) != 0))
+        access(1, false);
+      break;
+
+    case Opcode::rbaddr:
+      access(0, false);
+      break;
+
+    default:
+      // I/O, halt, and anything unknown
+      MarkAllNotMemoizable();
+      break;
+  }
+}
+
+void CallMemoizer::MarkNotMemoizable(u32 index)
+{
+  m_active_calls[index].memoizable = false;
+  while (m_first_memoizable_call < m_num_active_calls && !m_active_calls[m_first_memoizable_call].memoizable)
+    m_first_memoizable_call++;
+}
+
+void CallMemoizer::MarkAllNotMemoizable()
+{
+  for (u32 i = m_first_memoizable_call; i < m_num_active_calls; i++)
+    m_active_calls[i].memoizable = false;
+
+  m_first_memoizable_call = m_num_active_calls;
+}
+
+} // namespace Intcode
@@ -0,0 +1,100 @@
+#pragma once
+#include "intcode.h"
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Intcode {
+
+// Skips the bodies of calls which were already made with the same arguments. Calls are found through the convention
+// of compiled Intcode: the caller stores the return address at [rb + 0] and jumps to the function, which returns by
+// jumping there with the relative base restored. While a call runs, every cell it accesses is recorded relative to the
+// caller's relative base, its frame. A call which does no I/O and only accesses its frame through relative operands
+// only depends on the frame cells it read before writing them, and its only effect is the frame cells it wrote. Later
+// calls to the same function with those cells holding the same values get the writes applied and return at once.
+class CallMemoizer
+{
+public:
+  // Runs the computer until it leaves the Executing state.
+  void Execute(Computer& comp);
+
+  // Forgets every result, called when the program writes into its own code.
+  void Clear();
+
+  u64 GetCallCount() const { return m_call_count; }
+  u64 GetSkippedCallCount() const { return m_skipped_call_count; }
+
+private:
+  enum : u32
+  {
+    MAX_FRAME_CELLS = 16384, // calls accessing cells further above their frame are not memoized
+    MAX_ACTIVE_CALLS = 1024,
+    MAX_LAYOUTS_PER_FUNCTION = 16,
+    MAX_RESULTS = 1 << 20
+  };
+
+  enum : u8
+  {
+    CELL_READ = (1 << 0),
+    CELL_WRITTEN = (1 << 1)
+  };
+
+  using CellValues = std::vector<std::pair<u32, MemoryCellType>>;
+
+  struct ActiveCall
+  {
+    u32 entry_pc;
+    u32 return_pc;
+    s64 frame;
+    bool memoizable;
+    CellValues inputs; // frame cells read before the call wrote them, with the values read
+    std::vector<u32> outputs;
+    std::vector<u8> cell_state; // indexed by offset from the frame, grown as needed
+  };
+
+  struct Result
+  {
+    u32 entry_pc;
+    u32 layout;
+    std::vector<MemoryCellType> input_values;
+    CellValues outputs;
+  };
+
+  // Calls to a function can read different cells depending on the path they take, each distinct set of input cells
+  // is a layout. Most functions only have one.
+  struct Function
+  {
+    std::vector<std::vector<u32>> input_layouts;
+  };
+
+  static u64 HashInputs(u32 entry_pc, u32 layout, const std::vector<MemoryCellType>& input_values);
+
+  const Result* FindResult(const Computer& comp, u32 entry_pc, s64 frame);
+  void StoreResult(const Computer& comp, const ActiveCall& call);
+
+  void PushCall(u32 entry_pc, u32 return_pc, s64 frame);
+  void PopCall(const Computer& comp);
+  void SkipCall(Computer& comp, const Result& result, u32 return_pc, s64 frame);
+
+  void RecordAccess(s64 address, bool write, MemoryCellType value);
+  void RecordOperandAccesses(const Computer& comp, const Instruction& instr);
+  void MarkNotMemoizable(u32 index);
+  void MarkAllNotMemoizable();
+
+  std::vector<ActiveCall> m_active_calls;
+  u32 m_num_active_calls = 0;
+  u32 m_first_memoizable_call = 0; // calls below this one are not memoizable
+
+  std::unordered_map<u32, Function> m_functions;
+  std::unordered_multimap<u64, u32> m_result_index;
+  std::vector<Result> m_results;
+
+  // scratch space, reused between calls
+  std::vector<MemoryCellType> m_input_values;
+  CellValues m_outputs;
+
+  u64 m_call_count = 0;
+  u64 m_skipped_call_count = 0;
+};
+
+} // namespace Intcode
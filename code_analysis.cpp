@@ -0,0 +1,566 @@
+#include "code_analysis.h"
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+
+namespace Intcode {
+
+namespace {
+
+struct Successors
+{
+  u32 pcs[2];
+  u32 count = 0;
+  bool falls_through = false;
+  bool indirect = false;
+};
+
+// Immediate operands of a branch are only trusted while nothing writes to their cells.
+Successors GetSuccessors(const std::vector<u8>& cell_flags, u32 pc, const Instruction& instr)
+{
+  Successors succ;
+  if (instr.opcode == Opcode::halt)
+    return succ;
+
+  if (instr.opcode != Opcode::jnz && instr.opcode != Opcode::jz)
+  {
+    succ.pcs[succ.count++] = pc + instr.length;
+    succ.falls_through = true;
+    return succ;
+  }
+
+  const auto is_written = [&cell_flags](u32 address) {
+    return (address < cell_flags.size() && (cell_flags[address] & CodeAnalysis::CELL_WRITTEN));
+  };
+
+  // branches on an immediate condition always or never go to the target
+  bool may_branch = true;
+  succ.falls_through = true;
+  if (instr.operand_modes[0] == OperandMode::Immediate && !is_written(pc + 1))
+  {
+    const bool nonzero = (instr.operand_values[0] != 0);
+    may_branch = (instr.opcode == Opcode::jnz) ? nonzero : !nonzero;
+    succ.falls_through = !may_branch;
+  }
+
+  if (succ.falls_through)
+    succ.pcs[succ.count++] = pc + instr.length;
+
+  if (may_branch)
+  {
+    const MemoryCellType target = instr.operand_values[1];
+    succ.indirect = (instr.operand_modes[1] != OperandMode::Immediate || is_written(pc + 2));
+    if (instr.operand_modes[1] == OperandMode::Immediate && target >= 0 &&
+        target <= static_cast<MemoryCellType>(UINT32_MAX))
+    {
+      succ.pcs[succ.count++] = static_cast<u32>(target);
+    }
+  }
+
+  return succ;
+}
+
+bool EndsBlock(const Instruction& instr)
+{
+  return (instr.opcode == Opcode::jnz || instr.opcode == Opcode::jz || instr.opcode == Opcode::halt);
+}
+
+s32 GetWrittenOperand(const Instruction& instr)
+{
+  switch (instr.opcode)
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::slt:
+    case Opcode::seq:
+      return 2;
+
+    case Opcode::in:
+      return 0;
+
+    default:
+      return -1;
+  }
+}
+
+void AppendNumber(std::string* str, u64 value, u32 min_width = 0)
+{
+  char buffer[32];
+  char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+  const u32 length = static_cast<u32>(end - buffer);
+  if (length < min_width)
+    str->append(min_width - length, ' ');
+
+  str->append(buffer, end);
+}
+
+void AppendSignedNumber(std::string* str, s64 value)
+{
+  char buffer[32];
+  str->append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+void AppendLabel(std::string* str, u32 pc)
+{
+  str->push_back('L');
+  AppendNumber(str, pc);
+}
+
+} // namespace
+
+CodeAnalysis::CodeAnalysis(const CodeVector& code, u32 entry_pc)
+  : m_code(code), m_entry_pc(entry_pc), m_cell_flags(code.size())
+{
+  FindInstructions();
+  FindBlocks();
+  FindSelfModifyingWrites();
+  FindLoops();
+}
+
+const CodeAnalysis::AnalyzedInstruction* CodeAnalysis::FindInstruction(u32 pc) const
+{
+  const auto it = std::lower_bound(m_instructions.begin(), m_instructions.end(), pc,
+                                   [](const AnalyzedInstruction& ai, u32 value) { return ai.pc < value; });
+  return (it != m_instructions.end() && it->pc == pc) ? &(*it) : nullptr;
+}
+
+u32 CodeAnalysis::FindBlock(u32 pc) const
+{
+  const AnalyzedInstruction* ai = FindInstruction(pc);
+  return ai ? ai->block : NO_BLOCK;
+}
+
+void CodeAnalysis::FindInstructions()
+{
+  // Writes to branch operands can only be seen once the code doing them is found, and change which branches are
+  // followed. Written cells only ever accumulate, so repeat until no new branch operand is written.
+  for (;;)
+  {
+    FollowControlFlow();
+
+    bool branch_written = false;
+    for (const AnalyzedInstruction& ai : m_instructions)
+    {
+      const s32 operand = GetWrittenOperand(ai.instr);
+      const MemoryCellType address = (operand >= 0) ? ai.instr.operand_values[operand] : -1;
+      if (operand < 0 || ai.instr.operand_modes[operand] != OperandMode::Positional || address < 0 ||
+          static_cast<u64>(address) >= m_code.size() || (m_cell_flags[static_cast<size_t>(address)] & CELL_WRITTEN))
+      {
+        continue;
+      }
+
+      m_cell_flags[static_cast<size_t>(address)] |= CELL_WRITTEN;
+      for (u32 offset = 1; offset <= 2 && offset <= address; offset++)
+      {
+        const AnalyzedInstruction* branch = FindInstruction(static_cast<u32>(address - offset));
+        branch_written |= (branch && (branch->instr.opcode == Opcode::jnz || branch->instr.opcode == Opcode::jz));
+      }
+    }
+
+    if (!branch_written)
+      break;
+
+    for (u8& flags : m_cell_flags)
+      flags &= CELL_WRITTEN;
+    m_instructions.clear();
+  }
+}
+
+void CodeAnalysis::FollowControlFlow()
+{
+  const u64 code_size = m_code.size();
+  std::vector<bool> address_taken(code_size);
+  std::vector<u32> return_sites;
+  std::vector<u32> worklist;
+
+  const auto add_root = [&](u32 pc) {
+    if (pc < code_size)
+    {
+      m_cell_flags[pc] |= CELL_BLOCK_START;
+      worklist.push_back(pc);
+    }
+  };
+
+  add_root(m_entry_pc);
+  for (;;)
+  {
+    while (!worklist.empty())
+    {
+      const u32 pc = worklist.back();
+      worklist.pop_back();
+      if (pc >= code_size || (m_cell_flags[pc] & CELL_INSTRUCTION_START))
+        continue;
+
+      // cells past the end are zero in memory, which never makes a valid instruction longer
+      MemoryCellType cells[MAX_OPERANDS_PER_INSTRUCTION + 1];
+      for (u32 i = 0; i <= MAX_OPERANDS_PER_INSTRUCTION; i++)
+        cells[i] = ((pc + i) < code_size) ? m_code[pc + i] : 0;
+
+      Instruction instr;
+      if (!TryDecodeInstruction(cells, &instr) || (pc + instr.length) > code_size)
+        continue;
+
+      m_cell_flags[pc] |= CELL_INSTRUCTION_START;
+      for (u32 i = 0; i < instr.length; i++)
+        m_cell_flags[pc + i] |= CELL_INSTRUCTION;
+      m_instructions.push_back({pc, NO_BLOCK, instr});
+
+      const Successors succ = GetSuccessors(m_cell_flags, pc, instr);
+      const bool is_branch = (instr.opcode == Opcode::jnz || instr.opcode == Opcode::jz);
+      for (u32 i = 0; i < succ.count; i++)
+      {
+        if (is_branch)
+          add_root(succ.pcs[i]);
+        else
+          worklist.push_back(succ.pcs[i]);
+      }
+      if (!succ.falls_through)
+        return_sites.push_back(pc + instr.length);
+
+      if (!is_branch)
+      {
+        for (u32 i = 0; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
+        {
+          const MemoryCellType value = instr.operand_values[i];
+          if (instr.operand_modes[i] == OperandMode::Immediate && value >= 0 && static_cast<u64>(value) < code_size)
+            address_taken[static_cast<size_t>(value)] = true;
+        }
+      }
+    }
+
+    // each return site is only tried once, later instructions may still take its address
+    const auto first_taken = std::partition(return_sites.begin(), return_sites.end(),
+                                            [&](u32 pc) { return pc >= code_size || !address_taken[pc]; });
+    for (auto it = first_taken; it != return_sites.end(); ++it)
+      add_root(*it);
+    return_sites.erase(first_taken, return_sites.end());
+    if (worklist.empty())
+      break;
+  }
+
+  std::sort(m_instructions.begin(), m_instructions.end(),
+            [](const AnalyzedInstruction& lhs, const AnalyzedInstruction& rhs) { return lhs.pc < rhs.pc; });
+}
+
+void CodeAnalysis::FindBlocks()
+{
+  // blocks also start after anything ending one, and wherever the previous instruction does not run into this one
+  for (size_t i = 1; i < m_instructions.size(); i++)
+  {
+    const AnalyzedInstruction& prev = m_instructions[i - 1];
+    if (EndsBlock(prev.instr) || (prev.pc + prev.instr.length) != m_instructions[i].pc)
+      m_cell_flags[m_instructions[i].pc] |= CELL_BLOCK_START;
+  }
+
+  for (u32 i = 0; i < m_instructions.size(); i++)
+  {
+    AnalyzedInstruction& ai = m_instructions[i];
+    if (m_blocks.empty() || (m_cell_flags[ai.pc] & CELL_BLOCK_START))
+    {
+      m_cell_flags[ai.pc] |= CELL_BLOCK_START;
+      m_blocks.push_back({ai.pc, ai.pc, i, 0, false, false, false, {}, {}});
+    }
+
+    Block& block = m_blocks.back();
+    block.end_pc = ai.pc + ai.instr.length;
+    block.num_instructions++;
+    ai.block = static_cast<u32>(m_blocks.size() - 1);
+  }
+
+  for (u32 i = 0; i < m_blocks.size(); i++)
+  {
+    Block& block = m_blocks[i];
+    const AnalyzedInstruction& last = m_instructions[block.first_instruction + block.num_instructions - 1];
+    const Successors succ = GetSuccessors(m_cell_flags, last.pc, last.instr);
+    block.has_indirect_successor = succ.indirect;
+    for (u32 j = 0; j < succ.count; j++)
+    {
+      const u32 target = FindBlock(succ.pcs[j]);
+      if (target == NO_BLOCK || std::find(block.successors.begin(), block.successors.end(), target) !=
+                                  block.successors.end())
+      {
+        continue;
+      }
+
+      block.successors.push_back(target);
+      m_blocks[target].predecessors.push_back(i);
+    }
+  }
+}
+
+void CodeAnalysis::FindSelfModifyingWrites()
+{
+  for (const AnalyzedInstruction& ai : m_instructions)
+  {
+    const s32 operand = GetWrittenOperand(ai.instr);
+    if (operand < 0)
+      continue;
+
+    const MemoryCellType address = ai.instr.operand_values[operand];
+    if (ai.instr.operand_modes[operand] == OperandMode::Relative)
+    {
+      m_has_relative_writes = true;
+      continue;
+    }
+    if (ai.instr.operand_modes[operand] != OperandMode::Positional || address < 0 ||
+        static_cast<u64>(address) >= m_code.size())
+    {
+      continue;
+    }
+
+    m_cell_flags[static_cast<size_t>(address)] |= CELL_WRITTEN;
+    if (IsCode(static_cast<u32>(address)))
+      m_self_modifying_writes.push_back({ai.pc, static_cast<u32>(address)});
+  }
+
+  for (Block& block : m_blocks)
+  {
+    for (u32 pc = block.start_pc; pc < block.end_pc && !block.is_written; pc++)
+      block.is_written = (m_cell_flags[pc] & CELL_WRITTEN) != 0;
+  }
+}
+
+void CodeAnalysis::FindLoops()
+{
+  // Depth first search for back edges, an edge to a block still on the stack closes a loop.
+  enum : u8
+  {
+    UNVISITED,
+    ON_STACK,
+    DONE
+  };
+
+  std::vector<u8> state(m_blocks.size(), UNVISITED);
+  std::vector<std::pair<u32, u32>> back_edges;
+  std::vector<std::pair<u32, u32>> stack;
+
+  // start from the entry point, then pick up blocks only reachable through indirect branches
+  std::vector<u32> roots;
+  if (FindBlock(m_entry_pc) != NO_BLOCK)
+    roots.push_back(FindBlock(m_entry_pc));
+  for (u32 i = 0; i < m_blocks.size(); i++)
+    roots.push_back(i);
+
+  for (const u32 start : roots)
+  {
+    if (state[start] != UNVISITED)
+      continue;
+
+    state[start] = ON_STACK;
+    stack.emplace_back(start, 0);
+    while (!stack.empty())
+    {
+      auto& [block, next_successor] = stack.back();
+      if (next_successor == m_blocks[block].successors.size())
+      {
+        state[block] = DONE;
+        stack.pop_back();
+        continue;
+      }
+
+      const u32 succ = m_blocks[block].successors[next_successor++];
+      if (state[succ] == ON_STACK)
+      {
+        back_edges.emplace_back(block, succ);
+      }
+      else if (state[succ] == UNVISITED)
+      {
+        state[succ] = ON_STACK;
+        stack.emplace_back(succ, 0);
+      }
+    }
+  }
+
+  // The body of each loop is every block which reaches the back edge without passing through the header.
+  std::vector<bool> in_loop(m_blocks.size());
+  std::sort(back_edges.begin(), back_edges.end(),
+            [](const auto& lhs, const auto& rhs) { return lhs.second < rhs.second; });
+  for (size_t i = 0; i < back_edges.size();)
+  {
+    const u32 header = back_edges[i].second;
+    m_blocks[header].is_loop_header = true;
+
+    Loop loop;
+    loop.header = header;
+    std::fill(in_loop.begin(), in_loop.end(), false);
+    in_loop[header] = true;
+
+    std::vector<u32> worklist;
+    for (; i < back_edges.size() && back_edges[i].second == header; i++)
+      worklist.push_back(back_edges[i].first);
+
+    while (!worklist.empty())
+    {
+      const u32 block = worklist.back();
+      worklist.pop_back();
+      if (in_loop[block])
+        continue;
+
+      in_loop[block] = true;
+      loop.blocks.push_back(block);
+      for (const u32 pred : m_blocks[block].predecessors)
+        worklist.push_back(pred);
+    }
+
+    std::sort(loop.blocks.begin(), loop.blocks.end());
+    loop.blocks.insert(loop.blocks.begin(), header);
+    m_loops.push_back(std::move(loop));
+  }
+}
+
+void CodeAnalysis::AppendListing(std::string* str) const
+{
+  u32 address_width = 1;
+  for (u64 size = m_code.size(); size >= 10; size /= 10)
+    address_width++;
+
+  str->append("; entry point ");
+  AppendNumber(str, m_entry_pc);
+  str->append(", ");
+  AppendNumber(str, m_instructions.size());
+  str->append(" instructions in ");
+  AppendNumber(str, m_blocks.size());
+  str->append(" blocks, ");
+  AppendNumber(str, m_loops.size());
+  str->append(" loops, ");
+  AppendNumber(str, m_self_modifying_writes.size());
+  str->append(" self-modifying writes");
+  if (m_has_relative_writes)
+    str->append(", relative writes not resolved");
+  str->push_back('\n');
+  for (const Loop& loop : m_loops)
+  {
+    str->append("; loop at ");
+    AppendLabel(str, m_blocks[loop.header].start_pc);
+    str->append(", ");
+    AppendNumber(str, loop.blocks.size());
+    str->append(" blocks\n");
+  }
+
+  enum : u32
+  {
+    DATA_CELLS_PER_ROW = 8
+  };
+
+  size_t next_instruction = 0;
+  for (u32 pc = 0; pc < m_code.size();)
+  {
+    const u8 flags = m_cell_flags[pc];
+    if (flags & CELL_INSTRUCTION_START)
+    {
+      const AnalyzedInstruction& ai = m_instructions[next_instruction++];
+      assert(ai.pc == pc);
+      if (flags & CELL_BLOCK_START)
+      {
+        const Block& block = m_blocks[ai.block];
+        str->push_back('\n');
+        AppendLabel(str, pc);
+        str->push_back(':');
+        if (pc == m_entry_pc)
+          str->append(" ; entry");
+        if (block.is_loop_header)
+          str->append(" ; loop header");
+        if (block.is_written)
+          str->append(" ; modified by the program");
+        str->push_back('\n');
+      }
+
+      str->append("  ");
+      AppendNumber(str, pc, address_width);
+      str->append("  ");
+      ai.instr.AppendDisassembly(str);
+
+      const s32 operand = GetWrittenOperand(ai.instr);
+      if (operand >= 0 && ai.instr.operand_modes[operand] == OperandMode::Positional &&
+          ai.instr.operand_values[operand] >= 0 && static_cast<u64>(ai.instr.operand_values[operand]) < m_code.size() &&
+          IsCode(static_cast<u32>(ai.instr.operand_values[operand])))
+      {
+        str->append(" ; writes code");
+      }
+      const Block& block = m_blocks[ai.block];
+      if (block.has_indirect_successor && (ai.pc + ai.instr.length) == block.end_pc)
+        str->append(" ; indirect");
+
+      str->push_back('\n');
+      pc++;
+      continue;
+    }
+
+    // operands are printed with their instruction
+    if (flags & CELL_INSTRUCTION)
+    {
+      pc++;
+      continue;
+    }
+
+    str->append("  ");
+    AppendNumber(str, pc, address_width);
+    str->append("  data ");
+    for (u32 count = 0; count < DATA_CELLS_PER_ROW && pc < m_code.size() && !(m_cell_flags[pc] & CELL_INSTRUCTION);
+         count++, pc++)
+    {
+      if (count > 0)
+        str->append(", ");
+      AppendSignedNumber(str, m_code[pc]);
+    }
+    str->push_back('\n');
+  }
+}
+
+void CodeAnalysis::AppendCFG(std::string* str) const
+{
+  str->append("digraph cfg {\n  node [shape=box, fontname=\"monospace\"];\n");
+  bool has_indirect = false;
+  for (const Block& block : m_blocks)
+  {
+    str->append("  ");
+    AppendLabel(str, block.start_pc);
+    str->append(" [label=\"");
+    AppendLabel(str, block.start_pc);
+    str->append(":\\l");
+    for (u32 i = 0; i < block.num_instructions; i++)
+    {
+      str->append("  ");
+      m_instructions[block.first_instruction + i].instr.AppendDisassembly(str);
+      str->append("\\l");
+    }
+    str->push_back('"');
+    if (block.is_loop_header)
+      str->append(", penwidth=2");
+    if (block.is_written)
+      str->append(", color=red");
+    str->append("];\n");
+    has_indirect |= block.has_indirect_successor;
+  }
+
+  if (has_indirect)
+    str->append("  indirect [shape=ellipse, label=\"indirect\"];\n");
+  if (!m_blocks.empty() && FindBlock(m_entry_pc) != NO_BLOCK)
+  {
+    str->append("  entry [shape=point];\n  entry -> ");
+    AppendLabel(str, m_entry_pc);
+    str->append(";\n");
+  }
+
+  for (const Block& block : m_blocks)
+  {
+    for (const u32 succ : block.successors)
+    {
+      str->append("  ");
+      AppendLabel(str, block.start_pc);
+      str->append(" -> ");
+      AppendLabel(str, m_blocks[succ].start_pc);
+      str->append(";\n");
+    }
+    if (block.has_indirect_successor)
+    {
+      str->append("  ");
+      AppendLabel(str, block.start_pc);
+      str->append(" -> indirect [style=dashed];\n");
+    }
+  }
+
+  str->append("}\n");
+}
+
+} // namespace Intcode
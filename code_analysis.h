@@ -0,0 +1,109 @@
+#pragma once
+#include "intcode.h"
+#include <string>
+#include <vector>
+
+namespace Intcode {
+
+// Static analysis of a program's initial memory. Instructions are found by following control flow from the entry
+// point, everything else is treated as data. Branches through memory cannot be followed, the one pattern recognized is
+// a return site: an address materialized as an immediate which lands right after an instruction that never falls
+// through, as pushed by a call sequence.
+//
+// Writes through relative operands are not resolved, so code those can reach is only known to be unmodified when
+// HasRelativeWrites() is false.
+class CodeAnalysis
+{
+public:
+  enum : u8
+  {
+    CELL_INSTRUCTION_START = (1 << 0), // a reachable instruction starts at this cell
+    CELL_INSTRUCTION = (1 << 1),       // this cell is part of at least one reachable instruction
+    CELL_BLOCK_START = (1 << 2),       // a basic block starts at this cell
+    CELL_WRITTEN = (1 << 3),           // a reachable instruction writes this cell through a positional operand
+  };
+
+  enum : u32
+  {
+    NO_BLOCK = 0xFFFFFFFFu
+  };
+
+  struct AnalyzedInstruction
+  {
+    u32 pc;
+    u32 block;
+    Instruction instr;
+  };
+
+  struct Block
+  {
+    u32 start_pc;
+    u32 end_pc; // one past the last cell of the last instruction
+    u32 first_instruction;
+    u32 num_instructions;
+    bool has_indirect_successor; // ends in a branch whose target is read from memory
+    bool is_loop_header;
+    bool is_written; // some reachable instruction writes one of the block's cells
+    std::vector<u32> successors;
+    std::vector<u32> predecessors;
+  };
+
+  struct SelfModifyingWrite
+  {
+    u32 pc;
+    u32 address;
+  };
+
+  struct Loop
+  {
+    u32 header;
+    std::vector<u32> blocks; // header first, then the rest of the body in address order
+  };
+
+  explicit CodeAnalysis(const CodeVector& code, u32 entry_pc = 0);
+
+  u32 GetEntryPC() const { return m_entry_pc; }
+  const CodeVector& GetCode() const { return m_code; }
+  u8 GetCellFlags(u32 address) const { return (address < m_cell_flags.size()) ? m_cell_flags[address] : 0; }
+  bool IsCode(u32 address) const { return (GetCellFlags(address) & CELL_INSTRUCTION) != 0; }
+  bool HasRelativeWrites() const { return m_has_relative_writes; }
+
+  const std::vector<AnalyzedInstruction>& GetInstructions() const { return m_instructions; }
+  const std::vector<Block>& GetBlocks() const { return m_blocks; }
+  const std::vector<SelfModifyingWrite>& GetSelfModifyingWrites() const { return m_self_modifying_writes; }
+  const std::vector<Loop>& GetLoops() const { return m_loops; }
+
+  // Returns the reachable instruction starting at pc, or null.
+  const AnalyzedInstruction* FindInstruction(u32 pc) const;
+
+  // Returns the index of the block containing an instruction starting at pc, or NO_BLOCK.
+  u32 FindBlock(u32 pc) const;
+
+  // A block is safe to cache or compile ahead of time when nothing the analysis can see writes to it.
+  bool IsBlockStable(u32 block) const { return !m_blocks[block].is_written && !m_has_relative_writes; }
+
+  // Assembler-style listing of the whole program, with labels at block starts and data cells grouped in rows.
+  void AppendListing(std::string* str) const;
+
+  // Control flow graph in Graphviz dot format.
+  void AppendCFG(std::string* str) const;
+
+private:
+  void FindInstructions();
+  void FollowControlFlow();
+  void FindBlocks();
+  void FindSelfModifyingWrites();
+  void FindLoops();
+
+  CodeVector m_code;
+  u32 m_entry_pc;
+  bool m_has_relative_writes = false;
+
+  std::vector<u8> m_cell_flags;
+  std::vector<AnalyzedInstruction> m_instructions;
+  std::vector<Block> m_blocks;
+  std::vector<SelfModifyingWrite> m_self_modifying_writes;
+  std::vector<Loop> m_loops;
+};
+
+} // namespace Intcode
@@ -1,6 +1,9 @@
+#include "event_loop.h"
+#include "grid.h"
 #include "intcode.h"
-#include <map>
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 using Coordinates = std::pair<int, int>;
 enum class Colour
@@ -8,7 +11,7 @@ enum class Colour
   Black,
   White
 };
-std::map<Coordinates, Colour> pained_coordinates;
+Intcode::Grid<Colour, 2> pained_coordinates;
 
 enum class Direction
 {
@@ -20,133 +23,137 @@ enum class Direction
 
 Colour GetColour(const Coordinates& c)
 {
-  auto it = pained_coordinates.find(c);
-  if (it == pained_coordinates.end())
-    return Colour::Black;
-
-  return it->second;
+  return pained_coordinates.Get(c.first, c.second);
 }
 
 void SetColour(const Coordinates& c, Colour colour)
 {
   printf("painting color %d,%d %s\n", c.first, c.second, colour == Colour::Black ? "black" : "white");
-  pained_coordinates[c] = colour;
+  pained_coordinates.Set(c.first, c.second, colour);
 }
 
-int main(int argc, char* argv[])
+struct Bounds
 {
-  auto code = Intcode::ParseCodeFromFile("day11-input.txt");
-
-  Coordinates pos{};
-  Direction dir = Direction::Up;
-  bool waiting_for_dir = false;
-
-  // p2
   int min_x = 0;
   int max_x = 0;
   int min_y = 0;
   int max_y = 0;
-  SetColour(pos, Colour::White);
+};
 
-  Intcode::Computer comp(code);
+// the robot reads the colour under it, then outputs the colour to paint and which way to turn
+Intcode::Task RunRobot(Intcode::Machine& robot, Bounds& bounds)
+{
+  Coordinates pos{};
+  Direction dir = Direction::Up;
 
-  Intcode::Computer::State state;
-  while ((state = comp.Run()) != Intcode::Computer::State::Halted)
+  for (;;)
   {
-    if (state == Intcode::Computer::State::WaitingForInput)
+    const auto event = co_await robot.Next<2>();
+    if (event.kind == Intcode::MachineEvent<2>::Kind::Halted)
+      break;
+
+    if (event.kind == Intcode::MachineEvent<2>::Kind::InputRequested)
     {
       printf("query (%d,%d)\n", pos.first, pos.second);
-      comp.SetInput(GetColour(pos) == Colour::Black ? 0 : 1);
+      co_await robot.Write(GetColour(pos) == Colour::Black ? 0 : 1);
+      continue;
     }
-    else if (state == Intcode::Computer::State::WaitingForOutput)
+
+    const auto [colour, turn] = event.values;
+    SetColour(pos, colour == 0 ? Colour::Black : Colour::White);
+
+    printf("turn %d\n", (int)turn);
+    if (turn == 0)
     {
-      const auto output = comp.GetOutput();
-      if (!waiting_for_dir)
+      // turn left
+      switch (dir)
       {
-        // giving us the colour to paint
-        SetColour(pos, output == 0 ? Colour::Black : Colour::White);
-        waiting_for_dir = true;
+        case Direction::Up:
+          dir = Direction::Right;
+          break;
+        case Direction::Right:
+          dir = Direction::Down;
+          break;
+        case Direction::Down:
+          dir = Direction::Left;
+          break;
+        case Direction::Left:
+          dir = Direction::Up;
+          break;
+        default:
+          break;
       }
-      else
+    }
+    else
+    {
+      // turn right
+      switch (dir)
       {
-        printf("turn %d\n", (int)output);
-        if (output == 0)
-        {
-          // turn left
-          switch (dir)
-          {
-            case Direction::Up:
-              dir = Direction::Right;
-              break;
-            case Direction::Right:
-              dir = Direction::Down;
-              break;
-            case Direction::Down:
-              dir = Direction::Left;
-              break;
-            case Direction::Left:
-              dir = Direction::Up;
-              break;
-            default:
-              break;
-          }
-        }
-        else
-        {
-          // turn right
-          switch (dir)
-          {
-            case Direction::Up:
-              dir = Direction::Left;
-              break;
-            case Direction::Right:
-              dir = Direction::Up;
-              break;
-            case Direction::Down:
-              dir = Direction::Right;
-              break;
-            case Direction::Left:
-              dir = Direction::Down;
-              break;
-            default:
-              break;
-          }
-        }
-
-        // move forward
-        switch (dir)
-        {
-          case Direction::Up:
-            pos.second -= 1;
-            break;
-          case Direction::Right:
-            pos.first += 1;
-            break;
-          case Direction::Down:
-            pos.second += 1;
-            break;
-          case Direction::Left:
-            pos.first -= 1;
-            break;
-          default:
-            break;
-        }
-        printf("now at %d,%d\n", pos.first, pos.second);
-        waiting_for_dir = false;
-        min_x = std::min(min_x, pos.first);
-        min_y = std::min(min_y, pos.second);
-        max_x = std::max(max_x, pos.first);
-        max_y = std::max(max_y, pos.second);
+        case Direction::Up:
+          dir = Direction::Left;
+          break;
+        case Direction::Right:
+          dir = Direction::Up;
+          break;
+        case Direction::Down:
+          dir = Direction::Right;
+          break;
+        case Direction::Left:
+          dir = Direction::Down;
+          break;
+        default:
+          break;
       }
     }
+
+    // move forward
+    switch (dir)
+    {
+      case Direction::Up:
+        pos.second -= 1;
+        break;
+      case Direction::Right:
+        pos.first += 1;
+        break;
+      case Direction::Down:
+        pos.second += 1;
+        break;
+      case Direction::Left:
+        pos.first -= 1;
+        break;
+      default:
+        break;
+    }
+    printf("now at %d,%d\n", pos.first, pos.second);
+    bounds.min_x = std::min(bounds.min_x, pos.first);
+    bounds.min_y = std::min(bounds.min_y, pos.second);
+    bounds.max_x = std::max(bounds.max_x, pos.first);
+    bounds.max_y = std::max(bounds.max_y, pos.second);
   }
+}
+
+int main(int argc, char* argv[])
+{
+  auto code = Intcode::ParseCodeFromFile("day11-input.txt");
+
+  // p2
+  Bounds bounds;
+  SetColour(Coordinates{}, Colour::White);
+
+  Intcode::Computer comp(code);
+  Intcode::EventLoop loop;
+  Intcode::Machine robot(loop, comp);
+  const Intcode::Task task = RunRobot(robot, bounds);
+  loop.Run();
 
-  printf("%zu\n", pained_coordinates.size());
+  printf("%zu\n", pained_coordinates.GetSetCount());
 
-  for (int y = min_y; y <= max_y; y++)
+  std::vector<Colour> row(bounds.max_x - bounds.min_x + 1);
+  for (int y = bounds.min_y; y <= bounds.max_y; y++)
   {
-    for (int x = max_x; x >= min_x; x--)
-      printf("%c", GetColour(Coordinates(x, y)) == Colour::White ? '*' : ' ');
+    pained_coordinates.CopyRow(y, bounds.min_x, bounds.max_x, row.data());
+    for (auto it = row.rbegin(); it != row.rend(); ++it)
+      printf("%c", *it == Colour::White ? '*' : ' ');
     printf("\n");
   }
 
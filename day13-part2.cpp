@@ -1,90 +1,57 @@
+#include "arcade.h"
+#include "event_loop.h"
 #include "intcode.h"
-#include <map>
-#include <utility>
-
-using Coordinates = std::pair<int, int>;
-enum class TileType
-{
-  Empty = 0,
-  Wall = 1,
-  Block =2,
-  HorPaddle =3,
-  Ball = 4
-};
-std::map<Coordinates, TileType> pained_coordinates;
-Coordinates paddle_position;
-Coordinates ball_position;
-int score;
-
-enum class Direction
-{
-  Up,
-  Right,
-  Down,
-  Left
-};
-
-TileType GetTile(const Coordinates& c)
-{
-  auto it = pained_coordinates.find(c);
-  if (it == pained_coordinates.end())
-    return TileType::Empty;
-
-  return it->second;
-}
-
-void SetColour(const Coordinates& c, Intcode::MemoryCellType colour)
-{
-  //printf("painting color %d,%d %d\n", c.first, c.second, (int)colour);
-  pained_coordinates[c] = static_cast<TileType>(colour);
-}
-
-void Draw()
+#include "recording.h"
+#include "scope_timer.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// the game outputs x, y, tile triples, or -1, 0, score, and asks for the joystick position once a frame is complete
+Intcode::Task PlayGame(Intcode::Machine& game, Intcode::Arcade& arcade, bool draw)
 {
-  int min_x = 999999;
-  int max_x = -999999;
-  int min_y = 999999;
-  int max_y = -999999;
-
-  for (const auto& it : pained_coordinates)
+  for (bool halted = false; !halted;)
   {
-    const auto& pos = it.first;
-    min_x = std::min(min_x, pos.first);
-    min_y = std::min(min_y, pos.second);
-    max_x = std::max(max_x, pos.first);
-    max_y = std::max(max_y, pos.second);
-  }
-
-  for (int y = min_y; y <= max_y; y++)
-  {
-    for (int x = max_x; x >= min_x; x--)
+    // a frame lasts until the joystick is read, the time spent in it outside of run is spent in the host
+    ScopeTimer frame_timer("frame");
+    for (;;)
     {
-      TileType t = GetTile(Coordinates(x, y));
-      if (t == TileType::Ball)
-      {
-        //putchar('o');
-        ball_position = Coordinates(x, y);
-      }
-      else if (t == TileType::Block)
-      {
-        //putchar('#');
-      }
-      else if (t == TileType::HorPaddle)
-      {
-        //putchar('-');
-        paddle_position = Coordinates(x, y);
-      }
-      else if (t == TileType::Wall)
+      ScopeTimer run_timer("run");
+      const auto event = co_await game.Next<3>();
+      run_timer.Stop();
+
+      if (event.kind == Intcode::MachineEvent<3>::Kind::Halted)
       {
-        //putchar('*');
+        halted = true;
+        break;
       }
-      else
+
+      if (event.kind == Intcode::MachineEvent<3>::Kind::InputRequested)
       {
-        //putchar(' ');
+        if (draw)
+          arcade.Render(stdout);
+
+        int val;
+#if 0
+        int ch = getchar();
+        if (ch == 'a' || ch == 'A')
+          val = -1;
+        else if (ch == 'd' || ch == 'D')
+          val = 1;
+        else
+          val = 0;
+#else
+        val = arcade.GetAutopilotInput();
+#endif
+
+        co_await game.Write(val);
+        break;
       }
+
+      if (!arcade.OnOutput(event.values[0], event.values[1], event.values[2]))
+        std::fprintf(stderr, "unknown tile %d\n", static_cast<int>(event.values[2]));
     }
-      
-    printf("\n");
   }
 }
 
@@ -92,77 +59,54 @@ int main(int argc, char* argv[])
 {
   auto code = Intcode::ParseCodeFromFile("day13-input.txt");
 
-  int tstate = 0;
-  Coordinates pos{};
-
+  // the frame is only drawn when input is requested, so queue up all the tile updates before then
   Intcode::Computer comp(code);
+  comp.SetOutputQueueCapacity(3 * 1024);
   comp.WriteMemory(0, 2);
 
-  Intcode::Computer::State state;
-  while ((state = comp.Run()) != Intcode::Computer::State::Halted)
+  // day13-part2 [--draw] [--record <file>] [timer dump file], replay recordings with intcode-replay
+  Intcode::Recorder recorder;
+  int arg = 1;
+  bool draw = false;
+  if (argc > arg && std::strcmp(argv[arg], "--draw") == 0)
+  {
+    draw = true;
+    arg++;
+  }
+  if (argc > arg + 1 && std::strcmp(argv[arg], "--record") == 0)
   {
-    if (state == Intcode::Computer::State::WaitingForInput)
+    std::string error;
+    if (!recorder.Open(argv[arg + 1], comp, Intcode::Recorder::Mode::Events, &error))
     {
-      Draw();
-
-      int val;
-#if 0
-      int ch = getchar();
-      if (ch == 'a' || ch == 'A')
-        val = -1;
-      else if (ch == 'd' || ch == 'D')
-        val = 1;
-      else
-        val = 0;
-#else
-      if (paddle_position.first < ball_position.first)
-        val = 1;
-      else if (paddle_position.first > ball_position.first)
-        val = -1;
-      else
-        val = 0;
-
-      comp.SetInput(val);
-#endif
+      std::fprintf(stderr, "%s: %s\n", argv[arg + 1], error.c_str());
+      return 1;
     }
-    else if (state == Intcode::Computer::State::WaitingForOutput)
-    {
-      if (tstate == 0)
-      {
-        pos.first = (int)comp.GetOutput();
-        tstate = 1;
-      }
-      else if (tstate == 1)
-      {
-        pos.second = (int)comp.GetOutput();
-        tstate = 2;
-      }
-      else
-      {
-        if (pos.first == -1 && pos.second == 0)
-        {
-          score = (int)comp.GetOutput();
-          printf("score: %d\n", score);
-        }
-        else
-        {
-          SetColour(pos, comp.GetOutput());
-        }
 
-        tstate = 0;
-      }
-    }
+    comp.SetRecorder(&recorder);
+    arg += 2;
   }
+  if (argc > arg)
+    ScopeTimer::DumpAtExit(argv[arg]);
 
-
-  printf("score at end: %d\n", score);
-  int count = 0;
-  for (const auto& it : pained_coordinates)
+  Intcode::Arcade arcade;
   {
-    if (it.second == TileType::Block)
-      count++;
+    ScopeTimer game_timer("game");
+    Intcode::EventLoop loop;
+    Intcode::Machine game(loop, comp);
+    const Intcode::Task task = PlayGame(game, arcade, draw);
+    loop.Run();
   }
-  printf("blocks: %d\n", count);
+
+  if (recorder.IsOpen())
+    recorder.Close(comp);
+
+  if (draw)
+    printf("\n");
+
+  printf("score at end: %" PRId64 "\n", arcade.GetScore());
+  printf("blocks: %zu\n", arcade.GetBlockCount());
+
+  ScopeTimer::PrintSummary();
 
   return 0;
 }
\ No newline at end of file
@@ -44,11 +44,13 @@ int main(int argc, char* argv[])
   Coordinates pos{};
 
   Intcode::Computer comp(code);
+  comp.SetOutputQueueCapacity(3 * 1024);
 
   Intcode::Computer::State state;
-  while ((state = comp.Run()) != Intcode::Computer::State::Halted)
+  do
   {
-    if (state == Intcode::Computer::State::WaitingForOutput)
+    state = comp.Run();
+    while (comp.HasOutput())
     {
       if (tstate == 0)
       {
@@ -66,7 +68,7 @@ int main(int argc, char* argv[])
         tstate = 0;
       }
     }
-  }
+  } while (state != Intcode::Computer::State::Halted);
 
   int count = 0;
   for (const auto& it : pained_coordinates) {
@@ -0,0 +1,333 @@
+#pragma once
+#include "intcode.h"
+#include <array>
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#if !defined(__cpp_impl_coroutine)
+#error "event_loop.h needs C++20 coroutines, build the host with CXX_STANDARD 20"
+#endif
+
+// Coroutine front-end for hosts talking to computers. Instead of looping over Run() and reassembling messages from
+// output states, a host is written as coroutines which co_await values from a machine and writes into it:
+//
+//   Intcode::Task Robot(Intcode::Machine& robot)
+//   {
+//     co_await robot.Write(GetColour(pos));
+//     while (const auto message = co_await robot.Read<2>())
+//       ...
+//   }
+//
+// Everything runs on the thread calling EventLoop::Run(). A machine's computer is only run while a coroutine is
+// waiting on it, and only as far as needed to satisfy the wait, so any number of machines can feed each other.
+// Suspending and resuming never allocates, the only allocation is each coroutine's frame.
+//
+// Header-only, the library itself builds as C++17.
+namespace Intcode {
+
+class EventLoop;
+class Machine;
+
+// Coroutine type for hosts. Starts running when called, up to its first suspension. Destroying the task destroys the
+// coroutine, so it has to be kept alive until it is done.
+class Task
+{
+public:
+  struct promise_type
+  {
+    Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  Task(Task&& task) noexcept : m_handle(std::exchange(task.m_handle, nullptr)) {}
+  ~Task()
+  {
+    if (m_handle)
+      m_handle.destroy();
+  }
+
+  Task& operator=(Task&& task) noexcept
+  {
+    if (this != &task)
+    {
+      if (m_handle)
+        m_handle.destroy();
+      m_handle = std::exchange(task.m_handle, nullptr);
+    }
+
+    return *this;
+  }
+
+  bool IsDone() const { return !m_handle || m_handle.done(); }
+
+private:
+  explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+  std::coroutine_handle<promise_type> m_handle;
+};
+
+// Resumes coroutines waiting on machines, running the machines' computers as needed.
+class EventLoop
+{
+public:
+  EventLoop() = default;
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  // Returns once no waiting coroutine can make progress, because every task is done, or because the machines they
+  // wait on are halted, or blocked on input nobody writes.
+  inline void Run();
+
+private:
+  friend Machine;
+
+  inline void Schedule(Machine* machine);
+
+  // machines with a waiting coroutine which may be able to make progress, linked through m_next_scheduled
+  Machine* m_first_scheduled = nullptr;
+  Machine* m_last_scheduled = nullptr;
+};
+
+// What a machine stopped for, see Machine::Next().
+template<u32 N>
+struct MachineEvent
+{
+  enum class Kind : u32
+  {
+    Values,
+    InputRequested,
+    Halted // also when a strict computer faults, see Computer::GetFault()
+  };
+
+  Kind kind;
+  std::array<MemoryCellType, N> values; // only set for Kind::Values
+};
+
+// A computer driven by an event loop. At most one coroutine can wait to read from a machine at a time, and at most
+// one to write to it. Output is only read through the machine, input can also be pushed to the computer directly
+// while nothing is waiting to write.
+class Machine
+{
+public:
+  Machine(EventLoop& loop, Computer& comp) : m_loop(loop), m_comp(comp) {}
+  Machine(const Machine&) = delete;
+  Machine& operator=(const Machine&) = delete;
+
+  Computer& GetComputer() const { return m_comp; }
+
+  // Resumes with the next N outputs, or when the computer blocks on input with nothing queued, or halts.
+  template<u32 N = 1>
+  auto Next()
+  {
+    return ReadAwaiter<N, true>(*this);
+  }
+
+  // Resumes with the next output, or the next N outputs as an array, or std::nullopt once the computer halts. Input
+  // requests are not reported, the read waits for someone to write instead. Outputs left when the computer halts
+  // without completing a group of N are dropped.
+  template<u32 N = 1>
+  auto Read()
+  {
+    return ReadAwaiter<N, false>(*this);
+  }
+
+  // Queues a value for the computer, resuming once there is room for it.
+  auto Write(MemoryCellType value) { return WriteAwaiter{*this, value}; }
+
+private:
+  friend EventLoop;
+
+  template<u32 N, bool report_input_requests>
+  class ReadAwaiter
+  {
+  public:
+    explicit ReadAwaiter(Machine& machine) : m_machine(machine)
+    {
+      // the computer has to be able to queue a whole group, it would block before completing one otherwise
+      static_assert(N > 0);
+      Computer& comp = machine.m_comp;
+      if (comp.GetOutputQueueCapacity() < N)
+        comp.SetOutputQueueCapacity(N);
+    }
+
+    bool await_ready() const { return m_machine.IsReadSatisfied(N, report_input_requests); }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      assert(!m_machine.m_reader && "one reader at a time");
+      m_machine.m_reader = handle;
+      m_machine.m_reader_count = N;
+      m_machine.m_reader_wants_input_requests = report_input_requests;
+      m_machine.m_loop.Schedule(&m_machine);
+    }
+
+    auto await_resume()
+    {
+      Computer& comp = m_machine.m_comp;
+      MachineEvent<N> event = {};
+      if (comp.GetPendingOutputCount() >= N)
+      {
+        event.kind = MachineEvent<N>::Kind::Values;
+        comp.DrainOutputs(event.values.data(), N);
+
+        // the computer may have been blocked on a full queue
+        if (m_machine.m_writer)
+          m_machine.m_loop.Schedule(&m_machine);
+      }
+      else if (comp.GetState() == Computer::State::Halted || comp.GetState() == Computer::State::Faulted)
+      {
+        event.kind = MachineEvent<N>::Kind::Halted;
+      }
+      else
+      {
+        event.kind = MachineEvent<N>::Kind::InputRequested;
+      }
+
+      if constexpr (report_input_requests)
+      {
+        return event;
+      }
+      else if constexpr (N == 1)
+      {
+        return (event.kind == MachineEvent<N>::Kind::Values) ? std::optional<MemoryCellType>(event.values[0]) :
+                                                                std::nullopt;
+      }
+      else
+      {
+        return (event.kind == MachineEvent<N>::Kind::Values) ?
+                 std::optional<std::array<MemoryCellType, N>>(event.values) :
+                 std::nullopt;
+      }
+    }
+
+  private:
+    Machine& m_machine;
+  };
+
+  struct WriteAwaiter
+  {
+    Machine& machine;
+    MemoryCellType value;
+
+    bool await_ready() const
+    {
+      if (!machine.m_comp.CanPushInput())
+        return false;
+
+      machine.m_comp.SetInput(value);
+
+      // a reader may be waiting for the computer to get past an input
+      if (machine.m_reader)
+        machine.m_loop.Schedule(&machine);
+
+      return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      assert(!machine.m_writer && "one writer at a time");
+      machine.m_writer = handle;
+      machine.m_write_value = value;
+      machine.m_loop.Schedule(&machine);
+    }
+
+    void await_resume() const {}
+  };
+
+  bool IsReadSatisfied(u32 count, bool report_input_requests) const
+  {
+    const Computer::State state = m_comp.GetState();
+    return (m_comp.GetPendingOutputCount() >= count) || (state == Computer::State::Halted) ||
+           (state == Computer::State::Faulted) ||
+           (report_input_requests && state == Computer::State::WaitingForInput && m_comp.GetPendingInputCount() == 0);
+  }
+
+  // Whether running the computer now would get anywhere.
+  bool CanRun() const
+  {
+    switch (m_comp.GetState())
+    {
+      case Computer::State::Halted:
+      case Computer::State::Faulted:
+        return false;
+      case Computer::State::WaitingForInput:
+        return m_comp.GetPendingInputCount() > 0;
+      case Computer::State::WaitingForOutput:
+        return m_comp.GetPendingOutputCount() < m_comp.GetOutputQueueCapacity();
+      default:
+        return true;
+    }
+  }
+
+  // Called by the loop, runs the computer and resumes whichever waiters it satisfied.
+  void Update()
+  {
+    if (!m_reader && !m_writer)
+      return;
+
+    if (CanRun())
+      m_comp.Run();
+
+    if (m_writer && m_comp.CanPushInput())
+    {
+      m_comp.SetInput(m_write_value);
+      std::exchange(m_writer, nullptr).resume();
+
+      // the input may let the computer get further
+      if (m_reader)
+        m_loop.Schedule(this);
+    }
+
+    if (m_reader && IsReadSatisfied(m_reader_count, m_reader_wants_input_requests))
+      std::exchange(m_reader, nullptr).resume();
+  }
+
+  EventLoop& m_loop;
+  Computer& m_comp;
+
+  std::coroutine_handle<> m_reader;
+  u32 m_reader_count = 0;
+  bool m_reader_wants_input_requests = false;
+
+  std::coroutine_handle<> m_writer;
+  MemoryCellType m_write_value = 0;
+
+  Machine* m_next_scheduled = nullptr;
+  bool m_scheduled = false;
+};
+
+void EventLoop::Run()
+{
+  while (m_first_scheduled)
+  {
+    Machine* machine = m_first_scheduled;
+    m_first_scheduled = machine->m_next_scheduled;
+    if (!m_first_scheduled)
+      m_last_scheduled = nullptr;
+
+    machine->m_next_scheduled = nullptr;
+    machine->m_scheduled = false;
+    machine->Update();
+  }
+}
+
+void EventLoop::Schedule(Machine* machine)
+{
+  if (machine->m_scheduled)
+    return;
+
+  machine->m_scheduled = true;
+  if (m_last_scheduled)
+    m_last_scheduled->m_next_scheduled = machine;
+  else
+    m_first_scheduled = machine;
+  m_last_scheduled = machine;
+}
+
+} // namespace Intcode
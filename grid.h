@@ -0,0 +1,218 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Intcode {
+
+// Unbounded 2D grid for hosts which draw what a program outputs. Cells live in dense square chunks, reached through a
+// flat directory which grows to cover every chunk written, so reads and writes are a couple of shifts and loads.
+//
+// Like map keys, a cell is either set or not: unset cells read as the default value, and the grid keeps the bounds of
+// the set cells and how many of them hold each value, so hosts do not have to scan it. Values have to convert to an
+// index below NUM_VALUES, which suits enums of tile types.
+template<typename T, size_t NUM_VALUES>
+class Grid
+{
+public:
+  struct Bounds
+  {
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+  };
+
+  Grid(T default_value = T()) : m_default_value(default_value) {}
+
+  T Get(int x, int y) const
+  {
+    const Chunk* chunk = GetChunk(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    return chunk ? chunk->cells[GetCellIndex(x, y)] : m_default_value;
+  }
+
+  bool IsSet(int x, int y) const
+  {
+    const Chunk* chunk = GetChunk(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    return chunk && chunk->IsSet(GetCellIndex(x, y));
+  }
+
+  void Set(int x, int y, T value)
+  {
+    assert(static_cast<size_t>(value) < NUM_VALUES);
+
+    Chunk& chunk = GetOrCreateChunk(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    const u32 index = GetCellIndex(x, y);
+    if (chunk.IsSet(index))
+    {
+      m_counts[static_cast<size_t>(chunk.cells[index])]--;
+    }
+    else
+    {
+      chunk.set_bits[index / 64] |= u64(1) << (index % 64);
+      if (m_set_count == 0)
+        m_bounds = Bounds{x, y, x, y};
+
+      m_bounds.min_x = std::min(m_bounds.min_x, x);
+      m_bounds.min_y = std::min(m_bounds.min_y, y);
+      m_bounds.max_x = std::max(m_bounds.max_x, x);
+      m_bounds.max_y = std::max(m_bounds.max_y, y);
+      m_set_count++;
+    }
+
+    chunk.cells[index] = value;
+    m_counts[static_cast<size_t>(value)]++;
+  }
+
+  void Clear()
+  {
+    m_chunks.clear();
+    m_chunk_min_x = 0;
+    m_chunk_min_y = 0;
+    m_chunk_columns = 0;
+    m_chunk_rows = 0;
+    m_counts = {};
+    m_set_count = 0;
+  }
+
+  // Number of cells set, and of those holding value.
+  size_t GetSetCount() const { return m_set_count; }
+  size_t GetCount(T value) const { return m_counts[static_cast<size_t>(value)]; }
+
+  // Smallest rectangle holding every set cell, inclusive. Only meaningful once a cell is set.
+  bool IsEmpty() const { return m_set_count == 0; }
+  const Bounds& GetBounds() const { return m_bounds; }
+
+  // Copies cells min_x..max_x of a row to out, a chunk at a time, for drawing.
+  void CopyRow(int y, int min_x, int max_x, T* out) const
+  {
+    for (int x = min_x; x <= max_x;)
+    {
+      const int chunk_end = std::min(max_x, x | CHUNK_MASK);
+      const Chunk* chunk = GetChunk(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+      if (chunk)
+      {
+        const T* cells = &chunk->cells[GetCellIndex(x, y)];
+        out = std::copy(cells, cells + (chunk_end - x + 1), out);
+      }
+      else
+      {
+        out = std::fill_n(out, chunk_end - x + 1, m_default_value);
+      }
+
+      x = chunk_end + 1;
+    }
+  }
+
+private:
+  using u32 = std::uint32_t;
+  using u64 = std::uint64_t;
+
+  enum : int
+  {
+    CHUNK_SHIFT = 5,
+    CHUNK_SIZE = 1 << CHUNK_SHIFT,
+    CHUNK_MASK = CHUNK_SIZE - 1,
+    CHUNK_AREA = CHUNK_SIZE * CHUNK_SIZE
+  };
+
+  struct Chunk
+  {
+    std::array<T, CHUNK_AREA> cells;
+    std::array<u64, CHUNK_AREA / 64> set_bits = {};
+
+    bool IsSet(u32 index) const { return (set_bits[index / 64] >> (index % 64)) & 1; }
+  };
+
+  // rows are contiguous within a chunk
+  static u32 GetCellIndex(int x, int y)
+  {
+    return (static_cast<u32>(y & CHUNK_MASK) << CHUNK_SHIFT) | static_cast<u32>(x & CHUNK_MASK);
+  }
+
+  const Chunk* GetChunk(int chunk_x, int chunk_y) const
+  {
+    // negative offsets wrap around to large ones, so one compare covers both sides
+    const u32 column = static_cast<u32>(chunk_x - m_chunk_min_x);
+    const u32 row = static_cast<u32>(chunk_y - m_chunk_min_y);
+    if (column >= m_chunk_columns || row >= m_chunk_rows)
+      return nullptr;
+
+    return m_chunks[size_t(row) * m_chunk_columns + column].get();
+  }
+
+  Chunk& GetOrCreateChunk(int chunk_x, int chunk_y)
+  {
+    const u32 column = static_cast<u32>(chunk_x - m_chunk_min_x);
+    const u32 row = static_cast<u32>(chunk_y - m_chunk_min_y);
+    if (column >= m_chunk_columns || row >= m_chunk_rows)
+      return GetOrCreateChunkSlow(chunk_x, chunk_y);
+
+    std::unique_ptr<Chunk>& chunk = m_chunks[size_t(row) * m_chunk_columns + column];
+    if (!chunk)
+      chunk = NewChunk();
+
+    return *chunk;
+  }
+
+  Chunk& GetOrCreateChunkSlow(int chunk_x, int chunk_y)
+  {
+    // grows at least twofold towards the new chunk, so a robot walking off in one direction only rebuilds the
+    // directory a logarithmic number of times
+    int min_x = chunk_x, min_y = chunk_y, max_x = chunk_x, max_y = chunk_y;
+    if (m_chunk_columns > 0)
+    {
+      const int old_max_x = m_chunk_min_x + static_cast<int>(m_chunk_columns) - 1;
+      const int old_max_y = m_chunk_min_y + static_cast<int>(m_chunk_rows) - 1;
+      const int columns = static_cast<int>(m_chunk_columns);
+      const int rows = static_cast<int>(m_chunk_rows);
+      min_x = (chunk_x < m_chunk_min_x) ? std::min(chunk_x, m_chunk_min_x - columns) : m_chunk_min_x;
+      min_y = (chunk_y < m_chunk_min_y) ? std::min(chunk_y, m_chunk_min_y - rows) : m_chunk_min_y;
+      max_x = (chunk_x > old_max_x) ? std::max(chunk_x, old_max_x + columns) : old_max_x;
+      max_y = (chunk_y > old_max_y) ? std::max(chunk_y, old_max_y + rows) : old_max_y;
+    }
+
+    const u32 columns = static_cast<u32>(max_x - min_x + 1);
+    const u32 rows = static_cast<u32>(max_y - min_y + 1);
+    std::vector<std::unique_ptr<Chunk>> chunks(size_t(columns) * rows);
+    for (u32 row = 0; row < m_chunk_rows; row++)
+    {
+      const size_t new_row = static_cast<size_t>(m_chunk_min_y - min_y) + row;
+      const size_t new_column = static_cast<size_t>(m_chunk_min_x - min_x);
+      for (u32 column = 0; column < m_chunk_columns; column++)
+        chunks[new_row * columns + new_column + column] = std::move(m_chunks[size_t(row) * m_chunk_columns + column]);
+    }
+
+    m_chunks = std::move(chunks);
+    m_chunk_min_x = min_x;
+    m_chunk_min_y = min_y;
+    m_chunk_columns = columns;
+    m_chunk_rows = rows;
+    return GetOrCreateChunk(chunk_x, chunk_y);
+  }
+
+  std::unique_ptr<Chunk> NewChunk() const
+  {
+    std::unique_ptr<Chunk> chunk = std::make_unique<Chunk>();
+    chunk->cells.fill(m_default_value);
+    return chunk;
+  }
+
+  // row major, m_chunk_columns by m_chunk_rows chunks starting at (m_chunk_min_x, m_chunk_min_y)
+  std::vector<std::unique_ptr<Chunk>> m_chunks;
+  int m_chunk_min_x = 0;
+  int m_chunk_min_y = 0;
+  u32 m_chunk_columns = 0;
+  u32 m_chunk_rows = 0;
+
+  T m_default_value;
+  std::array<size_t, NUM_VALUES> m_counts = {};
+  size_t m_set_count = 0;
+  Bounds m_bounds = {};
+};
+
+} // namespace Intcode
@@ -0,0 +1,376 @@
+#include "intcode.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using Intcode::CodeVector;
+using Intcode::Computer;
+using Intcode::MemoryCellType;
+using Intcode::u32;
+using Intcode::u64;
+
+namespace {
+
+struct Workload
+{
+  std::string name;
+  CodeVector code;
+  CodeVector input;
+  u32 queue_capacity;
+};
+
+struct Result
+{
+  u64 instructions;
+  u64 round_trips;
+  std::vector<double> seconds;
+};
+
+// Synthetic workloads, each stressing one part of the interpreter. Inputs are fixed so runs are repeatable.
+std::vector<Workload> GetBuiltinWorkloads()
+{
+  std::vector<Workload> workloads;
+
+  // sum += i + i * 3 for i in [0, n)
+  workloads.push_back({"arith-loop",
+                       Intcode::ParseCode("3,28,1,30,29,30,1002,29,3,32,1,30,32,30,1001,29,1,29,7,29,28,31,1005,31,2,4,"
+                                          "30,99,0,0,0,0,0"),
+                       {2000000},
+                       1});
+
+  // naive recursive fibonacci, calls and returns through the relative base
+  workloads.push_back({"recursive-fib",
+                       Intcode::ParseCode("109,67,203,1,21101,11,0,0,1106,0,14,204,2,99,109,4,21207,-3,2,-1,1206,-1,32,"
+                                          "21201,-3,0,-2,109,-4,2106,0,0,21201,-3,-1,1,21101,43,0,0,1106,0,14,21201,2,"
+                                          "0,-1,21201,-3,-2,1,21101,58,0,0,1106,0,14,22201,2,-1,-2,109,-4,2106,0,0,0"),
+                       {25},
+                       1});
+
+  // two outputs per iteration, with single value queues every output returns to the host
+  workloads.push_back({"io-emitter",
+                       Intcode::ParseCode("3,22,4,23,1002,23,7,24,4,24,1001,23,1,23,8,23,22,24,1006,24,2,99,0,0,0"),
+                       {200000},
+                       1});
+
+  // reads values until a zero, echoing each one twice
+  CodeVector echo_input;
+  for (MemoryCellType i = 1; i <= 100000; i++)
+    echo_input.push_back(i);
+  echo_input.push_back(0);
+  workloads.push_back({"io-echo",
+                       Intcode::ParseCode("3,19,1006,19,16,1002,19,2,20,4,20,4,19,1106,0,0,104,-1,99,0,0"),
+                       std::move(echo_input), 1});
+
+  // rewrites an operand of the loop body on every iteration
+  workloads.push_back({"self-modifying",
+                       Intcode::ParseCode("3,34,1001,36,1,36,1001,4,1,4,1002,4,1,15,101,0,36,38,1001,35,1,35,7,35,34,"
+                                          "37,1005,37,2,4,36,4,38,99,0,0,0,0,0"),
+                       {300000},
+                       1});
+
+  return workloads;
+}
+
+// Runs the workload to completion from a reset computer, returning the number of times Run() returned for I/O. With
+// inline_io, input and output go through a provider and sink instead, so Run() only returns when the program halts.
+// Every output is appended to outputs, so engines can be checked against each other.
+u64 RunWorkload(Computer& comp, const Workload& workload, bool inline_io, std::vector<MemoryCellType>* outputs)
+{
+  comp.Reset();
+  outputs->clear();
+
+  u64 round_trips = 0;
+  size_t input_pos = 0;
+  MemoryCellType drained[64];
+  if (inline_io)
+  {
+    comp.SetInputProvider([&workload, &input_pos](MemoryCellType* value) {
+      if (input_pos == workload.input.size())
+        return false;
+
+      *value = workload.input[input_pos++];
+      return true;
+    });
+    comp.SetOutputSink([outputs](MemoryCellType value) { outputs->push_back(value); });
+  }
+
+  for (;;)
+  {
+    input_pos +=
+      comp.PushInputs(workload.input.data() + input_pos, static_cast<u32>(workload.input.size() - input_pos));
+
+    const Computer::State state = comp.Run();
+    for (;;)
+    {
+      const u32 count = comp.DrainOutputs(drained, static_cast<u32>(std::size(drained)));
+      if (count == 0)
+        break;
+
+      outputs->insert(outputs->end(), drained, drained + count);
+    }
+
+    if (state == Computer::State::Halted)
+      break;
+
+    if (state == Computer::State::WaitingForInput && input_pos == workload.input.size())
+    {
+      std::fprintf(stderr, "%s: input requested and none available\n", workload.name.c_str());
+      std::exit(EXIT_FAILURE);
+    }
+
+    round_trips++;
+  }
+
+  comp.SetInputProvider(nullptr);
+  comp.SetOutputSink(nullptr);
+  return round_trips;
+}
+
+bool CheckOutputs(const Workload& workload, const char* engine_name, const std::vector<MemoryCellType>& expected,
+                  const std::vector<MemoryCellType>& outputs)
+{
+  if (outputs == expected)
+    return true;
+
+  const size_t index = static_cast<size_t>(
+    std::mismatch(outputs.begin(), outputs.end(), expected.begin(), expected.end()).first - outputs.begin());
+  if (index == outputs.size() || index == expected.size())
+  {
+    std::fprintf(stderr, "%s: %s produced %zu outputs, expected %zu\n", workload.name.c_str(), engine_name,
+                 outputs.size(), expected.size());
+  }
+  else
+  {
+    std::fprintf(stderr, "%s: %s output %zu is %" PRId64 ", expected %" PRId64 "\n", workload.name.c_str(),
+                 engine_name, index, outputs[index], expected[index]);
+  }
+
+  return false;
+}
+
+// Every run, including warm-up runs, has to reproduce the interpreter's outputs. A wrong result is not measured.
+bool Measure(const Workload& workload, Computer::Engine engine, const char* engine_name, u64 instructions,
+             const std::vector<MemoryCellType>& expected_outputs, u32 warmup, u32 repeat, bool inline_io,
+             Result* result)
+{
+  Computer comp(workload.code, 16384, engine);
+  comp.SetInputQueueCapacity(workload.queue_capacity);
+  comp.SetOutputQueueCapacity(workload.queue_capacity);
+
+  // warm-up runs fill the instruction cache and compile blocks, Reset() keeps both
+  *result = {instructions, 0, {}};
+  std::vector<MemoryCellType> outputs;
+  outputs.reserve(expected_outputs.size());
+  for (u32 i = 0; i < warmup; i++)
+  {
+    RunWorkload(comp, workload, inline_io, &outputs);
+    if (!CheckOutputs(workload, engine_name, expected_outputs, outputs))
+      return false;
+  }
+
+  for (u32 i = 0; i < repeat; i++)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    result->round_trips = RunWorkload(comp, workload, inline_io, &outputs);
+    const auto end = std::chrono::steady_clock::now();
+    result->seconds.push_back(std::chrono::duration<double>(end - start).count());
+    if (!CheckOutputs(workload, engine_name, expected_outputs, outputs))
+      return false;
+  }
+
+  return true;
+}
+
+// Counted with the profiler, which always interprets, so every engine is credited with the same work, including calls
+// the memoizing engine skips. The outputs of this run are the ones every engine has to match.
+u64 CountInstructions(const Workload& workload, std::vector<MemoryCellType>* outputs)
+{
+  Intcode::Profiler profiler;
+  Computer comp(workload.code);
+  comp.SetInputQueueCapacity(workload.queue_capacity);
+  comp.SetOutputQueueCapacity(workload.queue_capacity);
+  comp.SetProfiler(&profiler);
+  RunWorkload(comp, workload, false, outputs);
+  return profiler.GetInstructionCount();
+}
+
+bool ParseProgramArgument(const char* arg, Workload* workload)
+{
+  // file.txt or file.txt:1,2,3 to give the program input
+  const char* separator = std::strrchr(arg, ':');
+  if (separator == arg + 1)
+    separator = nullptr; // drive letter
+  const std::string filename = separator ? std::string(arg, separator) : std::string(arg);
+
+  std::string error;
+  if (!Intcode::TryParseCodeFromFile(filename.c_str(), &workload->code, &error) ||
+      (separator && !Intcode::TryParseCode(separator + 1, &workload->input, &error)))
+  {
+    std::fprintf(stderr, "%s: %s\n", arg, error.c_str());
+    return false;
+  }
+  if (workload->code.empty())
+  {
+    std::fprintf(stderr, "%s: no code\n", arg);
+    return false;
+  }
+
+  workload->name = filename.substr(filename.find_last_of("/\\") + 1);
+  workload->queue_capacity = 1024;
+  return true;
+}
+
+void PrintUsage(const char* progname)
+{
+  std::fprintf(stderr,
+               "usage: %s [--warmup <runs>] [--repeat <runs>] [--engine interpreter|jit|memoizing|ir|all] "
+               "[--filter <text>] [--inline-io] [--csv] [program.txt[:inputs] ...]\n",
+               progname);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  u32 warmup = 2;
+  u32 repeat = 10;
+  const char* engine_name = "all";
+  const char* filter = nullptr;
+  bool csv = false;
+  bool inline_io = false;
+  std::vector<Workload> workloads = GetBuiltinWorkloads();
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--warmup") == 0 && (i + 1) < argc)
+    {
+      warmup = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+    }
+    else if (std::strcmp(argv[i], "--repeat") == 0 && (i + 1) < argc)
+    {
+      repeat = std::max(static_cast<u32>(std::strtoul(argv[++i], nullptr, 10)), 1u);
+    }
+    else if (std::strcmp(argv[i], "--engine") == 0 && (i + 1) < argc)
+    {
+      engine_name = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--filter") == 0 && (i + 1) < argc)
+    {
+      filter = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--csv") == 0)
+    {
+      csv = true;
+    }
+    else if (std::strcmp(argv[i], "--inline-io") == 0)
+    {
+      inline_io = true;
+    }
+    else if (argv[i][0] != '-')
+    {
+      Workload workload;
+      if (!ParseProgramArgument(argv[i], &workload))
+        return EXIT_FAILURE;
+
+      workloads.push_back(std::move(workload));
+    }
+    else
+    {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<std::pair<const char*, Computer::Engine>> engines;
+  if (std::strcmp(engine_name, "interpreter") == 0 || std::strcmp(engine_name, "all") == 0)
+    engines.emplace_back("interpreter", Computer::Engine::Interpreter);
+  if (std::strcmp(engine_name, "jit") == 0 || std::strcmp(engine_name, "all") == 0)
+    engines.emplace_back("jit", Computer::Engine::JIT);
+  if (std::strcmp(engine_name, "memoizing") == 0 || std::strcmp(engine_name, "all") == 0)
+    engines.emplace_back("memoizing", Computer::Engine::Memoizing);
+  if (std::strcmp(engine_name, "ir") == 0 || std::strcmp(engine_name, "all") == 0)
+    engines.emplace_back("ir", Computer::Engine::IR);
+  if (engines.empty())
+  {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+#if !defined(NDEBUG)
+  std::fprintf(stderr, "warning: assertions are enabled, build with -DCMAKE_BUILD_TYPE=Release for stable numbers\n");
+#endif
+
+  if (csv)
+  {
+    std::printf("workload,engine,instructions,round_trips,runs,min_ms,median_ms,mean_ms,stddev_ms,instructions_per_sec,"
+                "ns_per_instruction,round_trips_per_sec\n");
+  }
+  else
+  {
+    std::printf("%-16s %-12s %12s %10s %10s %8s %12s %10s %14s\n", "workload", "engine", "instructions", "median ms",
+                "min ms", "stddev", "Minstr/s", "ns/instr", "round trips/s");
+  }
+
+  // engines which get a workload wrong are left out of the table, and fail the run
+  bool mismatched = false;
+  for (const Workload& workload : workloads)
+  {
+    if (filter && workload.name.find(filter) == std::string::npos)
+      continue;
+
+    std::vector<MemoryCellType> expected_outputs;
+    const u64 instructions = CountInstructions(workload, &expected_outputs);
+    for (const auto& [name, engine] : engines)
+    {
+      Result result;
+      if (!Measure(workload, engine, name, instructions, expected_outputs, warmup, repeat, inline_io, &result))
+      {
+        mismatched = true;
+        continue;
+      }
+
+      // the median is reported, it is the least disturbed by other work on the machine
+      std::vector<double>& seconds = result.seconds;
+      std::sort(seconds.begin(), seconds.end());
+      const double median = (seconds.size() % 2) ? seconds[seconds.size() / 2] :
+                                                   (seconds[seconds.size() / 2 - 1] + seconds[seconds.size() / 2]) / 2;
+      double mean = 0.0;
+      for (const double s : seconds)
+        mean += s;
+      mean /= static_cast<double>(seconds.size());
+      double variance = 0.0;
+      for (const double s : seconds)
+        variance += (s - mean) * (s - mean);
+      const double stddev = std::sqrt(variance / static_cast<double>(seconds.size()));
+
+      const double instructions_per_sec = static_cast<double>(instructions) / median;
+      const double ns_per_instruction = median * 1e9 / static_cast<double>(std::max<u64>(instructions, 1));
+      const double round_trips_per_sec = static_cast<double>(result.round_trips) / median;
+      const char* engine_label = (Computer(workload.code, 16384, engine).GetEngine() == engine) ? name : "jit-fallback";
+      if (csv)
+      {
+        std::printf("%s,%s,%" PRIu64 ",%" PRIu64 ",%zu,%.4f,%.4f,%.4f,%.4f,%.0f,%.3f,%.0f\n", workload.name.c_str(),
+                    engine_label, instructions, result.round_trips, seconds.size(), seconds.front() * 1000.0,
+                    median * 1000.0, mean * 1000.0, stddev * 1000.0, instructions_per_sec, ns_per_instruction,
+                    round_trips_per_sec);
+      }
+      else
+      {
+        std::printf("%-16s %-12s %12" PRIu64 " %10.3f %10.3f %7.1f%% %12.1f %10.3f %14.0f\n", workload.name.c_str(),
+                    engine_label, instructions, median * 1000.0, seconds.front() * 1000.0, stddev * 100.0 / mean,
+                    instructions_per_sec / 1e6, ns_per_instruction, round_trips_per_sec);
+      }
+      std::fflush(stdout);
+    }
+  }
+
+  return mismatched ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+#include "code_analysis.h"
+#include "ir.h"
+#include "program_image.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static void PrintUsage(const char* progname)
+{
+  std::fprintf(stderr, "usage: %s [--cfg | --ir] [--entry <pc>] <program or image>\n", progname);
+  std::fprintf(stderr, "  prints a listing of the whole program, or its control flow graph in dot format with --cfg\n");
+  std::fprintf(stderr, "  --ir prints each block as optimized IR, see ir.h\n");
+}
+
+static void AppendIr(std::string* str, const Intcode::CodeAnalysis& analysis)
+{
+  // blocks stop early at instructions the IR does not express, those are left out
+  for (const Intcode::CodeAnalysis::Block& block : analysis.GetBlocks())
+  {
+    std::vector<Intcode::Instruction> instructions;
+    for (Intcode::u32 i = 0; i < block.num_instructions; i++)
+      instructions.push_back(analysis.GetInstructions()[block.first_instruction + i].instr);
+
+    Intcode::IrBlock ir_block;
+    if (!Intcode::LiftIrBlock(block.start_pc, instructions.data(), block.num_instructions, &ir_block))
+      continue;
+
+    Intcode::OptimizeIrBlock(&ir_block);
+    Intcode::AppendIrBlock(str, ir_block);
+  }
+}
+
+static bool LoadProgram(const char* filename, Intcode::CodeVector* code, Intcode::u32* entry_pc)
+{
+  // anything which is not an image is parsed as text
+  const std::shared_ptr<const Intcode::ProgramImage> image = Intcode::ProgramImage::Load(filename);
+  if (image)
+  {
+    code->assign(image->GetCells(), image->GetCells() + image->GetNumCells());
+    *entry_pc = image->GetEntryPC();
+    return true;
+  }
+
+  std::string error;
+  if (!Intcode::TryParseCodeFromFile(filename, code, &error))
+  {
+    std::fprintf(stderr, "%s: %s\n", filename, error.c_str());
+    return false;
+  }
+  if (code->empty())
+  {
+    std::fprintf(stderr, "%s: no code\n", filename);
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* filename = nullptr;
+  const char* entry_pc_arg = nullptr;
+  bool cfg = false;
+  bool ir = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--cfg") == 0)
+    {
+      cfg = true;
+    }
+    else if (std::strcmp(argv[i], "--ir") == 0)
+    {
+      ir = true;
+    }
+    else if (std::strcmp(argv[i], "--entry") == 0 && (i + 1) < argc)
+    {
+      entry_pc_arg = argv[++i];
+    }
+    else if (!filename)
+    {
+      filename = argv[i];
+    }
+    else
+    {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!filename || (cfg && ir))
+  {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Intcode::CodeVector code;
+  Intcode::u32 entry_pc = 0;
+  if (!LoadProgram(filename, &code, &entry_pc))
+    return EXIT_FAILURE;
+  if (entry_pc_arg)
+    entry_pc = static_cast<Intcode::u32>(std::strtoul(entry_pc_arg, nullptr, 10));
+
+  const Intcode::CodeAnalysis analysis(code, entry_pc);
+  std::string output;
+  if (cfg)
+    analysis.AppendCFG(&output);
+  else if (ir)
+    AppendIr(&output, analysis);
+  else
+    analysis.AppendListing(&output);
+
+  std::fwrite(output.data(), 1, output.size(), stdout);
+  return EXIT_SUCCESS;
+}
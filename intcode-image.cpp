@@ -0,0 +1,99 @@
+#include "program_image.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void PrintUsage(const char* progname)
+{
+  std::fprintf(stderr, "usage: %s [--no-decode] [--entry <pc>] [--metadata <text>] <input.txt> <output image>\n",
+               progname);
+  std::fprintf(stderr, "       %s --info <image>\n", progname);
+}
+
+static int PrintInfo(const char* filename)
+{
+  std::string error;
+  const std::shared_ptr<const Intcode::ProgramImage> image = Intcode::ProgramImage::Load(filename, &error);
+  if (!image)
+  {
+    std::fprintf(stderr, "%s: %s\n", filename, error.c_str());
+    return EXIT_FAILURE;
+  }
+
+  const std::string_view metadata = image->GetMetadata();
+  std::printf("cells: %llu\n", static_cast<unsigned long long>(image->GetNumCells()));
+  std::printf("entry point: %u\n", image->GetEntryPC());
+  std::printf("decoded instructions: %u\n", image->GetNumDecodedInstructions());
+  std::printf("metadata: %.*s\n", static_cast<int>(metadata.size()), metadata.data());
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* input_filename = nullptr;
+  const char* output_filename = nullptr;
+  const char* metadata = "";
+  unsigned long entry_pc = 0;
+  bool decode = true;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--info") == 0 && (i + 1) < argc)
+    {
+      return PrintInfo(argv[i + 1]);
+    }
+    else if (std::strcmp(argv[i], "--no-decode") == 0)
+    {
+      decode = false;
+    }
+    else if (std::strcmp(argv[i], "--entry") == 0 && (i + 1) < argc)
+    {
+      entry_pc = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if (std::strcmp(argv[i], "--metadata") == 0 && (i + 1) < argc)
+    {
+      metadata = argv[++i];
+    }
+    else if (!input_filename)
+    {
+      input_filename = argv[i];
+    }
+    else if (!output_filename)
+    {
+      output_filename = argv[i];
+    }
+    else
+    {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!input_filename || !output_filename)
+  {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::string error;
+  Intcode::CodeVector code;
+  if (!Intcode::TryParseCodeFromFile(input_filename, &code, &error))
+  {
+    std::fprintf(stderr, "%s: %s\n", input_filename, error.c_str());
+    return EXIT_FAILURE;
+  }
+  if (entry_pc >= code.size())
+  {
+    std::fprintf(stderr, "entry point %lu is outside the program\n", entry_pc);
+    return EXIT_FAILURE;
+  }
+
+  if (!Intcode::ProgramImage::Write(output_filename, code, static_cast<Intcode::u32>(entry_pc), metadata, decode,
+                                    &error))
+  {
+    std::fprintf(stderr, "%s: %s\n", output_filename, error.c_str());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+#include "program_image.h"
+#include "recording.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+static void PrintUsage(const char* progname)
+{
+  std::fprintf(stderr, "usage: %s [--engine interpreter|jit|memoizing|ir] [--dump] <program or image> <recording>\n",
+               progname);
+  std::fprintf(stderr, "  replays a recording against the program it was made from, checking the output matches\n");
+  std::fprintf(stderr, "  --dump prints the records instead\n");
+}
+
+static bool ParseEngine(const char* name, Intcode::Computer::Engine* engine)
+{
+  if (std::strcmp(name, "interpreter") == 0)
+    *engine = Intcode::Computer::Engine::Interpreter;
+  else if (std::strcmp(name, "jit") == 0)
+    *engine = Intcode::Computer::Engine::JIT;
+  else if (std::strcmp(name, "memoizing") == 0)
+    *engine = Intcode::Computer::Engine::Memoizing;
+  else if (std::strcmp(name, "ir") == 0)
+    *engine = Intcode::Computer::Engine::IR;
+  else
+    return false;
+
+  return true;
+}
+
+static std::unique_ptr<Intcode::Computer> LoadProgram(const char* filename, Intcode::Computer::Engine engine)
+{
+  // anything which is not an image is parsed as text
+  const std::shared_ptr<const Intcode::ProgramImage> image = Intcode::ProgramImage::Load(filename);
+  if (image)
+    return std::make_unique<Intcode::Computer>(image, 16384, engine);
+
+  std::string error;
+  Intcode::CodeVector code;
+  if (!Intcode::TryParseCodeFromFile(filename, &code, &error))
+  {
+    std::fprintf(stderr, "%s: %s\n", filename, error.c_str());
+    return nullptr;
+  }
+  if (code.empty())
+  {
+    std::fprintf(stderr, "%s: no code\n", filename);
+    return nullptr;
+  }
+
+  return std::make_unique<Intcode::Computer>(code, 16384, engine);
+}
+
+static void DumpRecords(Intcode::Replayer& replayer)
+{
+  // instruction numbers count from the start of the recording
+  Intcode::u64 instruction = 0;
+  Intcode::Record record;
+  bool ended = false;
+  while (replayer.ReadRecord(&record))
+  {
+    switch (record.kind)
+    {
+      case Intcode::RecordKind::Input:
+      case Intcode::RecordKind::Output:
+        instruction += record.instruction_count;
+        std::printf("%12" PRIu64 "  %-6s %" PRId64 "\n", instruction,
+                    (record.kind == Intcode::RecordKind::Input) ? "input" : "output", record.value);
+        break;
+
+      case Intcode::RecordKind::Step:
+        if (record.has_value)
+          std::printf("%12s  step   %u -> %" PRId64 "\n", "", record.pc, record.value);
+        else
+          std::printf("%12s  step   %u\n", "", record.pc);
+        break;
+
+      case Intcode::RecordKind::End:
+        instruction += record.instruction_count;
+        std::printf("%12" PRIu64 "  end    %s\n", instruction,
+                    (record.state == Intcode::Computer::State::Halted) ? "halted" : "running");
+        ended = true;
+        break;
+    }
+  }
+
+  if (!ended)
+    std::printf("recording was not closed\n");
+}
+
+int main(int argc, char* argv[])
+{
+  const char* program_filename = nullptr;
+  const char* recording_filename = nullptr;
+  Intcode::Computer::Engine engine = Intcode::Computer::Engine::JIT;
+  bool dump = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--engine") == 0 && (i + 1) < argc)
+    {
+      if (!ParseEngine(argv[++i], &engine))
+      {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (std::strcmp(argv[i], "--dump") == 0)
+    {
+      dump = true;
+    }
+    else if (!program_filename)
+    {
+      program_filename = argv[i];
+    }
+    else if (!recording_filename)
+    {
+      recording_filename = argv[i];
+    }
+    else
+    {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!program_filename || !recording_filename)
+  {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::string error;
+  Intcode::Replayer replayer;
+  if (!replayer.Open(recording_filename, &error))
+  {
+    std::fprintf(stderr, "%s: %s\n", recording_filename, error.c_str());
+    return EXIT_FAILURE;
+  }
+
+  if (dump)
+  {
+    DumpRecords(replayer);
+    return EXIT_SUCCESS;
+  }
+
+  const std::unique_ptr<Intcode::Computer> comp = LoadProgram(program_filename, engine);
+  if (!comp)
+    return EXIT_FAILURE;
+
+  const auto start_time = std::chrono::steady_clock::now();
+  const bool matched = replayer.Replay(*comp, &error);
+  const double elapsed_ms =
+    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+  if (!matched)
+  {
+    std::fprintf(stderr, "%s: %s\n", recording_filename, error.c_str());
+    return EXIT_FAILURE;
+  }
+
+  std::printf("replay matches, %.2f ms\n", elapsed_ms);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+#include "program_image.h"
+#include "transpiler.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void PrintUsage(const char* progname)
+{
+  std::fprintf(stderr, "usage: %s [--entry <pc>] [--symbol <name>] <program or image> <output.cpp>\n", progname);
+  std::fprintf(stderr, "  writes a C++ translation unit defining `const Intcode::NativeProgram <name>`, see "
+                       "native_program.h\n");
+}
+
+static bool LoadProgram(const char* filename, Intcode::CodeVector* code, Intcode::u32* entry_pc)
+{
+  // anything which is not an image is parsed as text
+  const std::shared_ptr<const Intcode::ProgramImage> image = Intcode::ProgramImage::Load(filename);
+  if (image)
+  {
+    code->assign(image->GetCells(), image->GetCells() + image->GetNumCells());
+    *entry_pc = image->GetEntryPC();
+    return true;
+  }
+
+  std::string error;
+  if (!Intcode::TryParseCodeFromFile(filename, code, &error))
+  {
+    std::fprintf(stderr, "%s: %s\n", filename, error.c_str());
+    return false;
+  }
+  if (code->empty())
+  {
+    std::fprintf(stderr, "%s: no code\n", filename);
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* filename = nullptr;
+  const char* output_filename = nullptr;
+  const char* entry_pc_arg = nullptr;
+  const char* symbol_arg = nullptr;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (std::strcmp(argv[i], "--entry") == 0 && (i + 1) < argc)
+    {
+      entry_pc_arg = argv[++i];
+    }
+    else if (std::strcmp(argv[i], "--symbol") == 0 && (i + 1) < argc)
+    {
+      symbol_arg = argv[++i];
+    }
+    else if (!filename)
+    {
+      filename = argv[i];
+    }
+    else if (!output_filename)
+    {
+      output_filename = argv[i];
+    }
+    else
+    {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!filename || !output_filename)
+  {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Intcode::CodeVector code;
+  Intcode::u32 entry_pc = 0;
+  if (!LoadProgram(filename, &code, &entry_pc))
+    return EXIT_FAILURE;
+  if (entry_pc_arg)
+    entry_pc = static_cast<Intcode::u32>(std::strtoul(entry_pc_arg, nullptr, 10));
+
+  const std::string symbol = symbol_arg ? std::string(symbol_arg) : Intcode::MakeSymbolName(filename);
+  const char* name = std::strrchr(filename, '/') ? (std::strrchr(filename, '/') + 1) : filename;
+
+  const Intcode::CodeAnalysis analysis(code, entry_pc);
+  std::string output;
+  Intcode::TranspileToCpp(analysis, name, symbol, &output);
+
+  std::FILE* fp = std::fopen(output_filename, "wb");
+  const bool written = fp && std::fwrite(output.data(), 1, output.size(), fp) == output.size();
+  if (!fp || std::fclose(fp) != 0 || !written)
+  {
+    std::fprintf(stderr, "%s: failed to write file\n", output_filename);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
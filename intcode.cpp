@@ -1,12 +1,29 @@
 #include "intcode.h"
+#include "call_memoizer.h"
+#include "code_analysis.h"
+#include "ir_interpreter.h"
+#include "jit_x64.h"
+#include "mapped_file.h"
+#include "native_program.h"
+#include "profiler.h"
+#include "program_image.h"
+#include "recording.h"
 #include "scope_timer.h"
+#include "snapshot.h"
+#include <algorithm>
 #include <cassert>
-#include <cctype>
+#include <charconv>
 #include <cinttypes>
 #include <cstdio>
-#include <deque>
-#include <fstream>
+#include <cstring>
+#include <limits>
 #include <sstream>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 namespace Intcode {
 
@@ -19,7 +36,7 @@ u32 GetNumOperandsForOpcode(Opcode opcode)
     case Opcode::mul:
       return 3;
     case Opcode::in:
-      return 2;
+      return 1;
     case Opcode::out:
       return 1;
     case Opcode::jnz:
@@ -40,176 +57,1017 @@ u32 GetNumOperandsForOpcode(Opcode opcode)
   }
 }
 
-CodeVector ParseCode(std::string_view code_string)
+const char* GetOpcodeName(Opcode opcode)
 {
-  CodeVector ret;
+  switch (opcode)
+  {
+    case Opcode::add:
+      return "add";
+    case Opcode::mul:
+      return "mul";
+    case Opcode::in:
+      return "in";
+    case Opcode::out:
+      return "out";
+    case Opcode::jnz:
+      return "jnz";
+    case Opcode::jz:
+      return "jz";
+    case Opcode::slt:
+      return "slt";
+    case Opcode::seq:
+      return "seq";
+    case Opcode::rbaddr:
+      return "rbaddr";
+    case Opcode::halt:
+      return "halt";
+    default:
+      assert(false && "unknown opcode");
+      return "unknown";
+  }
+}
+
+namespace {
 
-  std::string buffer;
-  for (auto it = code_string.begin(); it != code_string.end(); it++)
+// Counts the separators 16 bytes at a time, which gives the number of cells so the output can be sized up front.
+size_t CountSeparators(std::string_view str)
+{
+  const char* ptr = str.data();
+  const char* end = ptr + str.size();
+  size_t count = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  const __m128i separator = _mm_set1_epi8(',');
+  while ((end - ptr) >= 16)
   {
-    char ch = *it;
-    if (ch == ',')
+    // per-byte counters overflow after 255 blocks
+    const size_t num_blocks = std::min<size_t>(static_cast<size_t>(end - ptr) / 16, 255);
+    __m128i counts = _mm_setzero_si128();
+    for (size_t i = 0; i < num_blocks; i++, ptr += 16)
+    {
+      const __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+      counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(chars, separator));
+    }
+
+    const __m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+    count += static_cast<size_t>(_mm_cvtsi128_si32(sums)) + static_cast<size_t>(_mm_extract_epi16(sums, 4));
+  }
+#endif
+
+  return count + static_cast<size_t>(std::count(ptr, end, ','));
+}
+
+bool IsWhitespace(char ch)
+{
+  return (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n');
+}
+
+} // namespace
+
+bool TryParseCode(std::string_view code_string, CodeVector* code, std::string* error_message)
+{
+  const char* begin = code_string.data();
+  const char* end = begin + code_string.size();
+  const char* ptr = begin;
+
+  const auto fail = [&](const char* message) {
+    if (error_message)
     {
-      if (buffer.size() > 0)
+      const size_t line = 1 + static_cast<size_t>(std::count(begin, ptr, '\n'));
+      const char* line_start = begin;
+      for (const char* it = begin; it != ptr; it++)
       {
-        ret.push_back(std::strtoll(buffer.c_str(), nullptr, 10));
-        buffer.clear();
+        if (*it == '\n')
+          line_start = it + 1;
       }
 
-      continue;
-    }
-    else if (!std::isdigit(ch) && ch != '-')
-    {
-      continue;
+      std::ostringstream ss;
+      ss << "line " << line << ", column " << (ptr - line_start + 1) << ": " << message;
+      *error_message = ss.str();
     }
 
-    buffer.push_back(ch);
+    return false;
+  };
+
+  const auto skip_whitespace = [&]() {
+    while (ptr != end && IsWhitespace(*ptr))
+      ptr++;
+  };
+
+  code->clear();
+  code->reserve(CountSeparators(code_string) + 1);
+
+  skip_whitespace();
+  if (ptr == end)
+    return true;
+
+  for (;;)
+  {
+    MemoryCellType value;
+    const std::from_chars_result result = std::from_chars(ptr, end, value);
+    if (result.ec == std::errc::invalid_argument)
+      return fail("expected a number");
+    else if (result.ec == std::errc::result_out_of_range)
+      return fail("number out of range");
+
+    code->push_back(value);
+    ptr = result.ptr;
+
+    skip_whitespace();
+    if (ptr == end)
+      return true;
+    else if (*ptr != ',')
+      return fail("expected ','");
+
+    ptr++;
+    skip_whitespace();
   }
+}
 
-  if (buffer.size() > 0)
-    ret.push_back(std::strtoll(buffer.c_str(), nullptr, 10));
+bool TryParseCodeFromFile(const char* filename, CodeVector* code, std::string* error_message)
+{
+  MappedFile file;
+  if (!file.Open(filename))
+  {
+    if (error_message)
+      *error_message = "failed to open file";
 
-  return ret;
+    return false;
+  }
+
+  return TryParseCode(file.GetString(), code, error_message);
 }
 
-CodeVector ParseCodeFromFile(const char* filename)
+CodeVector ParseCode(std::string_view code_string)
 {
-  std::ifstream ifs(filename);
-  if (!ifs.is_open())
+  CodeVector code;
+  std::string error_message;
+  if (!TryParseCode(code_string, &code, &error_message))
+  {
+    std::fprintf(stderr, "ParseCode: %s\n", error_message.c_str());
     return {};
+  }
 
-  ifs.seekg(0, SEEK_END);
-  const auto size = ifs.tellg();
-  ifs.seekg(0, SEEK_SET);
+  return code;
+}
 
-  std::string str;
-  str.resize(size);
-  ifs.read(str.data(), size);
-  ifs.close();
+CodeVector ParseCodeFromFile(const char* filename)
+{
+  CodeVector code;
+  std::string error_message;
+  if (!TryParseCodeFromFile(filename, &code, &error_message))
+  {
+    std::fprintf(stderr, "ParseCodeFromFile: %s: %s\n", filename, error_message.c_str());
+    return {};
+  }
 
-  return ParseCode(str);
+  return code;
 }
 
 std::string Instruction::Disassemble() const
 {
-  std::ostringstream ss;
-  switch (opcode)
+  std::string str;
+  AppendDisassembly(&str);
+  return str;
+}
+
+void Instruction::AppendDisassembly(std::string* str) const
+{
+  // formats into a stack buffer, this runs once per instruction when listing whole programs
+  char buffer[MAX_DISASSEMBLY_LENGTH];
+  char* ptr = buffer;
+  char* const end = buffer + sizeof(buffer);
+  const auto append = [&ptr](std::string_view text) {
+    std::memcpy(ptr, text.data(), text.size());
+    ptr += text.size();
+  };
+
+  append(GetOpcodeName(opcode));
+  if (operand_modes[0] != OperandMode::None)
+    append(" ");
+
+  for (u32 i = 0; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
   {
-    case Opcode::add:
-      ss << "add ";
+    if (operand_modes[i] == OperandMode::None)
       break;
 
-    case Opcode::mul:
-      ss << "mul ";
+    if (i > 0)
+      append(", ");
+
+    switch (operand_modes[i])
+    {
+      case OperandMode::Positional:
+      {
+        append("[");
+        ptr = std::to_chars(ptr, end, operand_values[i]).ptr;
+        append("]");
+      }
       break;
 
-    case Opcode::in:
-      ss << "in ";
+      case OperandMode::Immediate:
+      {
+        append("#");
+        ptr = std::to_chars(ptr, end, operand_values[i]).ptr;
+      }
       break;
 
-    case Opcode::out:
-      ss << "out ";
+      case OperandMode::Relative:
+      {
+        // negate as unsigned, the most negative offset has no positive counterpart
+        append((operand_values[i] < 0) ? "[rb - " : "[rb + ");
+        const u64 magnitude = (operand_values[i] < 0) ? (0 - static_cast<u64>(operand_values[i])) :
+                                                        static_cast<u64>(operand_values[i]);
+        ptr = std::to_chars(ptr, end, magnitude).ptr;
+        append("]");
+      }
       break;
 
+      default:
+        break;
+    }
+  }
+
+  str->append(buffer, ptr);
+}
+
+void DecodeInstruction(const MemoryCellType* cells, Instruction* instr)
+{
+  const MemoryCellType first = cells[0];
+  instr->opcode = static_cast<Opcode>(static_cast<u8>(first % 100));
+  instr->operand_modes[0] = static_cast<OperandMode>(static_cast<u8>((first / 100) % 10));
+  instr->operand_modes[1] = static_cast<OperandMode>(static_cast<u8>((first / 1000) % 10));
+  instr->operand_modes[2] = static_cast<OperandMode>(static_cast<u8>((first / 10000) % 10));
+
+  const u32 num_parameters = GetNumOperandsForOpcode(instr->opcode);
+  for (u32 i = 0; i < num_parameters; i++)
+    instr->operand_values[i] = cells[1 + i];
+  for (u32 i = num_parameters; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
+    instr->operand_modes[i] = OperandMode::None;
+
+  instr->length = 1 + num_parameters;
+}
+
+bool TryDecodeInstruction(const MemoryCellType* cells, Instruction* instr)
+{
+  switch (static_cast<Opcode>(static_cast<u8>(cells[0] % 100)))
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::in:
+    case Opcode::out:
     case Opcode::jnz:
-      ss << "jnz ";
+    case Opcode::jz:
+    case Opcode::slt:
+    case Opcode::seq:
+    case Opcode::rbaddr:
+    case Opcode::halt:
       break;
 
-    case Opcode::jz:
-      ss << "jz ";
+    default:
+      return false;
+  }
+
+  DecodeInstruction(cells, instr);
+  for (u32 i = 0; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
+  {
+    if (instr->operand_modes[i] != OperandMode::None && instr->operand_modes[i] > OperandMode::Relative)
+      return false;
+  }
+
+  return true;
+}
+
+// Every opcode is implemented once, and instantiated for each combination of operand modes so the hot path does not
+// have to switch on the mode of every operand. Instantiating with RUNTIME_MODE instead resolves the modes from the
+// instruction, which is used for encodings outside the table (unknown modes, immediate write operands). Each
+// instantiation exists once per access policy, the strict ones check the instruction before running it.
+struct Computer::InstructionHandlers
+{
+  static constexpr OperandMode RUNTIME_MODE = OperandMode::None;
+  static constexpr u32 NUM_OPCODES = 10;
+  static constexpr u32 NUM_MODES = 3;
+  static constexpr u32 NUM_MODE_COMBINATIONS = NUM_MODES * NUM_MODES * NUM_MODES;
+  static constexpr u32 NUM_ACCESS_POLICIES = 2;
+
+  template<OperandMode mode>
+  static MemoryCellType ReadOperand(const Computer& comp, const Instruction& instr, u32 index)
+  {
+    if constexpr (mode == OperandMode::Positional)
+    {
+      const MemoryCellType address = instr.operand_values[index];
+      assert(comp.IsValidAddress(address));
+      return comp.ReadMemory(static_cast<u64>(address));
+    }
+    else if constexpr (mode == OperandMode::Immediate)
+    {
+      return instr.operand_values[index];
+    }
+    else if constexpr (mode == OperandMode::Relative)
+    {
+      const MemoryCellType address = comp.m_relative_base + instr.operand_values[index];
+      assert(comp.IsValidAddress(address));
+      return comp.ReadMemory(static_cast<u64>(address));
+    }
+    else
+    {
+      return comp.ReadOperand(instr, index);
+    }
+  }
+
+  template<OperandMode mode>
+  static void WriteOperand(Computer& comp, const Instruction& instr, u32 index, MemoryCellType value)
+  {
+    if constexpr (mode == OperandMode::Positional)
+    {
+      const MemoryCellType address = instr.operand_values[index];
+      assert(comp.IsValidAddress(address));
+      comp.WriteMemory(static_cast<u64>(address), value);
+    }
+    else if constexpr (mode == OperandMode::Immediate)
+    {
+      assert(false && "immediate write operand");
+    }
+    else if constexpr (mode == OperandMode::Relative)
+    {
+      const MemoryCellType address = comp.m_relative_base + instr.operand_values[index];
+      assert(comp.IsValidAddress(address));
+      comp.WriteMemory(static_cast<u64>(address), value);
+    }
+    else
+    {
+      comp.WriteOperand(instr, index, value);
+    }
+  }
+
+  template<Opcode opcode, OperandMode m0, OperandMode m1, OperandMode m2>
+  static void Execute(Computer& comp, const Instruction& instr)
+  {
+    if constexpr (opcode == Opcode::add)
+    {
+      const MemoryCellType lhs = ReadOperand<m0>(comp, instr, 0);
+      const MemoryCellType rhs = ReadOperand<m1>(comp, instr, 1);
+      WriteOperand<m2>(comp, instr, 2, lhs + rhs);
+      comp.m_pc += 4;
+    }
+    else if constexpr (opcode == Opcode::mul)
+    {
+      const MemoryCellType lhs = ReadOperand<m0>(comp, instr, 0);
+      const MemoryCellType rhs = ReadOperand<m1>(comp, instr, 1);
+      WriteOperand<m2>(comp, instr, 2, lhs * rhs);
+      comp.m_pc += 4;
+    }
+    else if constexpr (opcode == Opcode::in)
+    {
+      if (comp.m_input_queue.IsEmpty() && !comp.RequestInput())
+      {
+        // leave pc as-is so we re-execute after input is provided
+        comp.m_state = State::WaitingForInput;
+        return;
+      }
+
+      WriteOperand<m0>(comp, instr, 0, comp.m_input_queue.Pop());
+      comp.m_pc += 2;
+    }
+    else if constexpr (opcode == Opcode::out)
+    {
+      if (comp.m_output_sink)
+      {
+        comp.m_output_sink(ReadOperand<m0>(comp, instr, 0));
+        comp.m_pc += 2;
+        return;
+      }
+
+      if (comp.m_output_queue.IsFull())
+      {
+        // leave pc as-is so we re-execute after consuming output
+        comp.m_state = State::WaitingForOutput;
+        return;
+      }
+
+      // write output, increment pc, only return to the host once the queue fills up
+      comp.m_output_queue.Push(ReadOperand<m0>(comp, instr, 0));
+      if (comp.m_output_queue.IsFull())
+        comp.m_state = State::WaitingForOutput;
+
+      comp.m_pc += 2;
+    }
+    else if constexpr (opcode == Opcode::jnz || opcode == Opcode::jz)
+    {
+      const MemoryCellType value = ReadOperand<m0>(comp, instr, 0);
+      if ((opcode == Opcode::jnz) ? (value != 0) : (value == 0))
+      {
+        const MemoryCellType new_pc = ReadOperand<m1>(comp, instr, 1);
+        assert(new_pc >= 0 && "jumping to positive pc");
+        comp.m_pc = static_cast<u32>(new_pc);
+      }
+      else
+      {
+        // branch not taken
+        comp.m_pc += 3;
+      }
+    }
+    else if constexpr (opcode == Opcode::slt)
+    {
+      const MemoryCellType lhs = ReadOperand<m0>(comp, instr, 0);
+      const MemoryCellType rhs = ReadOperand<m1>(comp, instr, 1);
+      WriteOperand<m2>(comp, instr, 2, lhs < rhs ? 1 : 0);
+      comp.m_pc += 4;
+    }
+    else if constexpr (opcode == Opcode::seq)
+    {
+      const MemoryCellType lhs = ReadOperand<m0>(comp, instr, 0);
+      const MemoryCellType rhs = ReadOperand<m1>(comp, instr, 1);
+      WriteOperand<m2>(comp, instr, 2, lhs == rhs ? 1 : 0);
+      comp.m_pc += 4;
+    }
+    else if constexpr (opcode == Opcode::rbaddr)
+    {
+      comp.m_relative_base += ReadOperand<m0>(comp, instr, 0);
+      comp.m_pc += 2;
+    }
+    else if constexpr (opcode == Opcode::halt)
+    {
+      comp.m_state = State::Halted;
+      comp.m_pc++;
+    }
+  }
+
+  static bool IsWriteOperand(Opcode opcode, u32 index)
+  {
+    return (opcode == Opcode::in) ? (index == 0) :
+                                    (index == 2 && (opcode == Opcode::add || opcode == Opcode::mul ||
+                                                    opcode == Opcode::slt || opcode == Opcode::seq));
+  }
+
+  static bool AddWithoutOverflow(s64 lhs, s64 rhs, s64* result)
+  {
+    if ((rhs > 0 && lhs > std::numeric_limits<s64>::max() - rhs) ||
+        (rhs < 0 && lhs < std::numeric_limits<s64>::min() - rhs))
+    {
+      return false;
+    }
+
+    *result = lhs + rhs;
+    return true;
+  }
+
+  // Everything an instruction accesses is known before it runs, so a faulting instruction has no effect.
+  static Fault CheckInstruction(const Computer& comp, const Instruction& instr)
+  {
+    for (u32 i = 0; (i + 1) < instr.length; i++)
+    {
+      s64 address = instr.operand_values[i];
+      switch (instr.operand_modes[i])
+      {
+        case OperandMode::Positional:
+          break;
+
+        case OperandMode::Immediate:
+          if (IsWriteOperand(instr.opcode, i))
+            return Fault::InvalidInstruction;
+          continue;
+
+        case OperandMode::Relative:
+          if (!AddWithoutOverflow(comp.m_relative_base, instr.operand_values[i], &address))
+            return Fault::InvalidAddress;
+          break;
+
+        default:
+          return Fault::InvalidInstruction;
+      }
+
+      if (!comp.IsValidAddress(address))
+        return Fault::InvalidAddress;
+    }
+
+    switch (instr.opcode)
+    {
+      case Opcode::jnz:
+      case Opcode::jz:
+      {
+        const MemoryCellType value = comp.ReadOperand(instr, 0);
+        const MemoryCellType new_pc = comp.ReadOperand(instr, 1);
+        const bool taken = (instr.opcode == Opcode::jnz) ? (value != 0) : (value == 0);
+        if (taken && (new_pc < 0 || new_pc > std::numeric_limits<u32>::max()))
+          return Fault::InvalidJumpTarget;
+      }
+      break;
+
+      case Opcode::rbaddr:
+      {
+        s64 relative_base;
+        if (!AddWithoutOverflow(comp.m_relative_base, comp.ReadOperand(instr, 0), &relative_base))
+          return Fault::InvalidAddress;
+      }
       break;
 
-    case Opcode::slt:
-      ss << "slt ";
-      break;
+      default:
+        break;
+    }
+
+    return Fault::None;
+  }
+
+  template<Opcode opcode, OperandMode m0, OperandMode m1, OperandMode m2>
+  static void ExecuteStrict(Computer& comp, const Instruction& instr)
+  {
+    const Fault fault = CheckInstruction(comp, instr);
+    if (fault != Fault::None)
+    {
+      comp.m_state = State::Faulted;
+      comp.m_fault = fault;
+      return;
+    }
+
+    Execute<opcode, m0, m1, m2>(comp, instr);
+  }
+
+  // unchecked tables point straight at the plain handlers
+  template<AccessPolicy policy, Opcode opcode, OperandMode m0, OperandMode m1, OperandMode m2>
+  static constexpr InstructionHandler GetPolicyHandler()
+  {
+    if constexpr (policy == AccessPolicy::Strict)
+      return &ExecuteStrict<opcode, m0, m1, m2>;
+    else
+      return &Execute<opcode, m0, m1, m2>;
+  }
+
+  template<AccessPolicy policy>
+  static void UnknownOpcode(Computer& comp, const Instruction& /*instr*/)
+  {
+    if constexpr (policy == AccessPolicy::Strict)
+    {
+      comp.m_state = State::Faulted;
+      comp.m_fault = Fault::InvalidInstruction;
+    }
+    else
+    {
+      assert(false && "Unknown opcode");
+    }
+  }
+
+  // Handlers for every opcode and mode triple, indexed by opcode slot * NUM_MODE_COMBINATIONS + mode triple.
+  static constexpr std::array<Opcode, NUM_OPCODES> s_opcodes = {
+    Opcode::add, Opcode::mul, Opcode::in,  Opcode::out,    Opcode::jnz,
+    Opcode::jz,  Opcode::slt, Opcode::seq, Opcode::rbaddr, Opcode::halt};
+
+  template<AccessPolicy policy, size_t index>
+  static constexpr InstructionHandler MakeHandler()
+  {
+    constexpr Opcode opcode = s_opcodes[index / NUM_MODE_COMBINATIONS];
+    constexpr OperandMode m0 = static_cast<OperandMode>((index / (NUM_MODES * NUM_MODES)) % NUM_MODES);
+    constexpr OperandMode m1 = static_cast<OperandMode>((index / NUM_MODES) % NUM_MODES);
+    constexpr OperandMode m2 = static_cast<OperandMode>(index % NUM_MODES);
+    return GetPolicyHandler<policy, opcode, m0, m1, m2>();
+  }
+
+  template<AccessPolicy policy, size_t... indices>
+  static constexpr std::array<InstructionHandler, sizeof...(indices)>
+  MakeHandlerTable(std::index_sequence<indices...>)
+  {
+    return {MakeHandler<policy, indices>()...};
+  }
+
+  template<AccessPolicy policy, size_t... indices>
+  static constexpr std::array<InstructionHandler, sizeof...(indices)>
+  MakeRuntimeModeHandlerTable(std::index_sequence<indices...>)
+  {
+    return {GetPolicyHandler<policy, s_opcodes[indices], RUNTIME_MODE, RUNTIME_MODE, RUNTIME_MODE>()...};
+  }
+
+  // indexed by AccessPolicy
+  static const std::array<InstructionHandler, NUM_OPCODES * NUM_MODE_COMBINATIONS> s_handlers[NUM_ACCESS_POLICIES];
+  static const std::array<InstructionHandler, NUM_OPCODES> s_runtime_mode_handlers[NUM_ACCESS_POLICIES];
+
+  static bool IsKnownOpcode(Opcode opcode)
+  {
+    return std::find(s_opcodes.begin(), s_opcodes.end(), opcode) != s_opcodes.end();
+  }
+
+  static InstructionHandler GetHandler(const Instruction& instr, AccessPolicy policy)
+  {
+    const auto it = std::find(s_opcodes.begin(), s_opcodes.end(), instr.opcode);
+    if (it == s_opcodes.end())
+    {
+      return (policy == AccessPolicy::Strict) ? &UnknownOpcode<AccessPolicy::Strict> :
+                                                &UnknownOpcode<AccessPolicy::Unchecked>;
+    }
+
+    const u32 slot = static_cast<u32>(it - s_opcodes.begin());
+    const u32 policy_index = static_cast<u32>(policy);
+
+    // unused operands are ignored, so they share the mode 0 handler
+    u32 modes = 0;
+    for (u32 i = 0; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
+    {
+      const u32 mode = (instr.operand_modes[i] == OperandMode::None) ? 0 : static_cast<u32>(instr.operand_modes[i]);
+      if (mode >= NUM_MODES)
+        return s_runtime_mode_handlers[policy_index][slot];
+
+      modes = modes * NUM_MODES + mode;
+    }
+
+    return s_handlers[policy_index][slot * NUM_MODE_COMBINATIONS + modes];
+  }
+
+  // Fused handlers execute an instruction and the instructions after it in one dispatch. Every instruction still has
+  // its full effect, e.g. the result of a compare is written even when the branch after it is all that reads it. An
+  // instruction that overwrites the one after it invalidates it, so the sequence stops there and the interpreter
+  // decodes the new instruction.
+  static constexpr u32 NUM_COMPARE_BRANCH_HANDLERS = 2 * NUM_MODES * NUM_MODES * 2 * 2 * NUM_MODES;
+
+  // slt/seq into a cell, followed by jnz/jz on that cell.
+  template<Opcode opcode, OperandMode m0, OperandMode m1, OperandMode m2, Opcode branch_opcode, OperandMode target_mode>
+  static void CompareAndBranch(Computer& comp, const Instruction& instr)
+  {
+    const MemoryCellType lhs = ReadOperand<m0>(comp, instr, 0);
+    const MemoryCellType rhs = ReadOperand<m1>(comp, instr, 1);
+    const bool result = (opcode == Opcode::slt) ? (lhs < rhs) : (lhs == rhs);
+    WriteOperand<m2>(comp, instr, 2, result ? 1 : 0);
+    comp.m_pc += 4;
+    if (!(comp.m_instruction_cache_flags[comp.m_pc] & INSTRUCTION_CACHE_VALID))
+      return;
+
+    const Instruction& branch = comp.GetCachedInstruction(comp.m_pc).instr;
+    if ((branch_opcode == Opcode::jnz) ? result : !result)
+    {
+      const MemoryCellType new_pc = ReadOperand<target_mode>(comp, branch, 1);
+      assert(new_pc >= 0 && "jumping to positive pc");
+      comp.m_pc = static_cast<u32>(new_pc);
+    }
+    else
+    {
+      comp.m_pc += 3;
+    }
+  }
+
+  // rbaddr followed by an unconditional jump, which is how functions return.
+  template<OperandMode m0, OperandMode target_mode>
+  static void AdjustRelativeBaseAndJump(Computer& comp, const Instruction& instr)
+  {
+    comp.m_relative_base += ReadOperand<m0>(comp, instr, 0);
+    const Instruction& jump = comp.GetCachedInstruction(comp.m_pc + 2).instr;
+    const MemoryCellType new_pc = ReadOperand<target_mode>(comp, jump, 1);
+    assert(new_pc >= 0 && "jumping to positive pc");
+    comp.m_pc = static_cast<u32>(new_pc);
+  }
+
+  // add followed by a fused sequence or an unconditional jump, e.g. a counter increment before the loop condition, or
+  // storing the return address before a call.
+  template<OperandMode m0, OperandMode m1, OperandMode m2>
+  static void AddAndContinue(Computer& comp, const Instruction& instr)
+  {
+    Execute<Opcode::add, m0, m1, m2>(comp, instr);
+    if (!(comp.m_instruction_cache_flags[comp.m_pc] & INSTRUCTION_CACHE_VALID))
+      return;
+
+    const CachedInstruction& next = comp.GetCachedInstruction(comp.m_pc);
+    next.fused_handler(comp, next.instr);
+  }
+
+  template<size_t index>
+  static constexpr InstructionHandler MakeCompareAndBranchHandler()
+  {
+    constexpr OperandMode target_mode = static_cast<OperandMode>(index % NUM_MODES);
+    constexpr Opcode branch_opcode = ((index / NUM_MODES) % 2) ? Opcode::jz : Opcode::jnz;
+    constexpr OperandMode m2 = ((index / (NUM_MODES * 2)) % 2) ? OperandMode::Relative : OperandMode::Positional;
+    constexpr OperandMode m1 = static_cast<OperandMode>((index / (NUM_MODES * 2 * 2)) % NUM_MODES);
+    constexpr OperandMode m0 = static_cast<OperandMode>((index / (NUM_MODES * 2 * 2 * NUM_MODES)) % NUM_MODES);
+    constexpr Opcode opcode = (index / (NUM_MODES * 2 * 2 * NUM_MODES * NUM_MODES)) ? Opcode::seq : Opcode::slt;
+    return &CompareAndBranch<opcode, m0, m1, m2, branch_opcode, target_mode>;
+  }
+
+  template<size_t... indices>
+  static constexpr std::array<InstructionHandler, sizeof...(indices)>
+  MakeCompareAndBranchHandlerTable(std::index_sequence<indices...>)
+  {
+    return {MakeCompareAndBranchHandler<indices>()...};
+  }
+
+  template<size_t... indices>
+  static constexpr std::array<InstructionHandler, sizeof...(indices)>
+  MakeAdjustRelativeBaseAndJumpHandlerTable(std::index_sequence<indices...>)
+  {
+    return {&AdjustRelativeBaseAndJump<static_cast<OperandMode>(indices / NUM_MODES),
+                                       static_cast<OperandMode>(indices % NUM_MODES)>...};
+  }
+
+  template<size_t... indices>
+  static constexpr std::array<InstructionHandler, sizeof...(indices)>
+  MakeAddAndContinueHandlerTable(std::index_sequence<indices...>)
+  {
+    return {&AddAndContinue<static_cast<OperandMode>(indices / (NUM_MODES * NUM_MODES)),
+                            static_cast<OperandMode>((indices / NUM_MODES) % NUM_MODES),
+                            static_cast<OperandMode>(indices % NUM_MODES)>...};
+  }
 
-    case Opcode::seq:
-      ss << "seq ";
-      break;
+  static const std::array<InstructionHandler, NUM_COMPARE_BRANCH_HANDLERS> s_compare_and_branch_handlers;
+  static const std::array<InstructionHandler, NUM_MODES * NUM_MODES> s_adjust_relative_base_and_jump_handlers;
+  static const std::array<InstructionHandler, NUM_MODE_COMBINATIONS> s_add_and_continue_handlers;
 
-    case Opcode::rbaddr:
-      ss << "rbaddr ";
-      break;
+  // Whether an instruction with opcode can be fused with an instruction with next_opcode after it. Checked before
+  // decoding the next instruction.
+  static bool MayFuse(Opcode opcode, Opcode next_opcode)
+  {
+    const bool next_is_branch = (next_opcode == Opcode::jnz || next_opcode == Opcode::jz);
+    switch (opcode)
+    {
+      case Opcode::slt:
+      case Opcode::seq:
+      case Opcode::rbaddr:
+        return next_is_branch;
 
-    case Opcode::halt:
-      ss << "halt";
-      break;
+      case Opcode::add:
+        return next_is_branch || next_opcode == Opcode::slt || next_opcode == Opcode::seq ||
+               next_opcode == Opcode::rbaddr;
 
-    default:
-      assert(false && "unknown opcode");
-      break;
+      default:
+        return false;
+    }
   }
 
-  for (u32 i = 0; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
+  // Returns the handler executing instr and next, or nullptr if they cannot be fused. next_is_fused is set when next
+  // is itself fused with the instruction after it.
+  static InstructionHandler GetFusedHandler(const Instruction& instr, const Instruction& next, bool next_is_fused)
   {
-    if (operand_modes[i] == OperandMode::None)
-      break;
-
-    if (i > 0)
-      ss << ", ";
+    u32 modes[2][MAX_OPERANDS_PER_INSTRUCTION];
+    for (u32 i = 0; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
+    {
+      modes[0][i] = (instr.operand_modes[i] == OperandMode::None) ? 0 : static_cast<u32>(instr.operand_modes[i]);
+      modes[1][i] = (next.operand_modes[i] == OperandMode::None) ? 0 : static_cast<u32>(next.operand_modes[i]);
+      if (modes[0][i] >= NUM_MODES || modes[1][i] >= NUM_MODES)
+        return nullptr;
+    }
 
-    switch (operand_modes[i])
+    const bool next_is_branch = (next.opcode == Opcode::jnz || next.opcode == Opcode::jz);
+    const bool next_is_jump = next_is_branch && next.operand_modes[0] == OperandMode::Immediate &&
+                              ((next.opcode == Opcode::jnz) == (next.operand_values[0] != 0));
+    switch (instr.opcode)
     {
-      case OperandMode::Positional:
+      case Opcode::slt:
+      case Opcode::seq:
       {
-        ss << "[" << operand_values[i] << "]";
+        // the branch has to test the cell the compare wrote
+        if (!next_is_branch || instr.operand_modes[2] == OperandMode::Immediate ||
+            next.operand_modes[0] != instr.operand_modes[2] || next.operand_values[0] != instr.operand_values[2])
+        {
+          return nullptr;
+        }
+
+        u32 index = (instr.opcode == Opcode::seq) ? 1 : 0;
+        index = index * NUM_MODES + modes[0][0];
+        index = index * NUM_MODES + modes[0][1];
+        index = index * 2 + ((instr.operand_modes[2] == OperandMode::Relative) ? 1 : 0);
+        index = index * 2 + ((next.opcode == Opcode::jz) ? 1 : 0);
+        index = index * NUM_MODES + modes[1][1];
+        return s_compare_and_branch_handlers[index];
       }
-      break;
 
-      case OperandMode::Immediate:
-      {
-        ss << "#" << operand_values[i];
-      }
-      break;
+      case Opcode::rbaddr:
+        return next_is_jump ? s_adjust_relative_base_and_jump_handlers[modes[0][0] * NUM_MODES + modes[1][1]] : nullptr;
 
-      case OperandMode::Relative:
+      case Opcode::add:
       {
-        if (operand_values[i] < 0)
-          ss << "[rb - " << -operand_values[i] << "]";
-        else
-          ss << "[rb + " << operand_values[i] << "]";
+        return (next_is_fused || next_is_jump) ?
+                 s_add_and_continue_handlers[(modes[0][0] * NUM_MODES + modes[0][1]) * NUM_MODES + modes[0][2]] :
+                 nullptr;
       }
-      break;
 
       default:
-        break;
+        return nullptr;
     }
   }
+};
+
+const std::array<Computer::InstructionHandler, Computer::InstructionHandlers::NUM_OPCODES *
+                                                  Computer::InstructionHandlers::NUM_MODE_COMBINATIONS>
+  Computer::InstructionHandlers::s_handlers[NUM_ACCESS_POLICIES] = {
+    MakeHandlerTable<AccessPolicy::Unchecked>(std::make_index_sequence<NUM_OPCODES * NUM_MODE_COMBINATIONS>()),
+    MakeHandlerTable<AccessPolicy::Strict>(std::make_index_sequence<NUM_OPCODES * NUM_MODE_COMBINATIONS>())};
+
+const std::array<Computer::InstructionHandler, Computer::InstructionHandlers::NUM_OPCODES>
+  Computer::InstructionHandlers::s_runtime_mode_handlers[NUM_ACCESS_POLICIES] = {
+    MakeRuntimeModeHandlerTable<AccessPolicy::Unchecked>(std::make_index_sequence<NUM_OPCODES>()),
+    MakeRuntimeModeHandlerTable<AccessPolicy::Strict>(std::make_index_sequence<NUM_OPCODES>())};
+
+const std::array<Computer::InstructionHandler, Computer::InstructionHandlers::NUM_COMPARE_BRANCH_HANDLERS>
+  Computer::InstructionHandlers::s_compare_and_branch_handlers =
+    MakeCompareAndBranchHandlerTable(std::make_index_sequence<NUM_COMPARE_BRANCH_HANDLERS>());
+
+const std::array<Computer::InstructionHandler,
+                 Computer::InstructionHandlers::NUM_MODES * Computer::InstructionHandlers::NUM_MODES>
+  Computer::InstructionHandlers::s_adjust_relative_base_and_jump_handlers =
+    MakeAdjustRelativeBaseAndJumpHandlerTable(std::make_index_sequence<NUM_MODES * NUM_MODES>());
+
+const std::array<Computer::InstructionHandler, Computer::InstructionHandlers::NUM_MODE_COMBINATIONS>
+  Computer::InstructionHandlers::s_add_and_continue_handlers =
+    MakeAddAndContinueHandlerTable(std::make_index_sequence<NUM_MODE_COMBINATIONS>());
+
+Computer::Computer(const CodeVector& code, u32 memory_size, Engine engine)
+  : m_memory(code, memory_size),
+    m_instruction_cache_pages((u64(memory_size) + PagedMemory::PAGE_MASK) >> PagedMemory::PAGE_SHIFT),
+    m_instruction_cache_flags(memory_size)
+{
+  assert(!code.empty() && "has code to execute");
+  if (engine == Engine::JIT && JitX64::IsSupported())
+    m_jit = std::make_unique<JitX64>(memory_size);
+  else if (engine == Engine::Memoizing)
+    m_call_memoizer = std::make_unique<CallMemoizer>();
+  else if (engine == Engine::IR)
+    m_ir_interpreter = std::make_unique<IrInterpreter>(memory_size);
 
-  return ss.str();
+  Reset();
 }
 
-Computer::Computer(const CodeVector& code, u32 memory_size) : m_orginal_code(code), m_memory(memory_size)
+Computer::Computer(std::shared_ptr<const ProgramImage> image, u32 memory_size, Engine engine)
+  : m_memory(image, image->GetCells(), image->GetNumCells(), memory_size),
+    m_instruction_cache_pages((u64(memory_size) + PagedMemory::PAGE_MASK) >> PagedMemory::PAGE_SHIFT),
+    m_instruction_cache_flags(memory_size), m_entry_pc(image->GetEntryPC())
 {
-  assert(!code.empty() && "has code to execute");
-  assert(memory_size >= code.size() && "code size smaller than memory size");
+  if (engine == Engine::JIT && JitX64::IsSupported())
+    m_jit = std::make_unique<JitX64>(memory_size);
+  else if (engine == Engine::Memoizing)
+    m_call_memoizer = std::make_unique<CallMemoizer>();
+  else if (engine == Engine::IR)
+    m_ir_interpreter = std::make_unique<IrInterpreter>(memory_size);
+
+  Reset();
+
+  // image pages are never dirty after a reset, so these entries stay valid until the program overwrites them
+  const ProgramImage::DecodedInstruction* decoded = image->GetDecodedInstructions();
+  for (u32 i = 0; i < image->GetNumDecodedInstructions(); i++)
+  {
+    const u32 pc = decoded[i].pc;
+    const Instruction instr = ProgramImage::ToInstruction(decoded[i]);
+    if ((u64(pc) + instr.length) > memory_size)
+      continue;
+
+    CachedInstruction& cached = GetWritableCachedInstruction(pc);
+    cached.instr = instr;
+    cached.handler = InstructionHandlers::GetHandler(instr, m_access_policy);
+    cached.fused_handler = cached.handler;
+    m_instruction_cache_flags[pc] |= INSTRUCTION_CACHE_VALID;
+    for (u32 cell = pc; cell < (pc + instr.length); cell++)
+      m_instruction_cache_flags[cell] |= INSTRUCTION_CACHE_COVERED;
+  }
+
+  // last to first, so instructions fusing with a fused sequence see it already fused
+  for (u32 i = image->GetNumDecodedInstructions(); i > 0; i--)
+  {
+    const u32 pc = decoded[i - 1].pc;
+    if (pc < memory_size && (m_instruction_cache_flags[pc] & INSTRUCTION_CACHE_VALID))
+      FuseCachedInstruction(pc);
+  }
+}
+
+Computer::Computer(const NativeProgram& program, u32 memory_size)
+  : m_memory(nullptr, program.code, program.code_size, memory_size),
+    m_instruction_cache_pages((u64(memory_size) + PagedMemory::PAGE_MASK) >> PagedMemory::PAGE_SHIFT),
+    m_instruction_cache_flags(memory_size), m_entry_pc(program.entry_pc),
+    m_native_runner(std::make_unique<NativeProgramRunner>(program))
+{
+  assert(program.code_size > 0 && "has code to execute");
   Reset();
 }
 
+Computer::Computer(PagedMemory memory, const Computer& parent)
+  : m_memory(std::move(memory)), m_instruction_cache_pages(parent.m_instruction_cache_pages),
+    m_instruction_cache_flags(parent.m_instruction_cache_flags), m_entry_pc(parent.m_entry_pc), m_pc(parent.m_pc),
+    m_relative_base(parent.m_relative_base), m_state(parent.m_state), m_fault(parent.m_fault),
+    m_access_policy(parent.m_access_policy), m_input_queue(parent.m_input_queue), m_output_queue(parent.m_output_queue)
+{
+  if (parent.m_jit)
+  {
+    m_jit = std::make_unique<JitX64>(static_cast<u32>(m_instruction_cache_flags.size()));
+    for (u8& flags : m_instruction_cache_flags)
+      flags &= ~INSTRUCTION_CACHE_COMPILED;
+  }
+  if (parent.m_call_memoizer)
+    m_call_memoizer = std::make_unique<CallMemoizer>();
+  if (parent.m_ir_interpreter)
+  {
+    m_ir_interpreter = std::make_unique<IrInterpreter>(static_cast<u32>(m_instruction_cache_flags.size()));
+    for (u8& flags : m_instruction_cache_flags)
+      flags &= ~INSTRUCTION_CACHE_COMPILED;
+  }
+
+  // the flags were copied along with the memory, so the same blocks are still valid
+  if (parent.m_native_runner)
+    m_native_runner = std::make_unique<NativeProgramRunner>(*parent.m_native_runner);
+}
+
+Computer::Computer(Computer&&) = default;
+
 Computer::~Computer() = default;
 
+Computer& Computer::operator=(Computer&&) = default;
+
+Computer Computer::Fork()
+{
+  return Computer(m_memory.Fork(), *this);
+}
+
 void Computer::Reset()
 {
-  std::fill(m_memory.begin(), m_memory.end(), 0);
-  std::copy(m_orginal_code.begin(), m_orginal_code.end(), m_memory.begin());
-  m_pc = 0;
+  // only pages which were written can hold instructions that differ from the program image
+  const u32 cache_size = static_cast<u32>(m_instruction_cache_flags.size());
+  for (const u64 page : m_memory.GetDirtyPages())
+  {
+    const u64 start = page << PagedMemory::PAGE_SHIFT;
+    if (start < cache_size)
+    {
+      const u64 end = std::min<u64>(start + PagedMemory::PAGE_SIZE, cache_size);
+      InvalidateCachedInstructions(static_cast<u32>(start), static_cast<u32>(end));
+    }
+  }
+
+  m_memory.Reset();
+  if (m_jit)
+    m_jit->ResetInvalidationCounts();
+  if (m_ir_interpreter)
+    m_ir_interpreter->ResetInvalidationCounts();
+  if (m_native_runner)
+    m_native_runner->Reset(*this);
+
+  m_input_queue.Clear();
+  m_output_queue.Clear();
+  m_pc = m_entry_pc;
   m_relative_base = 0;
   m_state = State::Paused;
+  m_fault = Fault::None;
 }
 
-Computer::State Computer::Run(int num_instructions /*= -1*/)
+void Computer::SetAccessPolicy(AccessPolicy policy)
 {
-  assert(m_state != State::Halted);
+  assert(m_state != State::Executing);
+  if (policy == m_access_policy)
+    return;
 
-  m_state = State::Executing;
-  while (m_state == State::Executing)
+  // decoded instructions hold the handlers of the old policy
+  m_access_policy = policy;
+  InvalidateCachedInstructions(0, static_cast<u32>(m_instruction_cache_flags.size()));
+}
+
+bool Computer::SaveState(const char* filename, std::string* error_message) const
+{
+  return Snapshot::Save(*this, filename, error_message);
+}
+
+bool Computer::LoadState(const char* filename, std::string* error_message)
+{
+  return Snapshot::Load(*this, filename, error_message);
+}
+
+namespace {
+
+struct NoHooks
+{
+  void OnInstruction(const Computer&, u32, const Instruction&) {}
+};
+
+struct ProfilerAndRecorderHooks
+{
+  Profiler& profiler;
+  Recorder& recorder;
+
+  void OnInstruction(const Computer& comp, u32 pc, const Instruction& instr)
+  {
+    profiler.OnInstruction(comp, pc, instr);
+    recorder.OnInstruction(comp, pc, instr);
+  }
+};
+
+} // namespace
+
+template<typename Hooks>
+void Computer::Interpret(Hooks& hooks, int num_instructions)
+{
+  if (num_instructions < 0)
   {
-    Instruction instr;
-    FetchInstruction(&instr);
+    while (m_state == State::Executing)
+    {
+      const u32 pc = m_pc;
+      const CachedInstruction& cached = FetchCachedInstruction();
+      if constexpr (std::is_same_v<Hooks, NoHooks>)
+      {
+        cached.fused_handler(*this, cached.instr);
+      }
+      else
+      {
+        // hooks see every instruction, so fused sequences are executed one instruction at a time
+        cached.handler(*this, cached.instr);
+        hooks.OnInstruction(*this, pc, cached.instr);
+      }
+    }
 
-    // std::printf("%u: %s\n", m_pc, instr.Disassemble().c_str());
+    return;
+  }
 
-    ExecuteInstruction(instr);
+  while (m_state == State::Executing)
+  {
+    const u32 pc = m_pc;
+    const CachedInstruction& cached = FetchCachedInstruction();
+    cached.handler(*this, cached.instr);
+    hooks.OnInstruction(*this, pc, cached.instr);
 
     if (num_instructions > 0)
     {
@@ -223,180 +1081,290 @@ Computer::State Computer::Run(int num_instructions /*= -1*/)
       }
     }
   }
+}
+
+Computer::State Computer::Run(int num_instructions /*= -1*/)
+{
+  assert(m_state != State::Halted && m_state != State::Faulted);
+
+  m_state = State::Executing;
+
+  // the hooks are chosen once per call, so runs without a profiler or recorder execute the plain loop
+  if (m_profiler && m_recorder)
+  {
+    ProfilerAndRecorderHooks hooks{*m_profiler, *m_recorder};
+    Interpret(hooks, num_instructions);
+    return m_state;
+  }
+  if (m_profiler)
+  {
+    Interpret(*m_profiler, num_instructions);
+    return m_state;
+  }
+  if (m_recorder)
+  {
+    Interpret(*m_recorder, num_instructions);
+    return m_state;
+  }
+
+  // only the interpreter's handlers check accesses
+  if (m_access_policy == AccessPolicy::Strict)
+  {
+    NoHooks hooks;
+    Interpret(hooks, num_instructions);
+    return m_state;
+  }
+
+  // the JIT does not count instructions, so single-stepping always goes through the interpreter
+  if (m_jit && num_instructions < 0)
+  {
+    m_jit->Execute(*this);
+    return m_state;
+  }
+
+  // neither does skipping calls
+  if (m_call_memoizer && num_instructions < 0)
+  {
+    m_call_memoizer->Execute(*this);
+    return m_state;
+  }
+
+  // nor transpiled code
+  if (m_native_runner && num_instructions < 0)
+  {
+    m_native_runner->Execute(*this);
+    return m_state;
+  }
+
+  // nor lifted blocks
+  if (m_ir_interpreter && num_instructions < 0)
+  {
+    m_ir_interpreter->Execute(*this);
+    return m_state;
+  }
 
+  NoHooks hooks;
+  Interpret(hooks, num_instructions);
   return m_state;
 }
 
 void Computer::SetInput(MemoryCellType value)
 {
-  assert(!m_has_input);
-  m_input = value;
-  m_has_input = true;
+  m_input_queue.Push(value);
 }
 
 MemoryCellType Computer::GetOutput()
 {
-  assert(m_has_output);
-  MemoryCellType output = m_output;
-  m_has_output = false;
-  m_output = 0;
-  return output;
+  return m_output_queue.Pop();
+}
+
+u32 Computer::PushInputs(const MemoryCellType* values, u32 count)
+{
+  return static_cast<u32>(m_input_queue.PushRange(values, count));
+}
+
+u32 Computer::DrainOutputs(MemoryCellType* values, u32 max_count)
+{
+  return static_cast<u32>(m_output_queue.PopRange(values, max_count));
 }
 
 bool Computer::IsValidAddress(MemoryCellType address) const
 {
-  return (address >= 0 && static_cast<size_t>(address) < m_memory.size());
+  return (address >= 0);
 }
 
-void Computer::FetchInstruction(Instruction* instr)
+void Computer::FetchInstruction(u32 pc, Instruction* instr) const
 {
-  u32 new_pc = m_pc;
+  MemoryCellType cells[MAX_OPERANDS_PER_INSTRUCTION + 1];
+  for (u32 i = 0; i <= MAX_OPERANDS_PER_INSTRUCTION; i++)
+    cells[i] = ReadMemory(u64(pc) + i);
 
-  const MemoryCellType first = ReadMemory(new_pc++);
-  instr->opcode = static_cast<Opcode>(static_cast<u8>(first % 100));
-  instr->operand_modes[0] = static_cast<OperandMode>(static_cast<u8>((first / 100) % 10));
-  instr->operand_modes[1] = static_cast<OperandMode>(static_cast<u8>((first / 1000) % 10));
-  instr->operand_modes[2] = static_cast<OperandMode>(static_cast<u8>((first / 10000) % 10));
+  // strict computers fault when they get to an unknown opcode, which has no length to decode
+  const Opcode opcode = static_cast<Opcode>(static_cast<u8>(cells[0] % 100));
+  if (m_access_policy == AccessPolicy::Strict && !InstructionHandlers::IsKnownOpcode(opcode))
+  {
+    *instr = {};
+    instr->opcode = opcode;
+    instr->operand_modes.fill(OperandMode::None);
+    instr->length = 1;
+    return;
+  }
 
-  const u32 num_parameters = GetNumOperandsForOpcode(instr->opcode);
-  for (u32 i = 0; i < num_parameters; i++)
-    instr->operand_values[i] = ReadMemory(new_pc++);
-  for (u32 i = num_parameters; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
-    instr->operand_modes[i] = OperandMode::None;
+  DecodeInstruction(cells, instr);
 }
 
-void Computer::ExecuteInstruction(const Instruction& instr)
+const Computer::CachedInstruction& Computer::FetchCachedInstruction()
 {
-  switch (instr.opcode)
+  if (m_pc >= m_instruction_cache_flags.size())
   {
-    case Opcode::add:
-    {
-      const MemoryCellType lhs = ReadOperand(instr, 0);
-      const MemoryCellType rhs = ReadOperand(instr, 1);
-      WriteOperand(instr, 2, lhs + rhs);
-      m_pc += 4;
-      return;
-    }
+    FetchInstruction(m_pc, &m_uncached_instruction.instr);
+    m_uncached_instruction.handler = InstructionHandlers::GetHandler(m_uncached_instruction.instr, m_access_policy);
+    m_uncached_instruction.fused_handler = m_uncached_instruction.handler;
+    return m_uncached_instruction;
+  }
 
-    case Opcode::mul:
-    {
-      const MemoryCellType lhs = ReadOperand(instr, 0);
-      const MemoryCellType rhs = ReadOperand(instr, 1);
-      WriteOperand(instr, 2, lhs * rhs);
-      m_pc += 4;
-      return;
-    }
+  if (m_instruction_cache_flags[m_pc] & INSTRUCTION_CACHE_VALID)
+    return GetCachedInstruction(m_pc);
 
-    case Opcode::in:
-    {
-      if (!m_has_input)
-      {
-        // leave pc as-is so we re-execute after input is provided
-        m_state = State::WaitingForInput;
-        return;
-      }
+  DecodeCachedInstruction(m_pc);
+  return GetCachedInstruction(m_pc);
+}
 
-      WriteOperand(instr, 0, m_input);
-      m_input = 0;
-      m_has_input = false;
-      m_pc += 2;
-      return;
-    }
+Computer::CachedInstruction& Computer::GetWritableCachedInstruction(u32 pc)
+{
+  // another computer may be using the page, give this one its own copy before changing it
+  std::shared_ptr<InstructionCachePage>& page = m_instruction_cache_pages[pc >> PagedMemory::PAGE_SHIFT];
+  if (!page)
+    page = std::make_shared<InstructionCachePage>();
+  else if (page.use_count() > 1)
+    page = std::make_shared<InstructionCachePage>(*page);
+
+  return (*page)[pc & PagedMemory::PAGE_MASK];
+}
 
-    case Opcode::out:
-    {
-      if (m_has_output)
-      {
-        // leave pc as-is so we re-execute after consuming output
-        m_state = State::WaitingForOutput;
-        return;
-      }
+void Computer::DecodeCachedInstruction(u32 pc)
+{
+  CachedInstruction& cached = GetWritableCachedInstruction(pc);
+  FetchInstruction(pc, &cached.instr);
+  cached.handler = InstructionHandlers::GetHandler(cached.instr, m_access_policy);
+  m_instruction_cache_flags[pc] |= INSTRUCTION_CACHE_VALID;
+  const u32 end_pc = std::min(pc + cached.instr.length, static_cast<u32>(m_instruction_cache_flags.size()));
+  for (u32 cell = pc; cell < end_pc; cell++)
+    m_instruction_cache_flags[cell] |= INSTRUCTION_CACHE_COVERED;
+
+  FuseCachedInstruction(pc);
+}
 
-      // write output, increment pc
-      m_output = ReadOperand(instr, 0);
-      m_has_output = true;
-      m_state = State::WaitingForOutput;
-      m_pc += 2;
-      return;
-    }
+void Computer::FuseCachedInstruction(u32 pc)
+{
+  CachedInstruction& cached = GetWritableCachedInstruction(pc);
+  cached.fused_handler = cached.handler;
+  m_instruction_cache_flags[pc] &= ~INSTRUCTION_CACHE_FUSED;
+
+  // fused handlers skip the checks
+  if (m_access_policy == AccessPolicy::Strict)
+    return;
+
+  // the next instruction has to be cached as well, peek at its opcode before decoding it
+  const u32 next_pc = pc + cached.instr.length;
+  if ((u64(next_pc) + MAX_OPERANDS_PER_INSTRUCTION) >= m_instruction_cache_flags.size())
+    return;
+
+  const Opcode next_opcode = static_cast<Opcode>(static_cast<u8>(ReadMemory(next_pc) % 100));
+  if (!InstructionHandlers::MayFuse(cached.instr.opcode, next_opcode))
+    return;
+
+  // sequences are at most three instructions long, MayFuse() never allows an add after an add
+  if (!(m_instruction_cache_flags[next_pc] & INSTRUCTION_CACHE_VALID))
+    DecodeCachedInstruction(next_pc);
+
+  const bool next_is_fused = (m_instruction_cache_flags[next_pc] & INSTRUCTION_CACHE_FUSED) != 0;
+  const InstructionHandler fused_handler =
+    InstructionHandlers::GetFusedHandler(cached.instr, GetCachedInstruction(next_pc).instr, next_is_fused);
+  if (fused_handler)
+  {
+    cached.fused_handler = fused_handler;
+    m_instruction_cache_flags[pc] |= INSTRUCTION_CACHE_FUSED;
+  }
+}
 
-    case Opcode::jnz:
-    {
-      const MemoryCellType value = ReadOperand(instr, 0);
-      if (value != 0)
-      {
-        const MemoryCellType new_pc = ReadOperand(instr, 1);
-        assert(new_pc >= 0 && "jumping to positive pc");
-        m_pc = static_cast<u32>(new_pc);
-      }
-      else
-      {
-        // branch not taken
-        m_pc += 3;
-      }
+void Computer::InvalidateCachedInstructions(u32 start_address, u32 end_address)
+{
+  // Any instruction overlapping the range must start within the previous MAX_OPERANDS_PER_INSTRUCTION cells.
+  const u32 first_pc =
+    (start_address > MAX_OPERANDS_PER_INSTRUCTION) ? (start_address - MAX_OPERANDS_PER_INSTRUCTION) : 0;
+  u32 start_pc = first_pc;
+  u32 end_pc = first_pc;
+  for (u32 pc = first_pc; pc < end_address; pc++)
+  {
+    if (!(m_instruction_cache_flags[pc] & INSTRUCTION_CACHE_VALID))
+      continue;
 
-      return;
-    }
+    const u32 length = GetCachedInstruction(pc).instr.length;
+    if ((pc + length) <= start_address)
+      continue;
 
-    case Opcode::jz:
+    m_instruction_cache_flags[pc] &= ~(INSTRUCTION_CACHE_VALID | INSTRUCTION_CACHE_FUSED);
+    end_pc = std::max(end_pc, pc + length);
+
+    // instructions fused with this one would still execute it, so they are evicted too
+    u32 next_pc = pc;
+    for (u32 distance = 1; distance <= (MAX_OPERANDS_PER_INSTRUCTION + 1) && distance <= next_pc; distance++)
     {
-      const MemoryCellType value = ReadOperand(instr, 0);
-      if (value == 0)
-      {
-        const MemoryCellType new_pc = ReadOperand(instr, 1);
-        assert(new_pc >= 0 && "jumping to positive pc");
-        m_pc = static_cast<u32>(new_pc);
-      }
-      else
+      const u32 prev_pc = next_pc - distance;
+      if ((m_instruction_cache_flags[prev_pc] & INSTRUCTION_CACHE_FUSED) &&
+          (prev_pc + GetCachedInstruction(prev_pc).instr.length) == next_pc)
       {
-        // branch not taken
-        m_pc += 3;
+        m_instruction_cache_flags[prev_pc] &= ~(INSTRUCTION_CACHE_VALID | INSTRUCTION_CACHE_FUSED);
+        start_pc = std::min(start_pc, prev_pc);
+        next_pc = prev_pc;
+        distance = 0;
       }
-
-      return;
     }
+  }
 
-    case Opcode::slt:
+  // Recompute coverage for the cells of the evicted instructions, other cached instructions may still overlap them.
+  for (u32 cell = start_pc; cell < end_pc; cell++)
+  {
+    bool covered = false;
+    const u32 start = (cell > MAX_OPERANDS_PER_INSTRUCTION) ? (cell - MAX_OPERANDS_PER_INSTRUCTION) : 0;
+    for (u32 pc = start; pc <= cell && !covered; pc++)
     {
-      const MemoryCellType lhs = ReadOperand(instr, 0);
-      const MemoryCellType rhs = ReadOperand(instr, 1);
-      WriteOperand(instr, 2, lhs < rhs ? 1 : 0);
-      m_pc += 4;
-      return;
+      covered = (m_instruction_cache_flags[pc] & INSTRUCTION_CACHE_VALID) &&
+                (pc + GetCachedInstruction(pc).instr.length) > cell;
     }
 
-    case Opcode::seq:
-    {
-      const MemoryCellType lhs = ReadOperand(instr, 0);
-      const MemoryCellType rhs = ReadOperand(instr, 1);
-      WriteOperand(instr, 2, lhs == rhs ? 1 : 0);
-      m_pc += 4;
-      return;
-    }
+    if (!covered)
+      m_instruction_cache_flags[cell] &= ~INSTRUCTION_CACHE_COVERED;
+  }
 
-    case Opcode::rbaddr:
-    {
-      const MemoryCellType mod = ReadOperand(instr, 0);
-      m_relative_base += mod;
-      m_pc += 2;
-      return;
-    }
+  // results of calls may depend on the instructions which were evicted
+  if (m_call_memoizer && end_pc > first_pc)
+    m_call_memoizer->Clear();
 
-    case Opcode::halt:
-    {
-      m_state = State::Halted;
-      m_pc++;
-      return;
-    }
+  if (m_jit && std::any_of(m_instruction_cache_flags.begin() + start_address,
+                           m_instruction_cache_flags.begin() + end_address,
+                           [](u8 flags) { return (flags & INSTRUCTION_CACHE_COMPILED) != 0; }))
+  {
+    m_jit->InvalidateRange(*this, start_address, end_address);
+  }
 
-    default:
-    {
-      assert(false && "Unknown opcode");
-      return;
-    }
+  if (m_ir_interpreter && std::any_of(m_instruction_cache_flags.begin() + start_address,
+                                      m_instruction_cache_flags.begin() + end_address,
+                                      [](u8 flags) { return (flags & INSTRUCTION_CACHE_COMPILED) != 0; }))
+  {
+    m_ir_interpreter->InvalidateRange(*this, start_address, end_address);
+  }
+
+  if (m_native_runner && std::any_of(m_instruction_cache_flags.begin() + start_address,
+                                     m_instruction_cache_flags.begin() + end_address,
+                                     [](u8 flags) { return (flags & INSTRUCTION_CACHE_NATIVE) != 0; }))
+  {
+    m_native_runner->InvalidateRange(*this, start_address, end_address);
   }
 }
 
+void Computer::ExecuteInstruction(const Instruction& instr)
+{
+  InstructionHandlers::GetHandler(instr, m_access_policy)(*this, instr);
+}
+
+bool Computer::RequestInput()
+{
+  MemoryCellType value;
+  if (!m_input_provider || !m_input_provider(&value))
+    return false;
+
+  m_input_queue.Push(value);
+  return true;
+}
+
+void Computer::StepInstruction()
+{
+  const CachedInstruction& cached = FetchCachedInstruction();
+  cached.handler(*this, cached.instr);
+}
+
 MemoryCellType Computer::ReadOperand(const Instruction& instr, u32 index) const
 {
   switch (instr.operand_modes[index])
@@ -405,7 +1373,7 @@ MemoryCellType Computer::ReadOperand(const Instruction& instr, u32 index) const
     {
       const MemoryCellType address = instr.operand_values[index];
       assert(IsValidAddress(address));
-      return ReadMemory(static_cast<u32>(address));
+      return ReadMemory(static_cast<u64>(address));
     }
 
     case OperandMode::Immediate:
@@ -417,7 +1385,7 @@ MemoryCellType Computer::ReadOperand(const Instruction& instr, u32 index) const
     {
       const MemoryCellType address = m_relative_base + instr.operand_values[index];
       assert(IsValidAddress(address));
-      return ReadMemory(static_cast<u32>(address));
+      return ReadMemory(static_cast<u64>(address));
     }
 
     default:
@@ -436,7 +1404,7 @@ void Computer::WriteOperand(const Instruction& instr, u32 index, MemoryCellType
     {
       const MemoryCellType address = instr.operand_values[index];
       assert(IsValidAddress(address));
-      WriteMemory(static_cast<u32>(address), value);
+      WriteMemory(static_cast<u64>(address), value);
     }
     break;
 
@@ -450,7 +1418,7 @@ void Computer::WriteOperand(const Instruction& instr, u32 index, MemoryCellType
     {
       const MemoryCellType address = m_relative_base + instr.operand_values[index];
       assert(IsValidAddress(address));
-      WriteMemory(static_cast<u32>(address), value);
+      WriteMemory(static_cast<u64>(address), value);
     }
     break;
 
@@ -462,36 +1430,39 @@ void Computer::WriteOperand(const Instruction& instr, u32 index, MemoryCellType
   }
 }
 
-void RunProgramAndPrintOutput(const char* progname, const CodeVector& code, const CodeVector& input)
+void RunProgramAndPrintOutput(const char* progname, const CodeVector& code, const CodeVector& input,
+                              bool profile /*= false*/)
 {
   ScopeTimer timer(progname);
 
-  std::deque<MemoryCellType> input_queue;
-  std::deque<MemoryCellType> output_queue;
-
-  std::copy(input.begin(), input.end(), std::back_inserter(input_queue));
+  CodeVector output_queue;
 
+  Profiler profiler;
   Computer comp(code);
+  comp.SetInputQueueCapacity(1024);
+  comp.SetOutputQueueCapacity(1024);
+  if (profile)
+    comp.SetProfiler(&profiler);
 
-  Computer::State state;
-  while ((state = comp.Run()) != Computer::State::Halted)
+  size_t input_pos = 0;
+  for (;;)
   {
-    if (state == Computer::State::WaitingForInput)
-    {
-      if (input_queue.empty())
-      {
-        std::printf("%s: input requested and none available\n", progname);
-        std::abort();
-      }
+    input_pos += comp.PushInputs(input.data() + input_pos, static_cast<u32>(input.size() - input_pos));
 
-      comp.SetInput(input_queue.front());
-      input_queue.pop_front();
-    }
-    else if (state == Intcode::Computer::State::WaitingForOutput)
+    const Computer::State state = comp.Run();
+
+    const size_t output_pos = output_queue.size();
+    output_queue.resize(output_pos + comp.GetPendingOutputCount());
+    comp.DrainOutputs(output_queue.data() + output_pos, comp.GetPendingOutputCount());
+    // std::printf("%s: %zu outputs\n", progname, output_queue.size() - output_pos);
+
+    if (state == Computer::State::Halted)
+      break;
+
+    if (state == Computer::State::WaitingForInput && input_pos == input.size())
     {
-      const MemoryCellType output = comp.GetOutput();
-      // std::printf("%s: %" PRId64 "\n", progname, output);
-      output_queue.push_back(output);
+      std::printf("%s: input requested and none available\n", progname);
+      std::abort();
     }
   }
 
@@ -507,6 +1478,14 @@ void RunProgramAndPrintOutput(const char* progname, const CodeVector& code, cons
     }
     std::fprintf(stdout, "]\n");
   }
+
+  if (profile)
+  {
+    const CodeAnalysis analysis(code);
+    std::string report;
+    profiler.AppendReport(&report, &analysis);
+    std::fprintf(stdout, "%s %s", progname, report.c_str());
+  }
 }
 
 } // namespace Intcode
\ No newline at end of file
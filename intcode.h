@@ -1,13 +1,20 @@
 #pragma once
+#include "paged_memory.h"
+#include "ring_buffer.h"
 #include <array>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 
 namespace Intcode {
 using u8 = std::uint8_t;
+using u16 = std::uint16_t;
 using u32 = std::uint32_t;
+using u64 = std::uint64_t;
+using s32 = std::int32_t;
 using s64 = std::int64_t;
 
 using MemoryCellType = s64;
@@ -15,7 +22,8 @@ using CodeVector = std::vector<MemoryCellType>;
 
 enum : u32
 {
-  MAX_OPERANDS_PER_INSTRUCTION = 3
+  MAX_OPERANDS_PER_INSTRUCTION = 3,
+  MAX_DISASSEMBLY_LENGTH = 128
 };
 
 enum class Opcode : u8
@@ -33,6 +41,7 @@ enum class Opcode : u8
 };
 
 u32 GetNumOperandsForOpcode(Opcode opcode);
+const char* GetOpcodeName(Opcode opcode);
 
 enum class OperandMode : u8
 {
@@ -47,13 +56,37 @@ struct Instruction
   Opcode opcode;
   std::array<OperandMode, MAX_OPERANDS_PER_INSTRUCTION> operand_modes;
   std::array<MemoryCellType, MAX_OPERANDS_PER_INSTRUCTION> operand_values;
+  u32 length;
 
   std::string Disassemble() const;
+  void AppendDisassembly(std::string* str) const;
 };
 
+// Decodes the instruction starting at cells[0]. cells holds MAX_OPERANDS_PER_INSTRUCTION + 1 values, values past the
+// end of the instruction are ignored.
+void DecodeInstruction(const MemoryCellType* cells, Instruction* instr);
+
+// Same as DecodeInstruction(), but returns false instead of decoding an unknown opcode or operand mode.
+bool TryDecodeInstruction(const MemoryCellType* cells, Instruction* instr);
+
+// Parses comma-separated cells, whitespace is allowed around each one. Malformed input is reported with its line and
+// column, the plain versions print the error and return an empty vector.
+bool TryParseCode(std::string_view code_string, CodeVector* code, std::string* error_message = nullptr);
+bool TryParseCodeFromFile(const char* filename, CodeVector* code, std::string* error_message = nullptr);
 CodeVector ParseCode(std::string_view code_string);
 CodeVector ParseCodeFromFile(const char* filename);
 
+class CallMemoizer;
+class IrInterpreter;
+class JitX64;
+class NativeContext;
+class NativeProgramRunner;
+class Profiler;
+class ProgramImage;
+class Recorder;
+class Snapshot;
+struct NativeProgram;
+
 class Computer
 {
 public:
@@ -63,47 +96,249 @@ public:
     Executing,
     Halted,
     WaitingForInput,
-    WaitingForOutput
+    WaitingForOutput,
+    Faulted // only with AccessPolicy::Strict, see GetFault()
+  };
+
+  // How far a computer trusts its program. Unchecked computers run whatever the program does, an invalid access only
+  // trips an assert in debug builds. Strict computers check every instruction before running it, and stop at the first
+  // one which would access a negative address, jump outside the PC range, or cannot be decoded, with the PC left at
+  // it. Both run the same instruction handlers, instantiated once per policy.
+  enum class AccessPolicy : u32
+  {
+    Unchecked,
+    Strict
+  };
+
+  enum class Fault : u32
+  {
+    None,
+    InvalidInstruction, // unknown opcode or operand mode, or an immediate write operand
+    InvalidAddress,     // negative, or the relative base overflowed
+    InvalidJumpTarget   // negative, or past the largest PC
+  };
+
+  enum class Engine : u32
+  {
+    Interpreter,
+    JIT,      // falls back to the interpreter on hosts without JIT support
+    Memoizing, // interpreter which skips calls it has seen with the same arguments, see call_memoizer.h
+    Native,    // program transpiled to C++ ahead of time, see native_program.h
+    IR         // blocks lifted to an optimized IR and interpreted, see ir_interpreter.h
   };
 
-  Computer(const CodeVector& code, u32 memory_size = 16384);
+  // memory_size is the initially mapped range, which is also the range covered by the instruction cache and the JIT.
+  // Memory outside of it is still accessible.
+  Computer(const CodeVector& code, u32 memory_size = 16384, Engine engine = Engine::Interpreter);
+
+  // Runs straight from a mapped image, which is kept alive for as long as any of its pages are in use. Instructions
+  // decoded ahead of time are placed in the instruction cache, and the computer starts at (and resets to) the image's
+  // entry point.
+  Computer(std::shared_ptr<const ProgramImage> image, u32 memory_size = 16384, Engine engine = Engine::Interpreter);
+
+  // Runs a program transpiled by intcode-transpile, starting at its entry point. Blocks the program writes to are
+  // handed to the interpreter until the next reset.
+  explicit Computer(const NativeProgram& program, u32 memory_size = 16384);
+  Computer(Computer&&);
   ~Computer();
 
+  Computer& operator=(Computer&&);
+
+  // Returns an independent computer with the same state, memory, and pending input and output. Memory pages and
+  // decoded instructions are shared until either computer writes to them, so the cost does not depend on how much
+  // memory the program has used. Compiled or lifted code and memoized calls are not shared, the fork starts without
+  // them.
+  Computer Fork();
+
+  Engine GetEngine() const
+  {
+    if (m_jit)
+      return Engine::JIT;
+    else if (m_call_memoizer)
+      return Engine::Memoizing;
+    else if (m_native_runner)
+      return Engine::Native;
+    else if (m_ir_interpreter)
+      return Engine::IR;
+    else
+      return Engine::Interpreter;
+  }
+
   u32 GetPC() const { return m_pc; }
   s64 GetRelativeBase() const { return m_relative_base; }
   State GetState() const { return m_state; }
+  Fault GetFault() const { return m_fault; }
 
-  MemoryCellType ReadMemory(u32 address) const { return m_memory.at(address); }
-  void WriteMemory(u32 address, MemoryCellType value) { m_memory.at(address) = value; }
+  // Strict computers always run through the interpreter, whichever engine they were created with. Forks keep the
+  // policy of their parent.
+  AccessPolicy GetAccessPolicy() const { return m_access_policy; }
+  void SetAccessPolicy(AccessPolicy policy);
+
+  // Memory is sparse, any non-negative address can be accessed and reads zero until written.
+  MemoryCellType ReadMemory(u64 address) const { return m_memory.Read(address); }
+  void WriteMemory(u64 address, MemoryCellType value)
+  {
+    m_memory.Write(address, value);
+    if (address < m_instruction_cache_flags.size() && m_instruction_cache_flags[address] != 0)
+      InvalidateCachedInstructions(static_cast<u32>(address), static_cast<u32>(address) + 1);
+  }
 
   void Reset();
   State Run(int num_instructions = -1);
 
+  // Saves the registers, state, pending input and output, and every memory page written since the last reset, so a
+  // later LoadState() on a computer running the same program resumes where this one stopped. Not for use from inside
+  // Run(), e.g. in an input provider. Returns false and sets error_message on failure, see snapshot.h.
+  bool SaveState(const char* filename, std::string* error_message = nullptr) const;
+
+  // Leaves the computer untouched if the file is not a snapshot of this program. Reset() still goes back to the start
+  // of the program, not to the loaded state.
+  bool LoadState(const char* filename, std::string* error_message = nullptr);
+
+  // While a profiler is attached, Run() counts every instruction into it, always using the interpreter. Forks start
+  // without one.
+  Profiler* GetProfiler() const { return m_profiler; }
+  void SetProfiler(Profiler* profiler) { m_profiler = profiler; }
+
+  // Likewise, while a recorder is attached, Run() logs every input and output into it, see recording.h. Forks start
+  // without one.
+  Recorder* GetRecorder() const { return m_recorder; }
+  void SetRecorder(Recorder* recorder) { m_recorder = recorder; }
+
+  // For the hooks above, called after each instruction: whether the instruction at pc actually ran. Instructions
+  // waiting on I/O leave the PC alone and run again later, faulting instructions do not run at all.
+  bool DidInstructionRun(u32 pc) const
+  {
+    return m_pc != pc ||
+           (m_state != State::WaitingForInput && m_state != State::WaitingForOutput && m_state != State::Faulted);
+  }
+
+  // Input and output are queued. Run() only returns for I/O when an in instruction finds the input queue empty, or
+  // when the output queue becomes full. Both queues hold a single value by default.
+  u32 GetInputQueueCapacity() const { return static_cast<u32>(m_input_queue.GetCapacity()); }
+  u32 GetOutputQueueCapacity() const { return static_cast<u32>(m_output_queue.GetCapacity()); }
+  void SetInputQueueCapacity(u32 capacity) { m_input_queue.SetCapacity(capacity); }
+  void SetOutputQueueCapacity(u32 capacity) { m_output_queue.SetCapacity(capacity); }
+
+  bool CanPushInput() const { return !m_input_queue.IsFull(); }
+  bool HasOutput() const { return !m_output_queue.IsEmpty(); }
+  u32 GetPendingInputCount() const { return static_cast<u32>(m_input_queue.GetSize()); }
+  u32 GetPendingOutputCount() const { return static_cast<u32>(m_output_queue.GetSize()); }
+
   void SetInput(MemoryCellType value);
   MemoryCellType GetOutput();
 
+  // Queues as many of the values as there is space for, returning the number queued.
+  u32 PushInputs(const MemoryCellType* values, u32 count);
+
+  // Removes up to max_count pending outputs, returning the number removed.
+  u32 DrainOutputs(MemoryCellType* values, u32 max_count);
+
+  // Hosts which always have an answer ready can handle I/O inside Run() instead. The input provider is called when
+  // an in instruction finds the input queue empty, and returns false if it has no value yet, in which case Run()
+  // returns WaitingForInput as usual. With an output sink, every output is passed to it instead of being queued, and
+  // Run() never returns for output. Neither may call back into the computer. Forks start without them.
+  using InputProvider = std::function<bool(MemoryCellType* value)>;
+  using OutputSink = std::function<void(MemoryCellType value)>;
+  void SetInputProvider(InputProvider provider) { m_input_provider = std::move(provider); }
+  void SetOutputSink(OutputSink sink) { m_output_sink = std::move(sink); }
+
 private:
+  friend CallMemoizer;
+  friend IrInterpreter;
+  friend JitX64;
+  friend NativeContext;
+  friend NativeProgramRunner;
+  friend Snapshot;
+
+  enum : u8
+  {
+    INSTRUCTION_CACHE_VALID = (1 << 0),    // a decoded instruction starting at this cell is cached
+    INSTRUCTION_CACHE_COVERED = (1 << 1),  // this cell is part of at least one cached instruction
+    INSTRUCTION_CACHE_COMPILED = (1 << 2), // this cell is part of at least one block of the JIT or the IR engine
+    INSTRUCTION_CACHE_FUSED = (1 << 3),    // the cached instruction is fused with the one that follows it
+    INSTRUCTION_CACHE_NATIVE = (1 << 4),   // this cell is part of a block of the transpiled program
+  };
+
+  // Handlers are instantiated per opcode and operand mode combination, see intcode.cpp.
+  struct InstructionHandlers;
+  using InstructionHandler = void (*)(Computer& comp, const Instruction& instr);
+
+  // fused_handler is the same as handler, unless the instruction is fused with the instructions that follow it, in
+  // which case it executes all of them in a single dispatch.
+  struct CachedInstruction
+  {
+    Instruction instr;
+    InstructionHandler handler;
+    InstructionHandler fused_handler;
+  };
+
+  // Decoded instructions are paged like memory, so forks can share the pages neither side has decoded into since.
+  using InstructionCachePage = std::array<CachedInstruction, PagedMemory::PAGE_SIZE>;
+
+  Computer(PagedMemory memory, const Computer& parent);
+
   bool IsValidAddress(MemoryCellType address) const;
 
-  void FetchInstruction(Instruction* instr);
+  void FetchInstruction(u32 pc, Instruction* instr) const;
+  const CachedInstruction& FetchCachedInstruction();
+  const CachedInstruction& GetCachedInstruction(u32 pc) const
+  {
+    return (*m_instruction_cache_pages[pc >> PagedMemory::PAGE_SHIFT])[pc & PagedMemory::PAGE_MASK];
+  }
+  CachedInstruction& GetWritableCachedInstruction(u32 pc);
+  void DecodeCachedInstruction(u32 pc);
+  void FuseCachedInstruction(u32 pc);
+  void InvalidateCachedInstructions(u32 start_address, u32 end_address);
   void ExecuteInstruction(const Instruction& instr);
 
+  // Asks the input provider for a value, queueing it. Only called with an empty input queue.
+  bool RequestInput();
+  void StepInstruction();
+
+  // Interpreter loop, calling hooks.OnInstruction(*this, pc, instr) after each instruction.
+  template<typename Hooks>
+  void Interpret(Hooks& hooks, int num_instructions);
+
   MemoryCellType ReadOperand(const Instruction& instr, u32 index) const;
   void WriteOperand(const Instruction& instr, u32 index, MemoryCellType value);
 
-  std::vector<MemoryCellType> m_memory;
-  std::vector<MemoryCellType> m_orginal_code;
+  PagedMemory m_memory;
 
+  // Decoded instructions indexed by PC, so loop bodies are only decoded once. Only the first memory_size cells are
+  // cached, instructions above that are decoded every time they run.
+  // Writes to memory covered by a cached instruction invalidate it, which keeps self-modifying code working.
+  // Common sequences, such as a compare followed by a branch on its result, are fused when they are decoded. Fused
+  // instructions are invalidated along with the instructions they were fused with.
+  // Entries are only meaningful where this computer's flags say they are valid, which lets forks share a page until one
+  // side decodes a new instruction into it. Pages are allocated on the first decode.
+  std::vector<std::shared_ptr<InstructionCachePage>> m_instruction_cache_pages;
+  std::vector<u8> m_instruction_cache_flags;
+  CachedInstruction m_uncached_instruction = {};
+
+  u32 m_entry_pc = 0;
   u32 m_pc = 0;
   s64 m_relative_base = 0;
   State m_state = State::Paused;
+  Fault m_fault = Fault::None;
+  AccessPolicy m_access_policy = AccessPolicy::Unchecked;
+
+  RingBuffer<MemoryCellType> m_input_queue;
+  RingBuffer<MemoryCellType> m_output_queue;
+  InputProvider m_input_provider;
+  OutputSink m_output_sink;
 
-  MemoryCellType m_input = 0;
-  MemoryCellType m_output = 0;
-  bool m_has_input = false;
-  bool m_has_output = false;
+  std::unique_ptr<JitX64> m_jit;
+  std::unique_ptr<CallMemoizer> m_call_memoizer;
+  std::unique_ptr<NativeProgramRunner> m_native_runner;
+  std::unique_ptr<IrInterpreter> m_ir_interpreter;
+  Profiler* m_profiler = nullptr;
+  Recorder* m_recorder = nullptr;
 };
 
-void RunProgramAndPrintOutput(const char* progname, const CodeVector& code, const CodeVector& input);
+// Prints the output and how long the program took. With profile set, also prints a profile of the run annotated
+// with the program's blocks and loops.
+void RunProgramAndPrintOutput(const char* progname, const CodeVector& code, const CodeVector& input,
+                              bool profile = false);
 
 } // namespace Intcode
\ No newline at end of file
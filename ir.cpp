@@ -0,0 +1,688 @@
+#include "ir.h"
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <unordered_map>
+
+namespace Intcode {
+
+namespace {
+
+enum : u32
+{
+  NO_VALUE = 0xFFFFFFFFu
+};
+
+bool HasDestination(IrOpcode opcode)
+{
+  switch (opcode)
+  {
+    case IrOpcode::Const:
+    case IrOpcode::Copy:
+    case IrOpcode::LoadAbsolute:
+    case IrOpcode::LoadRelative:
+    case IrOpcode::Add:
+    case IrOpcode::Multiply:
+    case IrOpcode::LessThan:
+    case IrOpcode::Equals:
+    case IrOpcode::Input:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+u32 GetNumSources(IrOpcode opcode)
+{
+  switch (opcode)
+  {
+    case IrOpcode::Copy:
+    case IrOpcode::StoreAbsolute:
+    case IrOpcode::StoreRelative:
+    case IrOpcode::AdjustBase:
+    case IrOpcode::Output:
+    case IrOpcode::Jump:
+      return 1;
+
+    case IrOpcode::Add:
+    case IrOpcode::Multiply:
+    case IrOpcode::LessThan:
+    case IrOpcode::Equals:
+    case IrOpcode::JumpNonZero:
+    case IrOpcode::JumpZero:
+      return 2;
+
+    default:
+      return 0;
+  }
+}
+
+// Ops which can be dropped when nothing uses their value. Loads never fault, out of range addresses read zero.
+bool IsPure(IrOpcode opcode)
+{
+  return HasDestination(opcode) && opcode != IrOpcode::Input;
+}
+
+// Constant values of the registers defined by Const ops, filled in as the ops are visited in order.
+class ConstantValues
+{
+public:
+  explicit ConstantValues(const IrBlock& block) : m_known(block.registers.size()), m_values(block.registers.size()) {}
+
+  bool IsKnown(u32 reg) const { return reg < m_known.size() && m_known[reg]; }
+  MemoryCellType Get(u32 reg) const { return m_values[reg]; }
+
+  void Visit(const IrOp& op)
+  {
+    if (op.opcode == IrOpcode::Const)
+    {
+      m_known[op.dst] = true;
+      m_values[op.dst] = op.imm;
+    }
+  }
+
+private:
+  std::vector<bool> m_known;
+  std::vector<MemoryCellType> m_values;
+};
+
+class IrBuilder
+{
+public:
+  IrBuilder(IrBlock* block) : m_block(block) {}
+
+  void SetInstruction(u32 pc, const Instruction& instr)
+  {
+    m_pc = pc;
+    m_next_pc = pc + instr.length;
+  }
+
+  u32 Emit(IrOpcode opcode, u32 src0 = NO_VALUE, u32 src1 = NO_VALUE, s64 imm = 0)
+  {
+    const u32 dst = HasDestination(opcode) ? NewValue(m_block) : NO_VALUE;
+    m_block->ops.push_back({opcode, dst, {src0, src1}, imm, m_pc, m_next_pc});
+    return dst;
+  }
+
+  u32 EmitConstant(MemoryCellType value) { return Emit(IrOpcode::Const, NO_VALUE, NO_VALUE, value); }
+
+  u32 EmitRead(const Instruction& instr, u32 index)
+  {
+    switch (instr.operand_modes[index])
+    {
+      case OperandMode::Positional:
+        return Emit(IrOpcode::LoadAbsolute, NO_VALUE, NO_VALUE, instr.operand_values[index]);
+      case OperandMode::Relative:
+        return Emit(IrOpcode::LoadRelative, NO_VALUE, NO_VALUE, instr.operand_values[index]);
+      default:
+        return EmitConstant(instr.operand_values[index]);
+    }
+  }
+
+  void EmitWrite(const Instruction& instr, u32 index, u32 value)
+  {
+    const IrOpcode opcode = (instr.operand_modes[index] == OperandMode::Positional) ? IrOpcode::StoreAbsolute :
+                                                                                        IrOpcode::StoreRelative;
+    Emit(opcode, value, NO_VALUE, instr.operand_values[index]);
+  }
+
+  static u32 NewValue(IrBlock* block)
+  {
+    block->registers.push_back(0);
+    return static_cast<u32>(block->registers.size() - 1);
+  }
+
+private:
+  IrBlock* m_block;
+  u32 m_pc = 0;
+  u32 m_next_pc = 0;
+};
+
+bool CanLift(const Instruction& instr)
+{
+  switch (instr.opcode)
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::slt:
+    case Opcode::seq:
+      return (instr.operand_modes[2] != OperandMode::Immediate);
+
+    case Opcode::in:
+      return (instr.operand_modes[0] != OperandMode::Immediate);
+
+    case Opcode::out:
+    case Opcode::jnz:
+    case Opcode::jz:
+    case Opcode::rbaddr:
+      return true;
+
+    default:
+      // halt, left to the interpreter
+      return false;
+  }
+}
+
+void RemoveNops(IrBlock* block)
+{
+  block->ops.erase(std::remove_if(block->ops.begin(), block->ops.end(),
+                                  [](const IrOp& op) { return op.opcode == IrOpcode::Nop; }),
+                   block->ops.end());
+}
+
+void AppendRegister(std::string* str, const IrBlock& block, u32 reg)
+{
+  char buffer[32];
+  if (reg < block.num_constants)
+  {
+    str->push_back('#');
+    str->append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), block.registers[reg]).ptr);
+    return;
+  }
+
+  str->push_back('r');
+  str->append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), reg).ptr);
+}
+
+void AppendValue(std::string* str, s64 value)
+{
+  char buffer[32];
+  str->append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+} // namespace
+
+const char* GetIrOpcodeName(IrOpcode opcode)
+{
+  switch (opcode)
+  {
+    case IrOpcode::Nop:
+      return "nop";
+    case IrOpcode::Const:
+      return "const";
+    case IrOpcode::Copy:
+      return "copy";
+    case IrOpcode::LoadAbsolute:
+    case IrOpcode::LoadRelative:
+      return "load";
+    case IrOpcode::Add:
+      return "add";
+    case IrOpcode::Multiply:
+      return "mul";
+    case IrOpcode::LessThan:
+      return "lt";
+    case IrOpcode::Equals:
+      return "eq";
+    case IrOpcode::Input:
+      return "in";
+    case IrOpcode::StoreAbsolute:
+    case IrOpcode::StoreRelative:
+      return "store";
+    case IrOpcode::AdjustBase:
+      return "rbadd";
+    case IrOpcode::Output:
+      return "out";
+    case IrOpcode::Jump:
+      return "jump";
+    case IrOpcode::JumpNonZero:
+      return "jnz";
+    case IrOpcode::JumpZero:
+      return "jz";
+    default:
+      assert(false && "unknown IR opcode");
+      return "unknown";
+  }
+}
+
+bool LiftIrBlock(u32 start_pc, const Instruction* instructions, u32 num_instructions, IrBlock* block)
+{
+  block->start_pc = start_pc;
+  block->end_pc = start_pc;
+  block->num_instructions = 0;
+  block->ops.clear();
+  block->registers.clear();
+  block->num_constants = 0;
+
+  IrBuilder builder(block);
+  u32 pc = start_pc;
+  for (u32 i = 0; i < num_instructions && CanLift(instructions[i]); i++)
+  {
+    const Instruction& instr = instructions[i];
+    builder.SetInstruction(pc, instr);
+    pc += instr.length;
+    block->end_pc = pc;
+    block->num_instructions++;
+
+    switch (instr.opcode)
+    {
+      case Opcode::add:
+      case Opcode::mul:
+      case Opcode::slt:
+      case Opcode::seq:
+      {
+        const IrOpcode opcode = (instr.opcode == Opcode::add) ? IrOpcode::Add :
+                                (instr.opcode == Opcode::mul) ? IrOpcode::Multiply :
+                                (instr.opcode == Opcode::slt) ? IrOpcode::LessThan :
+                                                                IrOpcode::Equals;
+        const u32 lhs = builder.EmitRead(instr, 0);
+        const u32 rhs = builder.EmitRead(instr, 1);
+        builder.EmitWrite(instr, 2, builder.Emit(opcode, lhs, rhs));
+      }
+      break;
+
+      case Opcode::in:
+        builder.EmitWrite(instr, 0, builder.Emit(IrOpcode::Input));
+        break;
+
+      case Opcode::out:
+        builder.Emit(IrOpcode::Output, builder.EmitRead(instr, 0));
+        break;
+
+      case Opcode::rbaddr:
+        builder.Emit(IrOpcode::AdjustBase, builder.EmitRead(instr, 0));
+        break;
+
+      case Opcode::jnz:
+      case Opcode::jz:
+      {
+        const u32 condition = builder.EmitRead(instr, 0);
+        const u32 target = builder.EmitRead(instr, 1);
+        builder.Emit((instr.opcode == Opcode::jnz) ? IrOpcode::JumpNonZero : IrOpcode::JumpZero, condition, target);
+        return true;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  if (block->num_instructions == 0)
+    return false;
+
+  // carry on with whatever comes next, in another block or the interpreter
+  builder.Emit(IrOpcode::Jump, builder.EmitConstant(pc));
+  return true;
+}
+
+void PromoteIrMemory(IrBlock* block)
+{
+  // Stack slots are keyed by their offset from the relative base at the start of the block, for as long as it only
+  // moves by constants. A store to a cell may also write any stack slot and the other way around, positional and
+  // relative addresses are only known to differ from others of the same kind.
+  std::unordered_map<u64, u32> cells;
+  std::unordered_map<u64, u32> slots;
+  u64 base_offset = 0;
+
+  ConstantValues constants(*block);
+  for (IrOp& op : block->ops)
+  {
+    constants.Visit(op);
+    switch (op.opcode)
+    {
+      case IrOpcode::LoadAbsolute:
+      case IrOpcode::LoadRelative:
+      {
+        std::unordered_map<u64, u32>& values = (op.opcode == IrOpcode::LoadAbsolute) ? cells : slots;
+        const u64 key = static_cast<u64>(op.imm) + ((op.opcode == IrOpcode::LoadRelative) ? base_offset : 0);
+        const auto it = values.find(key);
+        if (it != values.end())
+        {
+          op.opcode = IrOpcode::Copy;
+          op.src[0] = it->second;
+        }
+        else
+        {
+          values.emplace(key, op.dst);
+        }
+      }
+      break;
+
+      case IrOpcode::StoreAbsolute:
+        cells[static_cast<u64>(op.imm)] = op.src[0];
+        slots.clear();
+        break;
+
+      case IrOpcode::StoreRelative:
+        slots[static_cast<u64>(op.imm) + base_offset] = op.src[0];
+        cells.clear();
+        break;
+
+      case IrOpcode::AdjustBase:
+      {
+        if (constants.IsKnown(op.src[0]))
+        {
+          base_offset += static_cast<u64>(constants.Get(op.src[0]));
+        }
+        else
+        {
+          slots.clear();
+          base_offset = 0;
+        }
+      }
+      break;
+
+      default:
+        break;
+    }
+  }
+}
+
+void FoldIrConstants(IrBlock* block)
+{
+  ConstantValues constants(*block);
+  for (IrOp& op : block->ops)
+  {
+    const auto make_constant = [&op](MemoryCellType value) {
+      op.opcode = IrOpcode::Const;
+      op.imm = value;
+    };
+    const auto make_copy = [&op](u32 src) {
+      op.opcode = IrOpcode::Copy;
+      op.src[0] = src;
+    };
+
+    const bool lhs_known = (GetNumSources(op.opcode) == 2) && constants.IsKnown(op.src[0]);
+    const bool rhs_known = (GetNumSources(op.opcode) == 2) && constants.IsKnown(op.src[1]);
+    const MemoryCellType lhs = lhs_known ? constants.Get(op.src[0]) : 0;
+    const MemoryCellType rhs = rhs_known ? constants.Get(op.src[1]) : 0;
+    switch (op.opcode)
+    {
+      case IrOpcode::Add:
+      {
+        if (lhs_known && rhs_known)
+          make_constant(static_cast<MemoryCellType>(static_cast<u64>(lhs) + static_cast<u64>(rhs)));
+        else if (lhs_known && lhs == 0)
+          make_copy(op.src[1]);
+        else if (rhs_known && rhs == 0)
+          make_copy(op.src[0]);
+      }
+      break;
+
+      case IrOpcode::Multiply:
+      {
+        if (lhs_known && rhs_known)
+          make_constant(static_cast<MemoryCellType>(static_cast<u64>(lhs) * static_cast<u64>(rhs)));
+        else if ((lhs_known && lhs == 0) || (rhs_known && rhs == 0))
+          make_constant(0);
+        else if (lhs_known && lhs == 1)
+          make_copy(op.src[1]);
+        else if (rhs_known && rhs == 1)
+          make_copy(op.src[0]);
+      }
+      break;
+
+      case IrOpcode::LessThan:
+      case IrOpcode::Equals:
+      {
+        const bool is_less_than = (op.opcode == IrOpcode::LessThan);
+        if (lhs_known && rhs_known)
+          make_constant(is_less_than ? (lhs < rhs) : (lhs == rhs));
+        else if (op.src[0] == op.src[1])
+          make_constant(is_less_than ? 0 : 1);
+      }
+      break;
+
+      case IrOpcode::AdjustBase:
+      {
+        if (constants.IsKnown(op.src[0]) && constants.Get(op.src[0]) == 0)
+          op.opcode = IrOpcode::Nop;
+      }
+      break;
+
+      default:
+        break;
+    }
+
+    constants.Visit(op);
+  }
+}
+
+void PropagateIrCopies(IrBlock* block)
+{
+  // values are defined before they are used, so a single pass resolves chains of copies
+  std::vector<u32> replacement(block->registers.size());
+  for (u32 i = 0; i < replacement.size(); i++)
+    replacement[i] = i;
+
+  for (IrOp& op : block->ops)
+  {
+    for (u32 i = 0; i < GetNumSources(op.opcode); i++)
+      op.src[i] = replacement[op.src[i]];
+
+    if (op.opcode == IrOpcode::Copy)
+    {
+      replacement[op.dst] = op.src[0];
+      op.opcode = IrOpcode::Nop;
+    }
+  }
+
+  RemoveNops(block);
+}
+
+void SimplifyIrBranches(IrBlock* block)
+{
+  ConstantValues constants(*block);
+  for (const IrOp& op : block->ops)
+    constants.Visit(op);
+
+  IrOp& branch = block->ops.back();
+  if (branch.opcode != IrOpcode::JumpNonZero && branch.opcode != IrOpcode::JumpZero)
+    return;
+
+  const bool target_is_next = constants.IsKnown(branch.src[1]) && constants.Get(branch.src[1]) == branch.next_pc;
+  if (!constants.IsKnown(branch.src[0]) && !target_is_next)
+    return;
+
+  const bool taken =
+    target_is_next || ((branch.opcode == IrOpcode::JumpNonZero) == (constants.Get(branch.src[0]) != 0));
+  if (taken)
+  {
+    branch.opcode = IrOpcode::Jump;
+    branch.src[0] = branch.src[1];
+    return;
+  }
+
+  // the branch falls through, jump to the next instruction instead
+  const u32 next_pc = IrBuilder::NewValue(block);
+  IrOp jump = {IrOpcode::Jump, NO_VALUE, {next_pc, NO_VALUE}, 0, branch.pc, branch.next_pc};
+  IrOp constant = {IrOpcode::Const, next_pc, {NO_VALUE, NO_VALUE}, branch.next_pc, branch.pc, branch.next_pc};
+  block->ops.back() = constant;
+  block->ops.push_back(jump);
+}
+
+void EliminateIrDeadStores(IrBlock* block)
+{
+  // Walks backwards collecting cells which are stored to later on. A store to one of them is dead unless something
+  // can observe the cell in between: a load which may alias it, or any point where execution can leave the block.
+  // Stores through the relative base are themselves such a point, they may overwrite the block, see ir_interpreter.h.
+  std::vector<u64> overwritten;
+  for (size_t i = block->ops.size(); i > 0; i--)
+  {
+    IrOp& op = block->ops[i - 1];
+    switch (op.opcode)
+    {
+      case IrOpcode::StoreAbsolute:
+      {
+        const u64 address = static_cast<u64>(op.imm);
+        if (address >= block->start_pc && address < block->end_pc)
+        {
+          overwritten.clear();
+        }
+        else if (std::find(overwritten.begin(), overwritten.end(), address) != overwritten.end())
+        {
+          op.opcode = IrOpcode::Nop;
+        }
+        else
+        {
+          overwritten.push_back(address);
+        }
+      }
+      break;
+
+      case IrOpcode::LoadAbsolute:
+        overwritten.erase(std::remove(overwritten.begin(), overwritten.end(), static_cast<u64>(op.imm)),
+                          overwritten.end());
+        break;
+
+      case IrOpcode::LoadRelative:
+      case IrOpcode::StoreRelative:
+      case IrOpcode::Input:
+      case IrOpcode::Output:
+      case IrOpcode::Jump:
+      case IrOpcode::JumpNonZero:
+      case IrOpcode::JumpZero:
+        overwritten.clear();
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  RemoveNops(block);
+}
+
+void EliminateIrDeadCode(IrBlock* block)
+{
+  std::vector<bool> used(block->registers.size());
+  for (size_t i = block->ops.size(); i > 0; i--)
+  {
+    IrOp& op = block->ops[i - 1];
+    if (IsPure(op.opcode) && !used[op.dst])
+    {
+      op.opcode = IrOpcode::Nop;
+      continue;
+    }
+
+    for (u32 j = 0; j < GetNumSources(op.opcode); j++)
+      used[op.src[j]] = true;
+  }
+
+  RemoveNops(block);
+}
+
+void AllocateIrRegisters(IrBlock* block)
+{
+  // constants first, each distinct value once
+  std::vector<u32> mapping(block->registers.size(), NO_VALUE);
+  std::vector<MemoryCellType> registers;
+  std::unordered_map<MemoryCellType, u32> constant_registers;
+  for (const IrOp& op : block->ops)
+  {
+    if (op.opcode != IrOpcode::Const)
+      continue;
+
+    const auto it = constant_registers.emplace(op.imm, static_cast<u32>(registers.size()));
+    if (it.second)
+      registers.push_back(op.imm);
+
+    mapping[op.dst] = it.first->second;
+  }
+
+  block->num_constants = static_cast<u32>(registers.size());
+  for (IrOp& op : block->ops)
+  {
+    if (op.opcode == IrOpcode::Const)
+    {
+      op.opcode = IrOpcode::Nop;
+      continue;
+    }
+
+    for (u32 i = 0; i < GetNumSources(op.opcode); i++)
+    {
+      assert(mapping[op.src[i]] != NO_VALUE && "value defined before use");
+      op.src[i] = mapping[op.src[i]];
+    }
+
+    if (HasDestination(op.opcode))
+    {
+      mapping[op.dst] = static_cast<u32>(registers.size());
+      op.dst = mapping[op.dst];
+      registers.push_back(0);
+    }
+  }
+
+  RemoveNops(block);
+  block->registers = std::move(registers);
+}
+
+void OptimizeIrBlock(IrBlock* block)
+{
+  // folding can turn relative base adjustments into constants, which lets more stack slots be promoted
+  for (u32 i = 0; i < 2; i++)
+  {
+    PromoteIrMemory(block);
+    PropagateIrCopies(block);
+    FoldIrConstants(block);
+    PropagateIrCopies(block);
+  }
+
+  SimplifyIrBranches(block);
+  EliminateIrDeadStores(block);
+  EliminateIrDeadCode(block);
+  AllocateIrRegisters(block);
+}
+
+void AppendIrBlock(std::string* str, const IrBlock& block)
+{
+  str->push_back('L');
+  AppendValue(str, block.start_pc);
+  str->append(": ; ");
+  AppendValue(str, block.num_instructions);
+  str->append(" instructions, ");
+  AppendValue(str, static_cast<s64>(block.ops.size()));
+  str->append(" ops\n");
+
+  for (const IrOp& op : block.ops)
+  {
+    str->append("  ");
+    if (HasDestination(op.opcode))
+    {
+      AppendRegister(str, block, op.dst);
+      str->append(" = ");
+    }
+
+    str->append(GetIrOpcodeName(op.opcode));
+    switch (op.opcode)
+    {
+      case IrOpcode::Const:
+        str->append(" #");
+        AppendValue(str, op.imm);
+        break;
+
+      case IrOpcode::LoadAbsolute:
+      case IrOpcode::StoreAbsolute:
+        str->append(" [");
+        AppendValue(str, op.imm);
+        str->push_back(']');
+        break;
+
+      case IrOpcode::LoadRelative:
+      case IrOpcode::StoreRelative:
+        str->append((op.imm < 0) ? " [rb - " : " [rb + ");
+        AppendValue(str, (op.imm < 0) ? static_cast<s64>(0 - static_cast<u64>(op.imm)) : op.imm);
+        str->push_back(']');
+        break;
+
+      default:
+        break;
+    }
+
+    const bool is_store = (op.opcode == IrOpcode::StoreAbsolute || op.opcode == IrOpcode::StoreRelative);
+    for (u32 i = 0; i < GetNumSources(op.opcode); i++)
+    {
+      str->append((i > 0 || is_store) ? ", " : " ");
+      AppendRegister(str, block, op.src[i]);
+    }
+
+    if (op.opcode == IrOpcode::JumpNonZero || op.opcode == IrOpcode::JumpZero)
+    {
+      str->append(" ; else ");
+      AppendValue(str, op.next_pc);
+    }
+    str->push_back('\n');
+  }
+}
+
+} // namespace Intcode
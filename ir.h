@@ -0,0 +1,89 @@
+#pragma once
+#include "intcode.h"
+#include <string>
+#include <vector>
+
+namespace Intcode {
+
+// Intermediate representation of a block of straight-line Intcode, ending in a jump or branch. Intcode instructions
+// go memory to memory, lifting splits them into loads, register operations and stores, so the passes below can keep
+// cells in registers and drop the memory traffic the program does not need.
+//
+// Before AllocateIrRegisters() the block is in SSA form: every op defining a value writes a register nothing else
+// writes. Cells addressed through positional operands and stack slots addressed through the relative base are only
+// promoted to registers within a block, since any other block, the host, or a write through an unknown relative base
+// may change them in between.
+enum class IrOpcode : u8
+{
+  Nop,
+  Const,         // dst = imm
+  Copy,          // dst = src0, removed by PropagateIrCopies()
+  LoadAbsolute,  // dst = [imm]
+  LoadRelative,  // dst = [rb + imm]
+  Add,           // dst = src0 + src1
+  Multiply,      // dst = src0 * src1
+  LessThan,      // dst = src0 < src1
+  Equals,        // dst = src0 == src1
+  Input,         // dst = next input, exits at pc when there is none
+  StoreAbsolute, // [imm] = src0
+  StoreRelative, // [rb + imm] = src0
+  AdjustBase,    // rb += src0
+  Output,        // outputs src0, exits at pc when the queue is full
+  Jump,          // continues at src0
+  JumpNonZero,   // continues at src1 if src0 != 0, otherwise at next_pc
+  JumpZero       // continues at src1 if src0 == 0, otherwise at next_pc
+};
+
+const char* GetIrOpcodeName(IrOpcode opcode);
+
+struct IrOp
+{
+  IrOpcode opcode;
+  u32 dst;
+  u32 src[2];
+  s64 imm;
+  u32 pc;      // the instruction this op was lifted from
+  u32 next_pc; // the instruction after it
+};
+
+struct IrBlock
+{
+  u32 start_pc;
+  u32 end_pc; // one past the last cell of the last instruction
+  u32 num_instructions;
+
+  // The last op is always a jump. Until AllocateIrRegisters(), there is one register per SSA value. After it, the first
+  // num_constants registers hold constants and are never written, the rest are scratch.
+  std::vector<IrOp> ops;
+  std::vector<MemoryCellType> registers;
+  u32 num_constants;
+};
+
+// Lifts instructions, which run one after the other from start_pc, stopping early at anything the IR cannot express.
+// Returns false if not even the first instruction could be lifted. Branches and halt end the block, halt itself is
+// left to the interpreter.
+bool LiftIrBlock(u32 start_pc, const Instruction* instructions, u32 num_instructions, IrBlock* block);
+
+// Optimization passes, each keeps the block in SSA form.
+// Forwards stored and loaded values to later loads of the same cell or stack slot.
+void PromoteIrMemory(IrBlock* block);
+// Evaluates operations on constants, and simplifies identities such as x + 0.
+void FoldIrConstants(IrBlock* block);
+// Makes users of copies refer to the original value.
+void PropagateIrCopies(IrBlock* block);
+// Turns branches on constants into jumps.
+void SimplifyIrBranches(IrBlock* block);
+// Drops stores to cells which are stored to again before anything can observe them.
+void EliminateIrDeadStores(IrBlock* block);
+// Drops ops without side effects whose values are never used.
+void EliminateIrDeadCode(IrBlock* block);
+
+// Moves constants into registers and numbers the remaining registers densely, the block is executable afterwards.
+void AllocateIrRegisters(IrBlock* block);
+
+// Runs every pass, then allocates registers.
+void OptimizeIrBlock(IrBlock* block);
+
+void AppendIrBlock(std::string* str, const IrBlock& block);
+
+} // namespace Intcode
@@ -0,0 +1,277 @@
+#include "ir_interpreter.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Intcode {
+
+enum : u32
+{
+  MAX_BLOCK_INSTRUCTIONS = 64,
+  MAX_BLOCK_INVALIDATIONS = 8
+};
+
+IrInterpreter::IrInterpreter(u32 memory_size)
+  : m_blocks(memory_size), m_cell_block_count(memory_size), m_invalidation_count(memory_size)
+{
+}
+
+IrInterpreter::~IrInterpreter() = default;
+
+void IrInterpreter::Execute(Computer& comp)
+{
+  while (comp.m_state == Computer::State::Executing)
+  {
+    IrBlock* block = LookupBlock(comp, comp.m_pc);
+    if (!block)
+    {
+      comp.StepInstruction();
+      continue;
+    }
+
+    // the block is dropped by the invalidation, so it has to have returned first
+    u32 written_address;
+    if (RunBlock(comp, *block, &written_address))
+      comp.InvalidateCachedInstructions(written_address, written_address + 1);
+  }
+}
+
+void IrInterpreter::InvalidateRange(Computer& comp, u32 start_address, u32 end_address)
+{
+  // blocks are bounded in length, so only a limited window of start addresses can cover the range
+  const u32 max_block_length = MAX_BLOCK_INSTRUCTIONS * (MAX_OPERANDS_PER_INSTRUCTION + 1);
+  const u32 first_pc = (start_address >= max_block_length) ? (start_address - max_block_length + 1) : 0;
+  for (u32 pc = first_pc; pc < end_address; pc++)
+  {
+    if (!m_blocks[pc] || m_blocks[pc]->end_pc <= start_address)
+      continue;
+
+    if (m_blocks[pc]->num_instructions > 0 && m_invalidation_count[pc] < MAX_BLOCK_INVALIDATIONS)
+      m_invalidation_count[pc]++;
+
+    RemoveBlock(comp, pc);
+  }
+}
+
+void IrInterpreter::ResetInvalidationCounts()
+{
+  std::fill(m_invalidation_count.begin(), m_invalidation_count.end(), u8(0));
+}
+
+bool IrInterpreter::LiftBlock(const Computer& comp, u32 start_pc, IrBlock* block)
+{
+  Instruction instructions[MAX_BLOCK_INSTRUCTIONS];
+  u32 num_instructions = 0;
+  for (u32 pc = start_pc; num_instructions < MAX_BLOCK_INSTRUCTIONS;)
+  {
+    Instruction& instr = instructions[num_instructions];
+    if (!DecodeInstruction(comp, pc, &instr))
+      break;
+
+    num_instructions++;
+    pc += instr.length;
+    if (instr.opcode == Opcode::jnz || instr.opcode == Opcode::jz || instr.opcode == Opcode::halt)
+      break;
+  }
+
+  if (!LiftIrBlock(start_pc, instructions, num_instructions, block))
+  {
+    // covers the cells the failure was decided from, so writing there lets the block be lifted again
+    block->end_pc = start_pc + ((num_instructions > 0) ? instructions[0].length : 1);
+    return false;
+  }
+
+  OptimizeIrBlock(block);
+  return true;
+}
+
+bool IrInterpreter::DecodeInstruction(const Computer& comp, u32 pc, Instruction* instr)
+{
+  // blocks past the instruction cache would not see writes
+  if ((static_cast<size_t>(pc) + MAX_OPERANDS_PER_INSTRUCTION) >= comp.m_instruction_cache_flags.size())
+    return false;
+
+  // FetchInstruction() expects a known opcode
+  switch (static_cast<Opcode>(static_cast<u8>(comp.ReadMemory(pc) % 100)))
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::in:
+    case Opcode::out:
+    case Opcode::jnz:
+    case Opcode::jz:
+    case Opcode::slt:
+    case Opcode::seq:
+    case Opcode::rbaddr:
+    case Opcode::halt:
+      break;
+
+    default:
+      return false;
+  }
+
+  comp.FetchInstruction(pc, instr);
+  return true;
+}
+
+IrBlock* IrInterpreter::LookupBlock(Computer& comp, u32 pc)
+{
+  if (pc >= m_blocks.size())
+    return nullptr;
+
+  // blocks which failed to lift are kept empty, so they are not retried until their instruction changes
+  if (m_blocks[pc])
+    return (m_blocks[pc]->num_instructions > 0) ? m_blocks[pc].get() : nullptr;
+  if (m_invalidation_count[pc] >= MAX_BLOCK_INVALIDATIONS)
+    return nullptr;
+
+  auto block = std::make_unique<IrBlock>();
+  const bool lifted = LiftBlock(comp, pc, block.get());
+  for (u32 cell = block->start_pc; cell < block->end_pc; cell++)
+  {
+    m_cell_block_count[cell]++;
+    comp.m_instruction_cache_flags[cell] |= Computer::INSTRUCTION_CACHE_COMPILED;
+  }
+
+  m_blocks[pc] = std::move(block);
+  return lifted ? m_blocks[pc].get() : nullptr;
+}
+
+void IrInterpreter::RemoveBlock(Computer& comp, u32 start_pc)
+{
+  const IrBlock& block = *m_blocks[start_pc];
+  for (u32 cell = block.start_pc; cell < block.end_pc; cell++)
+  {
+    if (--m_cell_block_count[cell] == 0)
+      comp.m_instruction_cache_flags[cell] &= ~Computer::INSTRUCTION_CACHE_COMPILED;
+  }
+
+  m_blocks[start_pc].reset();
+}
+
+bool IrInterpreter::RunBlock(Computer& comp, IrBlock& block, u32* written_address)
+{
+  MemoryCellType* const regs = block.registers.data();
+  const u8* const cell_flags = comp.m_instruction_cache_flags.data();
+  const u64 cache_size = comp.m_instruction_cache_flags.size();
+  s64 relative_base = comp.m_relative_base;
+
+  // every block ends in a jump, so there is no need to check for the end of the ops
+  for (const IrOp* op_ptr = block.ops.data();; op_ptr++)
+  {
+    const IrOp& op = *op_ptr;
+    switch (op.opcode)
+    {
+      case IrOpcode::LoadAbsolute:
+        regs[op.dst] = comp.m_memory.Read(static_cast<u64>(op.imm));
+        break;
+
+      case IrOpcode::LoadRelative:
+        regs[op.dst] = comp.m_memory.Read(static_cast<u64>(relative_base + op.imm));
+        break;
+
+      case IrOpcode::Add:
+        regs[op.dst] = regs[op.src[0]] + regs[op.src[1]];
+        break;
+
+      case IrOpcode::Multiply:
+        regs[op.dst] = regs[op.src[0]] * regs[op.src[1]];
+        break;
+
+      case IrOpcode::LessThan:
+        regs[op.dst] = (regs[op.src[0]] < regs[op.src[1]]) ? 1 : 0;
+        break;
+
+      case IrOpcode::Equals:
+        regs[op.dst] = (regs[op.src[0]] == regs[op.src[1]]) ? 1 : 0;
+        break;
+
+      case IrOpcode::Input:
+      {
+        if (comp.m_input_queue.IsEmpty() && !comp.RequestInput())
+        {
+          // re-execute the in instruction once input is provided
+          comp.m_pc = op.pc;
+          comp.m_relative_base = relative_base;
+          comp.m_state = Computer::State::WaitingForInput;
+          return false;
+        }
+
+        regs[op.dst] = comp.m_input_queue.Pop();
+      }
+      break;
+
+      case IrOpcode::StoreAbsolute:
+      case IrOpcode::StoreRelative:
+      {
+        const MemoryCellType address = (op.opcode == IrOpcode::StoreAbsolute) ? op.imm : (relative_base + op.imm);
+        assert(comp.IsValidAddress(address));
+        comp.m_memory.Write(static_cast<u64>(address), regs[op.src[0]]);
+        if (static_cast<u64>(address) < cache_size && cell_flags[address] != 0)
+        {
+          if (static_cast<u64>(address) >= block.start_pc && static_cast<u64>(address) < block.end_pc)
+          {
+            comp.m_pc = op.next_pc;
+            comp.m_relative_base = relative_base;
+            *written_address = static_cast<u32>(address);
+            return true;
+          }
+
+          comp.InvalidateCachedInstructions(static_cast<u32>(address), static_cast<u32>(address) + 1);
+        }
+      }
+      break;
+
+      case IrOpcode::AdjustBase:
+        relative_base += regs[op.src[0]];
+        break;
+
+      case IrOpcode::Output:
+      {
+        if (comp.m_output_sink)
+        {
+          comp.m_output_sink(regs[op.src[0]]);
+          break;
+        }
+
+        if (comp.m_output_queue.IsFull())
+        {
+          // re-execute the out instruction once output is consumed
+          comp.m_pc = op.pc;
+          comp.m_relative_base = relative_base;
+          comp.m_state = Computer::State::WaitingForOutput;
+          return false;
+        }
+
+        // only return to the host once the queue fills up
+        comp.m_output_queue.Push(regs[op.src[0]]);
+        if (comp.m_output_queue.IsFull())
+        {
+          comp.m_pc = op.next_pc;
+          comp.m_relative_base = relative_base;
+          comp.m_state = Computer::State::WaitingForOutput;
+          return false;
+        }
+      }
+      break;
+
+      case IrOpcode::Jump:
+      case IrOpcode::JumpNonZero:
+      case IrOpcode::JumpZero:
+      {
+        const bool taken = (op.opcode == IrOpcode::Jump) ||
+                           ((op.opcode == IrOpcode::JumpNonZero) == (regs[op.src[0]] != 0));
+        const MemoryCellType target = (op.opcode == IrOpcode::Jump) ? regs[op.src[0]] : regs[op.src[1]];
+        assert((!taken || target >= 0) && "jumping to positive pc");
+        comp.m_pc = taken ? static_cast<u32>(target) : op.next_pc;
+        comp.m_relative_base = relative_base;
+        return false;
+      }
+
+      default:
+        assert(false && "op removed by register allocation");
+        break;
+    }
+  }
+}
+
+} // namespace Intcode
@@ -0,0 +1,51 @@
+#pragma once
+#include "intcode.h"
+#include "ir.h"
+#include <memory>
+#include <vector>
+
+namespace Intcode {
+
+// Runs blocks lifted to IR and optimized, see ir.h. Values stay in registers within a block, so the memory traffic
+// the passes removed is never paid for, and the dispatch is per op rather than per instruction. Like the JIT, blocks
+// are dropped when the program writes into them, and anything the IR does not handle goes through the interpreter
+// one instruction at a time.
+//
+// A store into the block being run ends it after the storing instruction, since the rest of the block may no longer
+// match memory. Stores into any other block drop that block and carry on.
+class IrInterpreter
+{
+public:
+  IrInterpreter(u32 memory_size);
+  ~IrInterpreter();
+
+  // Runs the computer until it leaves the Executing state.
+  void Execute(Computer& comp);
+
+  // Drops every block overlapping [start_address, end_address).
+  void InvalidateRange(Computer& comp, u32 start_address, u32 end_address);
+
+  // Lets blocks which were dropped for self-modification be lifted again, used when the program is reset.
+  void ResetInvalidationCounts();
+
+private:
+  static bool DecodeInstruction(const Computer& comp, u32 pc, Instruction* instr);
+  static bool LiftBlock(const Computer& comp, u32 start_pc, IrBlock* block);
+
+  IrBlock* LookupBlock(Computer& comp, u32 pc);
+  void RemoveBlock(Computer& comp, u32 start_pc);
+
+  // Returns true if the block ended by writing into itself, at address.
+  bool RunBlock(Computer& comp, IrBlock& block, u32* written_address);
+
+  // by start PC, empty for PCs whose first instruction cannot be lifted
+  std::vector<std::unique_ptr<IrBlock>> m_blocks;
+
+  // number of blocks covering each cell, mirrored into INSTRUCTION_CACHE_COMPILED
+  std::vector<u16> m_cell_block_count;
+
+  // blocks which keep getting overwritten are left to the interpreter
+  std::vector<u8> m_invalidation_count;
+};
+
+} // namespace Intcode
@@ -0,0 +1,858 @@
+#include "jit_x64.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64_SUPPORTED 1
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace Intcode {
+
+// State shared between the dispatcher and compiled blocks. Blocks keep the relative base in a register and write it
+// back on exit, along with the PC to continue from. The page tables can be reallocated by the interpreter, so they
+// are refreshed before every block call.
+struct JitContext
+{
+  const MemoryCellType* const* read_pages;
+  MemoryCellType* const* write_pages;
+  u64 num_pages;
+  const u8* cell_flags;
+  s64 relative_base;
+  u64 pc;
+  u64 written_address;
+};
+
+enum : u32
+{
+  CODE_ARENA_SIZE = 4 * 1024 * 1024,
+  MAX_BLOCK_INSTRUCTIONS = 256,
+  MAX_BLOCK_INVALIDATIONS = 8
+};
+
+// Values returned from compiled blocks.
+enum : u32
+{
+  EXIT_CONTINUE = 0,     // dispatch the block at the new pc
+  EXIT_CODE_WRITTEN = 1, // a store hit a cached or compiled instruction, invalidate written_address
+  EXIT_INTERPRET = 2     // interpret the instruction at pc
+};
+
+constexpr u32 PAGE_SHIFT = static_cast<u32>(PagedMemory::PAGE_SHIFT);
+constexpr u32 PAGE_MASK = static_cast<u32>(PagedMemory::PAGE_MASK);
+
+class JitX64::CodeArena
+{
+public:
+  CodeArena(size_t size)
+  {
+#if defined(_WIN32)
+    m_base = static_cast<u8*>(VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+#else
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    m_base = (ptr != MAP_FAILED) ? static_cast<u8*>(ptr) : nullptr;
+#endif
+    m_size = m_base ? size : 0;
+  }
+
+  ~CodeArena()
+  {
+    if (!m_base)
+      return;
+
+#if defined(_WIN32)
+    VirtualFree(m_base, 0, MEM_RELEASE);
+#else
+    munmap(m_base, m_size);
+#endif
+  }
+
+  void* Allocate(const std::vector<u8>& code)
+  {
+    if ((m_size - m_used) < code.size())
+      return nullptr;
+
+    u8* ptr = m_base + m_used;
+    std::memcpy(ptr, code.data(), code.size());
+    m_used += code.size();
+    return ptr;
+  }
+
+  void Clear() { m_used = 0; }
+
+private:
+  u8* m_base = nullptr;
+  size_t m_size = 0;
+  size_t m_used = 0;
+};
+
+namespace {
+
+// Stands in for the block at a PC whose first instruction cannot be compiled, so it is not retried on every visit.
+// Dropped like any other block when the instruction is overwritten.
+u32 InterpretOnly(JitContext*)
+{
+  return EXIT_INTERPRET;
+}
+
+enum X64Reg : u8
+{
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R9 = 9,
+  R10 = 10,
+  R11 = 11,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+  R15 = 15,
+  NO_REG = 0xFF
+};
+
+enum X64Condition : u8
+{
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_L = 0xC
+};
+
+// Register assignment inside compiled blocks. All of these are callee-saved in both the SysV and Win64 ABIs.
+// rax, rcx, rdx, r8 and r9 are scratch.
+constexpr X64Reg REG_CONTEXT = RBX;
+constexpr X64Reg REG_CELL_FLAGS = RBP;
+constexpr X64Reg REG_READ_PAGES = R12;
+constexpr X64Reg REG_RELATIVE_BASE = R13;
+constexpr X64Reg REG_NUM_PAGES = R14;
+constexpr X64Reg REG_WRITE_PAGES = R15;
+#if defined(_WIN32)
+constexpr X64Reg REG_ARG0 = RCX;
+#else
+constexpr X64Reg REG_ARG0 = RDI;
+#endif
+
+constexpr s32 ContextOffset(size_t offset)
+{
+  return static_cast<s32>(offset);
+}
+
+// Minimal x86-64 encoder covering the instructions the block compiler needs. Memory operands always use a SIB byte
+// and a 32-bit displacement, which is valid for every base register.
+class Emitter
+{
+public:
+  const std::vector<u8>& GetCode() const { return m_code; }
+  size_t GetPosition() const { return m_code.size(); }
+
+  void MovRegReg(X64Reg dst, X64Reg src)
+  {
+    Rex(true, src, NO_REG, dst);
+    Byte(0x89);
+    ModRMReg(src, dst);
+  }
+
+  void MovRegImm(X64Reg dst, s64 imm)
+  {
+    Rex(true, NO_REG, NO_REG, dst);
+    if (imm >= INT32_MIN && imm <= INT32_MAX)
+    {
+      Byte(0xC7);
+      ModRMReg(RAX, dst);
+      Dword(static_cast<u32>(imm));
+    }
+    else
+    {
+      Byte(0xB8 | (dst & 7));
+      Qword(static_cast<u64>(imm));
+    }
+  }
+
+  void MovEaxImm(u32 imm)
+  {
+    Byte(0xB8);
+    Dword(imm);
+  }
+
+  // mov dst, qword [base + index * (1 << shift) + disp]
+  void MovRegMem(X64Reg dst, X64Reg base, X64Reg index, u8 shift, s32 disp)
+  {
+    Rex(true, dst, index, base);
+    Byte(0x8B);
+    ModRMMem(dst, base, index, shift, disp);
+  }
+
+  // mov qword [base + index * (1 << shift) + disp], src
+  void MovMemReg(X64Reg base, X64Reg index, u8 shift, s32 disp, X64Reg src)
+  {
+    Rex(true, src, index, base);
+    Byte(0x89);
+    ModRMMem(src, base, index, shift, disp);
+  }
+
+  void LeaRegMem(X64Reg dst, X64Reg base, s32 disp)
+  {
+    Rex(true, dst, NO_REG, base);
+    Byte(0x8D);
+    ModRMMem(dst, base, NO_REG, 0, disp);
+  }
+
+  void AddRegReg(X64Reg dst, X64Reg src) { AluRegReg(0x01, dst, src); }
+  void CmpRegReg(X64Reg lhs, X64Reg rhs) { AluRegReg(0x39, lhs, rhs); }
+  void TestRegReg(X64Reg lhs, X64Reg rhs) { AluRegReg(0x85, lhs, rhs); }
+
+  void AddRegImm(X64Reg dst, s32 imm) { AluRegImm(0, dst, imm); }
+  void AndRegImm(X64Reg dst, s32 imm) { AluRegImm(4, dst, imm); }
+  void CmpRegImm(X64Reg lhs, s32 imm) { AluRegImm(7, lhs, imm); }
+
+  void ShrRegImm(X64Reg dst, u8 shift)
+  {
+    Rex(true, NO_REG, NO_REG, dst);
+    Byte(0xC1);
+    ModRMReg(static_cast<X64Reg>(5), dst);
+    Byte(shift);
+  }
+
+  void ImulRegReg(X64Reg dst, X64Reg src)
+  {
+    Rex(true, dst, NO_REG, src);
+    Byte(0x0F);
+    Byte(0xAF);
+    ModRMReg(dst, src);
+  }
+
+  // cmp byte [base + index + disp], imm
+  void CmpByteMemImm(X64Reg base, X64Reg index, s32 disp, u8 imm)
+  {
+    Rex(false, NO_REG, index, base);
+    Byte(0x80);
+    ModRMMem(static_cast<X64Reg>(7), base, index, 0, disp);
+    Byte(imm);
+  }
+
+  // setcc al; movzx eax, al
+  void SetccEax(X64Condition cond)
+  {
+    Byte(0x0F);
+    Byte(0x90 | cond);
+    Byte(0xC0);
+    Byte(0x0F);
+    Byte(0xB6);
+    Byte(0xC0);
+  }
+
+  void Push(X64Reg reg)
+  {
+    Rex(false, NO_REG, NO_REG, reg);
+    Byte(0x50 | (reg & 7));
+  }
+
+  void Pop(X64Reg reg)
+  {
+    Rex(false, NO_REG, NO_REG, reg);
+    Byte(0x58 | (reg & 7));
+  }
+
+  void Ret() { Byte(0xC3); }
+
+  // Branches return the position of their displacement, which is later resolved with Bind().
+  size_t Jcc(X64Condition cond)
+  {
+    Byte(0x0F);
+    Byte(0x80 | cond);
+    Dword(0);
+    return m_code.size() - 4;
+  }
+
+  size_t Jmp()
+  {
+    Byte(0xE9);
+    Dword(0);
+    return m_code.size() - 4;
+  }
+
+  void Bind(size_t branch, size_t target)
+  {
+    const u32 rel = static_cast<u32>(static_cast<s32>(target - (branch + 4)));
+    for (u32 i = 0; i < 4; i++)
+      m_code[branch + i] = static_cast<u8>(rel >> (i * 8));
+  }
+
+private:
+  void Byte(u8 value) { m_code.push_back(value); }
+
+  void Dword(u32 value)
+  {
+    for (u32 i = 0; i < 4; i++)
+      Byte(static_cast<u8>(value >> (i * 8)));
+  }
+
+  void Qword(u64 value)
+  {
+    for (u32 i = 0; i < 8; i++)
+      Byte(static_cast<u8>(value >> (i * 8)));
+  }
+
+  void Rex(bool w, X64Reg reg, X64Reg index, X64Reg base)
+  {
+    u8 rex = 0x40;
+    if (w)
+      rex |= 0x08;
+    if (reg != NO_REG && (reg & 8))
+      rex |= 0x04;
+    if (index != NO_REG && (index & 8))
+      rex |= 0x02;
+    if (base != NO_REG && (base & 8))
+      rex |= 0x01;
+    if (rex != 0x40)
+      Byte(rex);
+  }
+
+  void ModRMReg(X64Reg reg, X64Reg rm) { Byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+  void ModRMMem(X64Reg reg, X64Reg base, X64Reg index, u8 shift, s32 disp)
+  {
+    Byte(0x84 | ((reg & 7) << 3));
+    Byte((shift << 6) | (((index == NO_REG) ? 4 : (index & 7)) << 3) | (base & 7));
+    Dword(static_cast<u32>(disp));
+  }
+
+  void AluRegReg(u8 opcode, X64Reg dst, X64Reg src)
+  {
+    Rex(true, src, NO_REG, dst);
+    Byte(opcode);
+    ModRMReg(src, dst);
+  }
+
+  // 81 /ext id
+  void AluRegImm(u8 ext, X64Reg dst, s32 imm)
+  {
+    Rex(true, NO_REG, NO_REG, dst);
+    Byte(0x81);
+    ModRMReg(static_cast<X64Reg>(ext), dst);
+    Dword(static_cast<u32>(imm));
+  }
+
+  std::vector<u8> m_code;
+};
+
+// Translates one basic block. Exits which are not expected to be taken (out of range relative addresses, stores into
+// code) are emitted out of line after the block body.
+class BlockCompiler
+{
+public:
+  BlockCompiler(u32 start_pc, u32 cache_size, u64 num_pages)
+    : m_start_pc(start_pc), m_cache_size(cache_size), m_num_pages(num_pages)
+  {
+  }
+
+  bool CanCompile(const Instruction& instr) const
+  {
+    switch (instr.opcode)
+    {
+      case Opcode::add:
+      case Opcode::mul:
+      case Opcode::slt:
+      case Opcode::seq:
+        return CanRead(instr, 0) && CanRead(instr, 1) && CanWrite(instr, 2);
+
+      case Opcode::rbaddr:
+        return CanRead(instr, 0);
+
+      case Opcode::jnz:
+      case Opcode::jz:
+        return CanRead(instr, 0) && CanRead(instr, 1) &&
+               (instr.operand_modes[1] != OperandMode::Immediate || instr.operand_values[1] >= 0);
+
+      default:
+        return false;
+    }
+  }
+
+  void EmitPrologue()
+  {
+    m_emitter.Push(RBX);
+    m_emitter.Push(RBP);
+    m_emitter.Push(R12);
+    m_emitter.Push(R13);
+    m_emitter.Push(R14);
+    m_emitter.Push(R15);
+    m_emitter.MovRegReg(REG_CONTEXT, REG_ARG0);
+    m_emitter.MovRegMem(REG_READ_PAGES, REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, read_pages)));
+    m_emitter.MovRegMem(REG_WRITE_PAGES, REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, write_pages)));
+    m_emitter.MovRegMem(REG_NUM_PAGES, REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, num_pages)));
+    m_emitter.MovRegMem(REG_CELL_FLAGS, REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, cell_flags)));
+    m_emitter.MovRegMem(REG_RELATIVE_BASE, REG_CONTEXT, NO_REG, 0,
+                        ContextOffset(offsetof(JitContext, relative_base)));
+    m_body_start = m_emitter.GetPosition();
+  }
+
+  void CompileInstruction(const Instruction& instr, u32 pc)
+  {
+    const u32 next_pc = pc + instr.length;
+    switch (instr.opcode)
+    {
+      case Opcode::add:
+      case Opcode::mul:
+      case Opcode::slt:
+      case Opcode::seq:
+      {
+        LoadOperand(instr, 0, RAX, pc);
+        LoadOperand(instr, 1, RDX, pc);
+        if (instr.opcode == Opcode::add)
+        {
+          m_emitter.AddRegReg(RAX, RDX);
+        }
+        else if (instr.opcode == Opcode::mul)
+        {
+          m_emitter.ImulRegReg(RAX, RDX);
+        }
+        else
+        {
+          m_emitter.CmpRegReg(RAX, RDX);
+          m_emitter.SetccEax(instr.opcode == Opcode::slt ? CC_L : CC_E);
+        }
+
+        StoreOperand(instr, 2, pc, next_pc);
+      }
+      break;
+
+      case Opcode::rbaddr:
+      {
+        if (instr.operand_modes[0] == OperandMode::Immediate && instr.operand_values[0] >= INT32_MIN &&
+            instr.operand_values[0] <= INT32_MAX)
+        {
+          m_emitter.AddRegImm(REG_RELATIVE_BASE, static_cast<s32>(instr.operand_values[0]));
+        }
+        else
+        {
+          LoadOperand(instr, 0, RAX, pc);
+          m_emitter.AddRegReg(REG_RELATIVE_BASE, RAX);
+        }
+      }
+      break;
+
+      default:
+        assert(false && "instruction not compilable");
+        break;
+    }
+  }
+
+  void CompileBranch(const Instruction& instr, u32 pc)
+  {
+    LoadOperand(instr, 0, RAX, pc);
+    m_emitter.TestRegReg(RAX, RAX);
+    const size_t not_taken = m_emitter.Jcc(instr.opcode == Opcode::jnz ? CC_E : CC_NE);
+
+    if (instr.operand_modes[1] == OperandMode::Immediate)
+    {
+      const MemoryCellType target = instr.operand_values[1];
+      if (target == m_start_pc)
+        m_emitter.Bind(m_emitter.Jmp(), m_body_start);
+      else
+        EmitExit(static_cast<u32>(target), EXIT_CONTINUE);
+    }
+    else
+    {
+      LoadOperand(instr, 1, RDX, pc);
+      m_emitter.MovMemReg(REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, pc)), RDX);
+      m_emitter.MovEaxImm(EXIT_CONTINUE);
+      m_epilogue_branches.push_back(m_emitter.Jmp());
+    }
+
+    m_emitter.Bind(not_taken, m_emitter.GetPosition());
+    EmitExit(pc + instr.length, EXIT_CONTINUE);
+  }
+
+  void EmitExit(u32 pc, u32 exit_code)
+  {
+    m_emitter.MovRegImm(RAX, pc);
+    m_emitter.MovMemReg(REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, pc)), RAX);
+    m_emitter.MovEaxImm(exit_code);
+    m_epilogue_branches.push_back(m_emitter.Jmp());
+  }
+
+  const std::vector<u8>& Finish()
+  {
+    for (const SideExit& exit : m_side_exits)
+    {
+      m_emitter.Bind(exit.branch, m_emitter.GetPosition());
+      if (exit.exit_code == EXIT_CODE_WRITTEN)
+      {
+        if (exit.written_address < 0)
+          m_emitter.MovMemReg(REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, written_address)), RCX);
+        else
+          EmitStoreContext(offsetof(JitContext, written_address), exit.written_address);
+      }
+
+      EmitExit(exit.pc, exit.exit_code);
+    }
+
+    const size_t epilogue = m_emitter.GetPosition();
+    for (const size_t branch : m_epilogue_branches)
+      m_emitter.Bind(branch, epilogue);
+
+    m_emitter.MovMemReg(REG_CONTEXT, NO_REG, 0, ContextOffset(offsetof(JitContext, relative_base)),
+                        REG_RELATIVE_BASE);
+    m_emitter.Pop(R15);
+    m_emitter.Pop(R14);
+    m_emitter.Pop(R13);
+    m_emitter.Pop(R12);
+    m_emitter.Pop(RBP);
+    m_emitter.Pop(RBX);
+    m_emitter.Ret();
+    return m_emitter.GetCode();
+  }
+
+private:
+  struct SideExit
+  {
+    size_t branch;
+    u32 pc;
+    u32 exit_code;
+    s64 written_address; // negative when the address is in rcx
+  };
+
+  // Positional addresses are resolved to a page table entry at compile time. The table only ever grows, so this
+  // stays valid for the lifetime of the block.
+  bool IsInRange(MemoryCellType address) const
+  {
+    return address >= 0 && static_cast<u64>(address >> PAGE_SHIFT) < m_num_pages;
+  }
+
+  static s32 PageTableOffset(MemoryCellType address)
+  {
+    return static_cast<s32>((address >> PAGE_SHIFT) * sizeof(MemoryCellType*));
+  }
+
+  static s32 PageOffset(MemoryCellType address)
+  {
+    return static_cast<s32>((address & PAGE_MASK) * sizeof(MemoryCellType));
+  }
+
+  bool CanRead(const Instruction& instr, u32 index) const
+  {
+    const MemoryCellType value = instr.operand_values[index];
+    switch (instr.operand_modes[index])
+    {
+      case OperandMode::Positional:
+        return IsInRange(value);
+      case OperandMode::Immediate:
+        return true;
+      case OperandMode::Relative:
+        return value >= INT32_MIN && value <= INT32_MAX;
+      default:
+        return false;
+    }
+  }
+
+  bool CanWrite(const Instruction& instr, u32 index) const
+  {
+    return instr.operand_modes[index] != OperandMode::Immediate && CanRead(instr, index);
+  }
+
+  void EmitStoreContext(size_t offset, s64 value)
+  {
+    m_emitter.MovRegImm(RAX, value);
+    m_emitter.MovMemReg(REG_CONTEXT, NO_REG, 0, ContextOffset(offset), RAX);
+  }
+
+  // rcx = relative base + offset, r8 = its page and r9 = the cell within the page. Leaves the block if the address
+  // is negative or outside the direct page table.
+  void ComputeRelativeAddress(MemoryCellType offset, u32 pc)
+  {
+    m_emitter.LeaRegMem(RCX, REG_RELATIVE_BASE, static_cast<s32>(offset));
+    m_emitter.MovRegReg(R8, RCX);
+    m_emitter.ShrRegImm(R8, PAGE_SHIFT);
+    m_emitter.CmpRegReg(R8, REG_NUM_PAGES);
+    m_side_exits.push_back({m_emitter.Jcc(CC_AE), pc, EXIT_INTERPRET, -1});
+    m_emitter.MovRegReg(R9, RCX);
+    m_emitter.AndRegImm(R9, PAGE_MASK);
+  }
+
+  void LoadOperand(const Instruction& instr, u32 index, X64Reg reg, u32 pc)
+  {
+    const MemoryCellType value = instr.operand_values[index];
+    switch (instr.operand_modes[index])
+    {
+      case OperandMode::Positional:
+        m_emitter.MovRegMem(R8, REG_READ_PAGES, NO_REG, 0, PageTableOffset(value));
+        m_emitter.MovRegMem(reg, R8, NO_REG, 0, PageOffset(value));
+        break;
+
+      case OperandMode::Immediate:
+        m_emitter.MovRegImm(reg, value);
+        break;
+
+      case OperandMode::Relative:
+        ComputeRelativeAddress(value, pc);
+        m_emitter.MovRegMem(R8, REG_READ_PAGES, R8, 3, 0);
+        m_emitter.MovRegMem(reg, R8, R9, 3, 0);
+        break;
+
+      default:
+        assert(false && "unknown operand mode");
+        break;
+    }
+  }
+
+  // Stores rax to the operand. Pages which are not privately owned yet are left to the interpreter, which allocates
+  // them. If the cell holds a cached or compiled instruction, leaves the block after the store.
+  void StoreOperand(const Instruction& instr, u32 index, u32 pc, u32 next_pc)
+  {
+    const MemoryCellType value = instr.operand_values[index];
+    if (instr.operand_modes[index] == OperandMode::Positional)
+    {
+      m_emitter.MovRegMem(R8, REG_WRITE_PAGES, NO_REG, 0, PageTableOffset(value));
+      m_emitter.TestRegReg(R8, R8);
+      m_side_exits.push_back({m_emitter.Jcc(CC_E), pc, EXIT_INTERPRET, -1});
+      m_emitter.MovMemReg(R8, NO_REG, 0, PageOffset(value), RAX);
+      if (value < m_cache_size)
+      {
+        m_emitter.CmpByteMemImm(REG_CELL_FLAGS, NO_REG, static_cast<s32>(value), 0);
+        m_side_exits.push_back({m_emitter.Jcc(CC_NE), next_pc, EXIT_CODE_WRITTEN, value});
+      }
+    }
+    else
+    {
+      ComputeRelativeAddress(value, pc);
+      m_emitter.MovRegMem(R8, REG_WRITE_PAGES, R8, 3, 0);
+      m_emitter.TestRegReg(R8, R8);
+      m_side_exits.push_back({m_emitter.Jcc(CC_E), pc, EXIT_INTERPRET, -1});
+      m_emitter.MovMemReg(R8, R9, 3, 0, RAX);
+      m_emitter.CmpRegImm(RCX, static_cast<s32>(m_cache_size));
+      const size_t uncached = m_emitter.Jcc(CC_AE);
+      m_emitter.CmpByteMemImm(REG_CELL_FLAGS, RCX, 0, 0);
+      m_side_exits.push_back({m_emitter.Jcc(CC_NE), next_pc, EXIT_CODE_WRITTEN, -1});
+      m_emitter.Bind(uncached, m_emitter.GetPosition());
+    }
+  }
+
+  Emitter m_emitter;
+  std::vector<SideExit> m_side_exits;
+  std::vector<size_t> m_epilogue_branches;
+  size_t m_body_start = 0;
+  u32 m_start_pc;
+  u32 m_cache_size;
+  u64 m_num_pages;
+};
+
+} // namespace
+
+JitX64::JitX64(u32 memory_size)
+  : m_block_lookup(memory_size), m_cell_block_count(memory_size), m_invalidation_count(memory_size),
+    m_code_arena(std::make_unique<CodeArena>(CODE_ARENA_SIZE))
+{
+}
+
+JitX64::~JitX64() = default;
+
+bool JitX64::IsSupported()
+{
+#ifdef JIT_X64_SUPPORTED
+  return true;
+#else
+  return false;
+#endif
+}
+
+void JitX64::Execute(Computer& comp)
+{
+  JitContext ctx;
+  ctx.cell_flags = comp.m_instruction_cache_flags.data();
+
+  while (comp.m_state == Computer::State::Executing)
+  {
+    const BlockFunction block = LookupBlock(comp, comp.m_pc);
+    if (!block || block == &InterpretOnly)
+    {
+      comp.StepInstruction();
+      continue;
+    }
+
+    ctx.read_pages = comp.m_memory.GetReadPageTable();
+    ctx.write_pages = comp.m_memory.GetWritePageTable();
+    ctx.num_pages = comp.m_memory.GetDirectPageCount();
+    ctx.pc = comp.m_pc;
+    ctx.relative_base = comp.m_relative_base;
+    const u32 exit_code = block(&ctx);
+    comp.m_pc = static_cast<u32>(ctx.pc);
+    comp.m_relative_base = ctx.relative_base;
+
+    if (exit_code == EXIT_CODE_WRITTEN)
+    {
+      const u32 address = static_cast<u32>(ctx.written_address);
+      comp.InvalidateCachedInstructions(address, address + 1);
+    }
+    else if (exit_code == EXIT_INTERPRET)
+      comp.StepInstruction();
+  }
+}
+
+void JitX64::InvalidateRange(Computer& comp, u32 start_address, u32 end_address)
+{
+  // blocks are bounded in length, so only a limited window of start addresses can cover the range
+  const u32 max_block_length = MAX_BLOCK_INSTRUCTIONS * (MAX_OPERANDS_PER_INSTRUCTION + 1);
+  const u32 first_pc = (start_address >= max_block_length) ? (start_address - max_block_length + 1) : 0;
+  for (u32 pc = first_pc; pc < end_address; pc++)
+  {
+    if (!m_block_lookup[pc])
+      continue;
+
+    const auto it = m_blocks.find(pc);
+    assert(it != m_blocks.end());
+    if (it->second.end_pc <= start_address)
+      continue;
+
+    if (it->second.function != &InterpretOnly && m_invalidation_count[pc] < MAX_BLOCK_INVALIDATIONS)
+      m_invalidation_count[pc]++;
+
+    RemoveBlock(comp, it->second);
+    m_blocks.erase(it);
+  }
+}
+
+void JitX64::ResetInvalidationCounts()
+{
+  std::fill(m_invalidation_count.begin(), m_invalidation_count.end(), u8(0));
+}
+
+bool JitX64::DecodeInstruction(const Computer& comp, u32 pc, Instruction* instr)
+{
+  if ((static_cast<size_t>(pc) + MAX_OPERANDS_PER_INSTRUCTION) >= comp.m_instruction_cache_flags.size())
+    return false;
+
+  // FetchInstruction() expects a known opcode
+  switch (static_cast<Opcode>(static_cast<u8>(comp.ReadMemory(pc) % 100)))
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::in:
+    case Opcode::out:
+    case Opcode::jnz:
+    case Opcode::jz:
+    case Opcode::slt:
+    case Opcode::seq:
+    case Opcode::rbaddr:
+    case Opcode::halt:
+      break;
+
+    default:
+      return false;
+  }
+
+  comp.FetchInstruction(pc, instr);
+  return true;
+}
+
+JitX64::BlockFunction JitX64::LookupBlock(Computer& comp, u32 pc)
+{
+  if (pc >= m_block_lookup.size())
+    return nullptr;
+
+  const BlockFunction block = m_block_lookup[pc];
+  if (block || m_invalidation_count[pc] >= MAX_BLOCK_INVALIDATIONS)
+    return block;
+
+  return CompileBlock(comp, pc);
+}
+
+JitX64::BlockFunction JitX64::CompileBlock(Computer& comp, u32 start_pc)
+{
+  BlockCompiler compiler(start_pc, static_cast<u32>(comp.m_instruction_cache_flags.size()),
+                         comp.m_memory.GetDirectPageCount());
+  compiler.EmitPrologue();
+
+  u32 pc = start_pc;
+  u32 num_instructions = 0;
+  for (;;)
+  {
+    Instruction instr;
+    const bool decoded = DecodeInstruction(comp, pc, &instr);
+    if (!decoded || !compiler.CanCompile(instr))
+    {
+      // covers the cells the decision was made from, so writing the instruction lets it be compiled again
+      if (num_instructions == 0)
+        return AddBlock(comp, &InterpretOnly, start_pc, start_pc + (decoded ? instr.length : 1));
+
+      compiler.EmitExit(pc, EXIT_INTERPRET);
+      break;
+    }
+
+    num_instructions++;
+    if (instr.opcode == Opcode::jnz || instr.opcode == Opcode::jz)
+    {
+      compiler.CompileBranch(instr, pc);
+      pc += instr.length;
+      break;
+    }
+
+    compiler.CompileInstruction(instr, pc);
+    pc += instr.length;
+
+    if (num_instructions == MAX_BLOCK_INSTRUCTIONS)
+    {
+      compiler.EmitExit(pc, EXIT_CONTINUE);
+      break;
+    }
+  }
+
+  const std::vector<u8>& code = compiler.Finish();
+  void* code_ptr = m_code_arena->Allocate(code);
+  if (!code_ptr)
+  {
+    FlushBlocks(comp);
+    code_ptr = m_code_arena->Allocate(code);
+    if (!code_ptr)
+      return nullptr;
+  }
+
+  return AddBlock(comp, reinterpret_cast<BlockFunction>(code_ptr), start_pc, pc);
+}
+
+JitX64::BlockFunction JitX64::AddBlock(Computer& comp, BlockFunction function, u32 start_pc, u32 end_pc)
+{
+  m_blocks.emplace(start_pc, Block{function, start_pc, end_pc});
+  m_block_lookup[start_pc] = function;
+  for (u32 cell = start_pc; cell < end_pc; cell++)
+  {
+    m_cell_block_count[cell]++;
+    comp.m_instruction_cache_flags[cell] |= Computer::INSTRUCTION_CACHE_COMPILED;
+  }
+
+  return function;
+}
+
+void JitX64::RemoveBlock(Computer& comp, const Block& block)
+{
+  m_block_lookup[block.start_pc] = nullptr;
+  for (u32 cell = block.start_pc; cell < block.end_pc; cell++)
+  {
+    if (--m_cell_block_count[cell] == 0)
+      comp.m_instruction_cache_flags[cell] &= ~Computer::INSTRUCTION_CACHE_COMPILED;
+  }
+}
+
+void JitX64::FlushBlocks(Computer& comp)
+{
+  for (const auto& it : m_blocks)
+    RemoveBlock(comp, it.second);
+
+  m_blocks.clear();
+  m_code_arena->Clear();
+}
+
+} // namespace Intcode
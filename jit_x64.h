@@ -0,0 +1,63 @@
+#pragma once
+#include "intcode.h"
+#include <unordered_map>
+#include <vector>
+
+namespace Intcode {
+
+struct JitContext;
+
+// Compiles basic blocks of Intcode to native x86-64 code. Instructions the compiler does not handle (I/O, halt,
+// operands it cannot prove are in range) are handed back to the interpreter one at a time, so the State contract
+// of Computer::Run is unchanged.
+class JitX64
+{
+public:
+  JitX64(u32 memory_size);
+  ~JitX64();
+
+  static bool IsSupported();
+
+  // Runs the computer until it leaves the Executing state.
+  void Execute(Computer& comp);
+
+  // Drops every compiled block overlapping [start_address, end_address). Called when the program writes into its own
+  // code, and for written pages on reset.
+  void InvalidateRange(Computer& comp, u32 start_address, u32 end_address);
+
+  // Lets blocks which were dropped for self-modification be compiled again, used when the program is reset.
+  void ResetInvalidationCounts();
+
+private:
+  using BlockFunction = u32 (*)(JitContext* ctx);
+
+  struct Block
+  {
+    BlockFunction function;
+    u32 start_pc;
+    u32 end_pc;
+  };
+
+  class CodeArena;
+
+  static bool DecodeInstruction(const Computer& comp, u32 pc, Instruction* instr);
+
+  BlockFunction LookupBlock(Computer& comp, u32 pc);
+  BlockFunction CompileBlock(Computer& comp, u32 start_pc);
+  BlockFunction AddBlock(Computer& comp, BlockFunction function, u32 start_pc, u32 end_pc);
+  void RemoveBlock(Computer& comp, const Block& block);
+  void FlushBlocks(Computer& comp);
+
+  std::unordered_map<u32, Block> m_blocks;
+  std::vector<BlockFunction> m_block_lookup;
+
+  // number of compiled blocks covering each cell, mirrored into INSTRUCTION_CACHE_COMPILED
+  std::vector<u16> m_cell_block_count;
+
+  // blocks which keep getting overwritten are left to the interpreter
+  std::vector<u8> m_invalidation_count;
+
+  std::unique_ptr<CodeArena> m_code_arena;
+};
+
+} // namespace Intcode
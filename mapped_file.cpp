@@ -0,0 +1,110 @@
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Intcode {
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+bool MappedFile::Open(const char* filename)
+{
+  Close();
+
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size))
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  // empty files cannot be mapped, but are still valid
+  m_file_handle = file;
+  m_open = true;
+  if (size.QuadPart == 0)
+    return true;
+
+  m_mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  const void* data = m_mapping_handle ? MapViewOfFile(m_mapping_handle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (!data)
+  {
+    Close();
+    return false;
+  }
+
+  m_data = static_cast<const char*>(data);
+  m_size = static_cast<size_t>(size.QuadPart);
+  return true;
+#else
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  // empty files cannot be mapped, but are still valid
+  m_open = true;
+  if (st.st_size == 0)
+  {
+    close(fd);
+    return true;
+  }
+
+  // the mapping keeps the file referenced, so the descriptor is not needed past this point
+  void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    m_open = false;
+    return false;
+  }
+
+  m_data = static_cast<const char*>(data);
+  m_size = static_cast<size_t>(st.st_size);
+  return true;
+#endif
+}
+
+void MappedFile::Close()
+{
+#if defined(_WIN32)
+  if (m_data)
+    UnmapViewOfFile(m_data);
+  if (m_mapping_handle)
+    CloseHandle(m_mapping_handle);
+  if (m_file_handle)
+    CloseHandle(m_file_handle);
+
+  m_mapping_handle = nullptr;
+  m_file_handle = nullptr;
+#else
+  if (m_data)
+    munmap(const_cast<char*>(m_data), m_size);
+#endif
+
+  m_data = nullptr;
+  m_size = 0;
+  m_open = false;
+}
+
+} // namespace Intcode
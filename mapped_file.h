@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+namespace Intcode {
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  ~MappedFile();
+
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const char* filename);
+  void Close();
+
+  bool IsOpen() const { return m_open; }
+  const char* GetData() const { return m_data; }
+  size_t GetSize() const { return m_size; }
+  std::string_view GetString() const { return std::string_view(m_data, m_size); }
+
+private:
+  const char* m_data = nullptr;
+  size_t m_size = 0;
+  bool m_open = false;
+
+#if defined(_WIN32)
+  void* m_file_handle = nullptr;
+  void* m_mapping_handle = nullptr;
+#endif
+};
+
+} // namespace Intcode
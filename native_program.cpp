@@ -0,0 +1,87 @@
+#include "native_program.h"
+#include <algorithm>
+
+namespace Intcode {
+
+NativeProgramRunner::NativeProgramRunner(const NativeProgram& program)
+  : m_program(program), m_block_valid(program.num_blocks)
+{
+  for (u32 i = 0; i < program.num_blocks; i++)
+  {
+    const u32 start_pc = program.blocks[i].start_pc;
+    if (start_pc >= m_block_at_pc.size())
+      m_block_at_pc.resize(start_pc + 1, NO_BLOCK);
+
+    m_block_at_pc[start_pc] = i;
+  }
+}
+
+void NativeProgramRunner::Execute(Computer& comp)
+{
+  NativeContext ctx(comp, m_block_valid.data());
+  while (comp.m_state == Computer::State::Executing)
+  {
+    const u32 pc = comp.m_pc;
+    if (pc < m_block_at_pc.size() && m_block_at_pc[pc] != NO_BLOCK && m_block_valid[m_block_at_pc[pc]])
+    {
+      m_program.run(ctx);
+      if (comp.m_state != Computer::State::Executing)
+        break;
+    }
+
+    // the transpiled code stopped at an instruction it does not handle, or there is none here
+    comp.StepInstruction();
+  }
+}
+
+void NativeProgramRunner::InvalidateRange(Computer& comp, u32 start_address, u32 end_address)
+{
+  bool any_dropped = false;
+  for (u32 i = 0; i < m_program.num_blocks; i++)
+  {
+    const NativeProgram::Block& block = m_program.blocks[i];
+    if (m_block_valid[i] && block.start_pc < end_address && block.end_pc > start_address)
+    {
+      m_block_valid[i] = 0;
+      MarkBlockCells(comp, block, false);
+      any_dropped = true;
+    }
+  }
+
+  // blocks are disjoint unless the program jumps into the middle of an instruction, put back any cells still in use
+  if (any_dropped)
+  {
+    for (u32 i = 0; i < m_program.num_blocks; i++)
+    {
+      if (m_block_valid[i])
+        MarkBlockCells(comp, m_program.blocks[i], true);
+    }
+  }
+}
+
+void NativeProgramRunner::Reset(Computer& comp)
+{
+  // blocks past the instruction cache would not see writes, so they are never run
+  const u64 cache_size = comp.m_instruction_cache_flags.size();
+  for (u32 i = 0; i < m_program.num_blocks; i++)
+  {
+    const NativeProgram::Block& block = m_program.blocks[i];
+    m_block_valid[i] = (block.end_pc <= cache_size) ? 1 : 0;
+    if (m_block_valid[i])
+      MarkBlockCells(comp, block, true);
+  }
+}
+
+void NativeProgramRunner::MarkBlockCells(Computer& comp, const NativeProgram::Block& block, bool native)
+{
+  const u32 end_pc = std::min(block.end_pc, static_cast<u32>(comp.m_instruction_cache_flags.size()));
+  for (u32 cell = block.start_pc; cell < end_pc; cell++)
+  {
+    if (native)
+      comp.m_instruction_cache_flags[cell] |= Computer::INSTRUCTION_CACHE_NATIVE;
+    else
+      comp.m_instruction_cache_flags[cell] &= ~Computer::INSTRUCTION_CACHE_NATIVE;
+  }
+}
+
+} // namespace Intcode
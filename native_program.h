@@ -0,0 +1,131 @@
+#pragma once
+#include "intcode.h"
+#include <cassert>
+#include <vector>
+
+namespace Intcode {
+
+class NativeContext;
+
+// A program transpiled to C++ ahead of time by intcode-transpile, see transpiler.h. The generated translation unit
+// defines one of these, and Computer(const NativeProgram&) runs it.
+struct NativeProgram
+{
+  struct Block
+  {
+    u32 start_pc;
+    u32 end_pc;
+  };
+
+  // Runs from ctx.GetPC() until an instruction has to be handed to the interpreter, see NativeContext::Exit().
+  using RunFunction = void (*)(NativeContext& ctx);
+
+  const char* name;
+  const MemoryCellType* code;
+  u32 code_size;
+  u32 entry_pc;
+  const Block* blocks;
+  u32 num_blocks;
+  RunFunction run;
+};
+
+// The interface transpiled code runs against. Everything is inline so the host compiler can optimize across it, the
+// relative base and PC live in locals of the generated function and are only written back on exit.
+class NativeContext
+{
+public:
+  NativeContext(Computer& comp, const u8* block_valid) : m_comp(comp), m_block_valid(block_valid) {}
+
+  u32 GetPC() const { return m_comp.m_pc; }
+  s64 GetRelativeBase() const { return m_comp.m_relative_base; }
+
+  // Blocks are dropped when the program writes to them, the interpreter runs them from then on.
+  bool IsBlockValid(u32 block) const { return m_block_valid[block] != 0; }
+
+  MemoryCellType Read(s64 address) const
+  {
+    assert(m_comp.IsValidAddress(address));
+    return m_comp.ReadMemory(static_cast<u64>(address));
+  }
+
+  // Returns true when the write hit transpiled code, which must not keep running.
+  bool Write(s64 address, MemoryCellType value)
+  {
+    assert(m_comp.IsValidAddress(address));
+    const u64 cell = static_cast<u64>(address);
+    m_comp.m_memory.Write(cell, value);
+    if (cell >= m_comp.m_instruction_cache_flags.size() || m_comp.m_instruction_cache_flags[cell] == 0)
+      return false;
+
+    const bool native = (m_comp.m_instruction_cache_flags[cell] & Computer::INSTRUCTION_CACHE_NATIVE) != 0;
+    m_comp.InvalidateCachedInstructions(static_cast<u32>(cell), static_cast<u32>(cell) + 1);
+    return native;
+  }
+
+  bool HasInput() { return !m_comp.m_input_queue.IsEmpty() || m_comp.RequestInput(); }
+  MemoryCellType PopInput() { return m_comp.m_input_queue.Pop(); }
+
+  bool IsOutputFull() const { return !m_comp.m_output_sink && m_comp.m_output_queue.IsFull(); }
+
+  // Only called with room in the queue. Returns false once the queue is full, which suspends the computer until the
+  // host drains it.
+  bool PushOutput(MemoryCellType value)
+  {
+    if (m_comp.m_output_sink)
+    {
+      m_comp.m_output_sink(value);
+      return true;
+    }
+
+    m_comp.m_output_queue.Push(value);
+    if (!m_comp.m_output_queue.IsFull())
+      return true;
+
+    m_comp.m_state = Computer::State::WaitingForOutput;
+    return false;
+  }
+
+  // Stores the state back into the computer. Unless the computer was suspended, the instruction at pc is then run by
+  // the interpreter, which covers I/O waits, halting, and jumps to code that was not transpiled.
+  void Exit(u32 pc, s64 relative_base)
+  {
+    m_comp.m_pc = pc;
+    m_comp.m_relative_base = relative_base;
+  }
+
+private:
+  Computer& m_comp;
+  const u8* m_block_valid;
+};
+
+// Runs a NativeProgram for Computer, tracking which of its blocks still match memory.
+class NativeProgramRunner
+{
+public:
+  NativeProgramRunner(const NativeProgram& program);
+
+  const NativeProgram& GetProgram() const { return m_program; }
+
+  // Runs the computer until it leaves the Executing state.
+  void Execute(Computer& comp);
+
+  // Drops every block overlapping [start_address, end_address), called when the program writes into its own code.
+  void InvalidateRange(Computer& comp, u32 start_address, u32 end_address);
+
+  // Brings every block back after memory has been restored to the program image.
+  void Reset(Computer& comp);
+
+private:
+  enum : u32
+  {
+    NO_BLOCK = 0xFFFFFFFFu
+  };
+
+  void MarkBlockCells(Computer& comp, const NativeProgram::Block& block, bool native);
+
+  const NativeProgram& m_program;
+  std::vector<u32> m_block_at_pc;
+  std::vector<u8> m_block_valid;
+};
+
+} // namespace Intcode
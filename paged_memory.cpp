@@ -0,0 +1,180 @@
+#include "paged_memory.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Intcode {
+
+// Backs every page which has not been written yet. Pages are value-initialized by make_shared, so they start zeroed.
+static const PagedMemory::CellType s_zero_page[PagedMemory::PAGE_SIZE] = {};
+
+PagedMemory::PagedMemory(const std::vector<CellType>& image, std::uint64_t initial_size)
+{
+  SetImage(nullptr, image.data(), image.size(), initial_size);
+}
+
+PagedMemory::PagedMemory(std::shared_ptr<const void> owner, const CellType* image, std::uint64_t image_size,
+                         std::uint64_t initial_size)
+{
+  SetImage(owner, image, image_size, initial_size);
+}
+
+PagedMemory::~PagedMemory() = default;
+
+PagedMemory PagedMemory::Fork()
+{
+  // every direct page is now shared, so writes on either side have to go through WriteSlow()
+  std::fill(m_write_pages.begin(), m_write_pages.end(), nullptr);
+  return PagedMemory(*this);
+}
+
+void PagedMemory::Reset()
+{
+  for (const std::uint64_t page : m_dirty_pages)
+  {
+    if (page < m_pages.size())
+      SetDirectPage(page, (page < m_image_pages.size()) ? m_image_pages[page] : PagePtr(), false);
+    else
+      m_far_pages.erase(page);
+  }
+
+  m_dirty_pages.clear();
+}
+
+const PagedMemory::CellType* PagedMemory::GetPageData(std::uint64_t page) const
+{
+  if (page < m_read_pages.size())
+    return m_read_pages[page];
+
+  const auto it = m_far_pages.find(page);
+  return (it != m_far_pages.end()) ? it->second->data() : s_zero_page;
+}
+
+PagedMemory::CellType* PagedMemory::RestorePage(std::uint64_t page)
+{
+  assert(std::find(m_dirty_pages.begin(), m_dirty_pages.end(), page) == m_dirty_pages.end());
+  PagePtr ptr = std::make_shared<Page>();
+  CellType* data = ptr->data();
+  if (page < MAX_DIRECT_PAGES)
+  {
+    if (page >= m_pages.size())
+      GrowDirectPages(page + 1);
+
+    SetDirectPage(page, std::move(ptr), true);
+  }
+  else
+  {
+    m_far_pages[page] = std::move(ptr);
+  }
+
+  m_dirty_pages.push_back(page);
+  return data;
+}
+
+std::uint64_t PagedMemory::GetImageHash() const
+{
+  // FNV-1a over every image cell, including the zeros padding the last page
+  std::uint64_t hash = 0xCBF29CE484222325ull;
+  for (const PagePtr& page : m_image_pages)
+  {
+    for (const CellType value : *page)
+    {
+      hash ^= static_cast<std::uint64_t>(value);
+      hash *= 0x100000001B3ull;
+    }
+  }
+
+  return hash;
+}
+
+PagedMemory::CellType PagedMemory::ReadFar(std::uint64_t address) const
+{
+  const auto it = m_far_pages.find(address >> PAGE_SHIFT);
+  return (it != m_far_pages.end()) ? (*it->second)[address & PAGE_MASK] : 0;
+}
+
+void PagedMemory::WriteSlow(std::uint64_t address, CellType value)
+{
+  const std::uint64_t page = address >> PAGE_SHIFT;
+  if (page < MAX_DIRECT_PAGES)
+  {
+    if (page >= m_pages.size())
+      GrowDirectPages(std::max(page + 1, std::min<std::uint64_t>(m_pages.size() * 2, MAX_DIRECT_PAGES)));
+
+    // the page is either unallocated or shared with the image or a fork, give this memory its own copy
+    const PagePtr& current = m_pages[page];
+    const bool dirty = current && (page >= m_image_pages.size() || current != m_image_pages[page]);
+    if (!dirty)
+      m_dirty_pages.push_back(page);
+
+    // forks which shared the page may have gone away since
+    if (dirty && current.use_count() == 1)
+      SetDirectPage(page, current, true);
+    else
+      SetDirectPage(page, current ? std::make_shared<Page>(*current) : std::make_shared<Page>(), true);
+    m_write_pages[page][address & PAGE_MASK] = value;
+    return;
+  }
+
+  PagePtr& ptr = m_far_pages[page];
+  if (!ptr)
+  {
+    ptr = std::make_shared<Page>();
+    m_dirty_pages.push_back(page);
+  }
+  else if (ptr.use_count() > 1)
+  {
+    ptr = std::make_shared<Page>(*ptr);
+  }
+
+  (*ptr)[address & PAGE_MASK] = value;
+}
+
+void PagedMemory::SetImage(const std::shared_ptr<const void>& owner, const CellType* image, std::uint64_t image_size,
+                           std::uint64_t initial_size)
+{
+  const std::uint64_t image_pages = (image_size + PAGE_MASK) >> PAGE_SHIFT;
+  assert(image_pages <= MAX_DIRECT_PAGES);
+  m_image_pages.resize(static_cast<size_t>(image_pages));
+  for (std::uint64_t page = 0; page < image_pages; page++)
+  {
+    const std::uint64_t start = page << PAGE_SHIFT;
+    const std::uint64_t count = std::min<std::uint64_t>(PAGE_SIZE, image_size - start);
+    if (owner && count == PAGE_SIZE)
+    {
+      // image pages are only ever read, see WriteSlow()
+      Page* ptr = reinterpret_cast<Page*>(const_cast<CellType*>(image + start));
+      m_image_pages[page] = PagePtr(std::const_pointer_cast<void>(owner), ptr);
+      continue;
+    }
+
+    PagePtr ptr = std::make_shared<Page>();
+    std::copy_n(image + start, count, ptr->begin());
+    m_image_pages[page] = std::move(ptr);
+  }
+
+  const std::uint64_t initial_pages =
+    std::min<std::uint64_t>((initial_size + PAGE_MASK) >> PAGE_SHIFT, MAX_DIRECT_PAGES);
+  GrowDirectPages(std::max(initial_pages, image_pages));
+  for (std::uint64_t page = 0; page < image_pages; page++)
+    SetDirectPage(page, m_image_pages[page], false);
+}
+
+void PagedMemory::GrowDirectPages(std::uint64_t count)
+{
+  assert(count <= MAX_DIRECT_PAGES);
+  if (count <= m_pages.size())
+    return;
+
+  m_pages.resize(static_cast<size_t>(count));
+  m_read_pages.resize(static_cast<size_t>(count), s_zero_page);
+  m_write_pages.resize(static_cast<size_t>(count), nullptr);
+}
+
+void PagedMemory::SetDirectPage(std::uint64_t page, PagePtr ptr, bool writable)
+{
+  m_read_pages[page] = ptr ? ptr->data() : s_zero_page;
+  m_write_pages[page] = writable ? ptr->data() : nullptr;
+  m_pages[page] = std::move(ptr);
+}
+
+} // namespace Intcode
@@ -0,0 +1,106 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace Intcode {
+
+// Sparse memory covering every non-negative 64-bit address. Pages are allocated on first write, reads from untouched
+// pages see zeros. Pages holding the program image are shared with the image until they are written, and written
+// pages are tracked so Reset() only has to restore those. Forked memories share pages the same way.
+class PagedMemory
+{
+public:
+  using CellType = std::int64_t;
+
+  enum : std::uint64_t
+  {
+    PAGE_SHIFT = 10,
+    PAGE_SIZE = std::uint64_t(1) << PAGE_SHIFT,
+    PAGE_MASK = PAGE_SIZE - 1,
+
+    // pages below this are reached through flat tables, anything above goes through a hash map
+    MAX_DIRECT_PAGES = std::uint64_t(1) << 20
+  };
+
+  PagedMemory(const std::vector<CellType>& image, std::uint64_t initial_size);
+
+  // Uses the image in place instead of copying it, owner keeps it alive. Like any image page, these are never written
+  // and are copied on the first write.
+  PagedMemory(std::shared_ptr<const void> owner, const CellType* image, std::uint64_t image_size,
+              std::uint64_t initial_size);
+  PagedMemory(PagedMemory&&) = default;
+  ~PagedMemory();
+
+  PagedMemory& operator=(PagedMemory&&) = default;
+
+  // Returns a memory with the same contents which shares every page with this one. Both sides copy a page the first
+  // time they write to it.
+  PagedMemory Fork();
+
+  CellType Read(std::uint64_t address) const
+  {
+    const std::uint64_t page = address >> PAGE_SHIFT;
+    if (page < m_read_pages.size())
+      return m_read_pages[page][address & PAGE_MASK];
+
+    return ReadFar(address);
+  }
+
+  void Write(std::uint64_t address, CellType value)
+  {
+    const std::uint64_t page = address >> PAGE_SHIFT;
+    if (page < m_write_pages.size() && m_write_pages[page])
+      m_write_pages[page][address & PAGE_MASK] = value;
+    else
+      WriteSlow(address, value);
+  }
+
+  // Pages which differ from the image, written since construction or the last Reset().
+  const std::vector<std::uint64_t>& GetDirtyPages() const { return m_dirty_pages; }
+
+  // Restores the image, only touching dirty pages.
+  void Reset();
+
+  // Contents of a page, zeros if it was never written.
+  const CellType* GetPageData(std::uint64_t page) const;
+
+  // Gives a page which is not dirty, such as any page after Reset(), zeroed contents of its own for the caller to
+  // fill in, and marks it dirty. Used to restore saved state.
+  CellType* RestorePage(std::uint64_t page);
+
+  // Identifies the image, so saved state is only restored into memory built from the same program.
+  std::uint64_t GetImageHash() const;
+
+  // Flat page tables for the JIT. Read pointers are never null, write pointers are only set for pages which can be
+  // written in place. Both tables are reallocated when memory grows.
+  const CellType* const* GetReadPageTable() const { return m_read_pages.data(); }
+  CellType* const* GetWritePageTable() const { return m_write_pages.data(); }
+  std::uint64_t GetDirectPageCount() const { return m_read_pages.size(); }
+
+private:
+  using Page = std::array<CellType, PAGE_SIZE>;
+  using PagePtr = std::shared_ptr<Page>;
+
+  PagedMemory(const PagedMemory&) = default;
+
+  void SetImage(const std::shared_ptr<const void>& owner, const CellType* image, std::uint64_t image_size,
+                std::uint64_t initial_size);
+
+  CellType ReadFar(std::uint64_t address) const;
+  void WriteSlow(std::uint64_t address, CellType value);
+  void GrowDirectPages(std::uint64_t count);
+  void SetDirectPage(std::uint64_t page, PagePtr ptr, bool writable);
+
+  std::vector<PagePtr> m_pages;
+  std::vector<const CellType*> m_read_pages;
+  std::vector<CellType*> m_write_pages;
+  std::unordered_map<std::uint64_t, PagePtr> m_far_pages;
+
+  std::vector<PagePtr> m_image_pages;
+  std::vector<std::uint64_t> m_dirty_pages;
+};
+
+} // namespace Intcode
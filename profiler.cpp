@@ -0,0 +1,161 @@
+#include "profiler.h"
+#include "code_analysis.h"
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+
+namespace Intcode {
+
+namespace {
+
+void AppendFormat(std::string* str, const char* format, ...)
+{
+  char buffer[256];
+  std::va_list ap;
+  va_start(ap, format);
+  const int length = std::vsnprintf(buffer, sizeof(buffer), format, ap);
+  va_end(ap);
+  if (length > 0)
+    str->append(buffer, std::min<size_t>(static_cast<size_t>(length), sizeof(buffer) - 1));
+}
+
+double Percent(u64 count, u64 total)
+{
+  return (total > 0) ? (static_cast<double>(count) * 100.0 / static_cast<double>(total)) : 0.0;
+}
+
+} // namespace
+
+void Profiler::Reset()
+{
+  m_pcs.clear();
+  m_opcode_counts.fill(0);
+  for (auto& counts : m_mode_counts)
+    counts.fill(0);
+  m_instruction_count = 0;
+}
+
+u64 Profiler::GetOpcodeCount(Opcode opcode) const
+{
+  return m_opcode_counts[static_cast<u8>(opcode) % NUM_OPCODE_SLOTS];
+}
+
+u64 Profiler::GetModeCount(Opcode opcode, u32 mode_combination) const
+{
+  assert(mode_combination < NUM_MODE_COMBINATIONS);
+  return m_mode_counts[static_cast<u8>(opcode) % NUM_OPCODE_SLOTS][mode_combination];
+}
+
+void Profiler::AppendReport(std::string* str, const CodeAnalysis* analysis, u32 max_rows) const
+{
+  AppendFormat(str, "profile: %" PRIu64 " instructions\n", m_instruction_count);
+
+  std::vector<u32> pcs;
+  for (u32 pc = 0; pc < m_pcs.size(); pc++)
+  {
+    if (m_pcs[pc].count > 0)
+      pcs.push_back(pc);
+  }
+  std::stable_sort(pcs.begin(), pcs.end(), [this](u32 lhs, u32 rhs) { return m_pcs[lhs].count > m_pcs[rhs].count; });
+
+  str->append("hot spots:\n");
+  std::string disassembly;
+  for (size_t i = 0; i < pcs.size() && i < max_rows; i++)
+  {
+    const PCProfile& profile = m_pcs[pcs[i]];
+    disassembly.clear();
+    profile.instr.AppendDisassembly(&disassembly);
+    AppendFormat(str, "  %14" PRIu64 " %6.2f%% %8u  ", profile.count, Percent(profile.count, m_instruction_count),
+                 pcs[i]);
+    if (profile.instr.opcode == Opcode::jnz || profile.instr.opcode == Opcode::jz)
+      AppendFormat(str, "%-36s taken %.2f%%\n", disassembly.c_str(), Percent(profile.taken, profile.count));
+    else
+      AppendFormat(str, "%s\n", disassembly.c_str());
+  }
+
+  str->append("opcodes:\n");
+  for (u32 slot = 0; slot < NUM_OPCODE_SLOTS; slot++)
+  {
+    if (m_opcode_counts[slot] > 0)
+    {
+      AppendFormat(str, "  %-8s %14" PRIu64 " %6.2f%%\n", GetOpcodeName(static_cast<Opcode>(slot)),
+                   m_opcode_counts[slot], Percent(m_opcode_counts[slot], m_instruction_count));
+    }
+  }
+
+  static constexpr const char* mode_names[] = {"pos", "imm", "rel"};
+  str->append("operand modes:\n");
+  for (u32 slot = 0; slot < NUM_OPCODE_SLOTS; slot++)
+  {
+    const Opcode opcode = static_cast<Opcode>(slot);
+    for (u32 combination = 0; combination < NUM_MODE_COMBINATIONS; combination++)
+    {
+      const u64 count = m_mode_counts[slot][combination];
+      if (count == 0)
+        continue;
+
+      std::string modes = GetOpcodeName(opcode);
+      const u32 num_operands = GetNumOperandsForOpcode(opcode);
+      for (u32 i = 0, divisor = 9; i < num_operands; i++, divisor /= 3)
+      {
+        modes += (i == 0) ? " " : ", ";
+        modes += mode_names[(combination / divisor) % 3];
+      }
+      AppendFormat(str, "  %-20s %14" PRIu64 " %6.2f%%\n", modes.c_str(), count, Percent(count, m_instruction_count));
+    }
+  }
+
+  if (!analysis)
+    return;
+
+  // instructions executed within each block, self-modified code may have run instructions the analysis never saw
+  const std::vector<CodeAnalysis::Block>& blocks = analysis->GetBlocks();
+  const std::vector<CodeAnalysis::AnalyzedInstruction>& instructions = analysis->GetInstructions();
+  std::vector<u64> block_counts(blocks.size());
+  for (u32 i = 0; i < blocks.size(); i++)
+  {
+    for (u32 j = 0; j < blocks[i].num_instructions; j++)
+      block_counts[i] += GetExecutionCount(instructions[blocks[i].first_instruction + j].pc);
+  }
+
+  std::vector<u32> order;
+  for (u32 i = 0; i < blocks.size(); i++)
+  {
+    if (block_counts[i] > 0)
+      order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&block_counts](u32 lhs, u32 rhs) { return block_counts[lhs] > block_counts[rhs]; });
+
+  str->append("hot blocks:\n");
+  for (size_t i = 0; i < order.size() && i < max_rows; i++)
+  {
+    const CodeAnalysis::Block& block = blocks[order[i]];
+    AppendFormat(str, "  L%-8u %14" PRIu64 " %6.2f%%  %" PRIu64 " entries, %u instructions\n", block.start_pc,
+                 block_counts[order[i]], Percent(block_counts[order[i]], m_instruction_count),
+                 GetExecutionCount(block.start_pc), block.num_instructions);
+  }
+
+  std::vector<std::pair<u64, u32>> loops;
+  for (u32 i = 0; i < analysis->GetLoops().size(); i++)
+  {
+    u64 count = 0;
+    for (const u32 block : analysis->GetLoops()[i].blocks)
+      count += block_counts[block];
+    if (count > 0)
+      loops.emplace_back(count, i);
+  }
+  std::stable_sort(loops.begin(), loops.end(), [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
+
+  str->append("hot loops:\n");
+  for (size_t i = 0; i < loops.size() && i < max_rows; i++)
+  {
+    const CodeAnalysis::Loop& loop = analysis->GetLoops()[loops[i].second];
+    AppendFormat(str, "  L%-8u %14" PRIu64 " %6.2f%%  %zu blocks\n", blocks[loop.header].start_pc, loops[i].first,
+                 Percent(loops[i].first, m_instruction_count), loop.blocks.size());
+  }
+}
+
+} // namespace Intcode
@@ -0,0 +1,81 @@
+#pragma once
+#include "intcode.h"
+#include <array>
+#include <string>
+#include <vector>
+
+namespace Intcode {
+
+class CodeAnalysis;
+
+// Execution counts per PC, per opcode and per operand mode combination, and taken counts for conditional branches.
+// Attach one with Computer::SetProfiler(), computers without one do not pay for the counting.
+class Profiler
+{
+public:
+  enum : u32
+  {
+    NUM_OPCODE_SLOTS = 100,
+    NUM_MODE_COMBINATIONS = 27 // three modes for each of the three operands
+  };
+
+  void Reset();
+
+  u64 GetInstructionCount() const { return m_instruction_count; }
+  u64 GetExecutionCount(u32 pc) const { return (pc < m_pcs.size()) ? m_pcs[pc].count : 0; }
+  u64 GetTakenCount(u32 pc) const { return (pc < m_pcs.size()) ? m_pcs[pc].taken : 0; }
+  u64 GetOpcodeCount(Opcode opcode) const;
+  u64 GetModeCount(Opcode opcode, u32 mode_combination) const;
+
+  // Hot spots by PC, with the instruction as it was first executed, followed by the opcode and operand mode
+  // histograms. An analysis of the program adds hot blocks and loops.
+  void AppendReport(std::string* str, const CodeAnalysis* analysis = nullptr, u32 max_rows = 20) const;
+
+  // Called by the interpreter after each instruction.
+  void OnInstruction(const Computer& comp, u32 pc, const Instruction& instr)
+  {
+    if (!comp.DidInstructionRun(pc))
+      return;
+
+    if (pc >= m_pcs.size())
+      m_pcs.resize(static_cast<size_t>(pc) + 1 + m_pcs.size() / 2);
+
+    PCProfile& profile = m_pcs[pc];
+    if (profile.count++ == 0)
+      profile.instr = instr;
+    if (instr.opcode == Opcode::jnz || instr.opcode == Opcode::jz)
+      profile.taken += (comp.GetPC() != (pc + instr.length));
+
+    const u32 slot = static_cast<u8>(instr.opcode) % NUM_OPCODE_SLOTS;
+    m_opcode_counts[slot]++;
+    m_mode_counts[slot][GetModeCombination(instr)]++;
+    m_instruction_count++;
+  }
+
+  static u32 GetModeCombination(const Instruction& instr)
+  {
+    u32 combination = 0;
+    for (u32 i = 0; i < MAX_OPERANDS_PER_INSTRUCTION; i++)
+    {
+      const u32 mode = static_cast<u32>(instr.operand_modes[i]);
+      combination = combination * 3 + ((mode < 3) ? mode : 0);
+    }
+
+    return combination;
+  }
+
+private:
+  struct PCProfile
+  {
+    u64 count;
+    u64 taken;
+    Instruction instr;
+  };
+
+  std::vector<PCProfile> m_pcs;
+  std::array<u64, NUM_OPCODE_SLOTS> m_opcode_counts = {};
+  std::array<std::array<u64, NUM_MODE_COMBINATIONS>, NUM_OPCODE_SLOTS> m_mode_counts = {};
+  u64 m_instruction_count = 0;
+};
+
+} // namespace Intcode
@@ -0,0 +1,186 @@
+#include "program_image.h"
+#include "code_analysis.h"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+namespace Intcode {
+
+static_assert(sizeof(ProgramImage::Header) == 56, "image header layout");
+static_assert(sizeof(ProgramImage::DecodedInstruction) == 32, "image instruction layout");
+
+namespace {
+
+enum : u64
+{
+  // keeps the cells cache line aligned in the mapping
+  CELLS_ALIGNMENT = 64
+};
+
+u64 AlignUp(u64 value, u64 alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+bool IsKnownOpcode(MemoryCellType opcode)
+{
+  switch (static_cast<Opcode>(static_cast<u8>(opcode)))
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::in:
+    case Opcode::out:
+    case Opcode::jnz:
+    case Opcode::jz:
+    case Opcode::slt:
+    case Opcode::seq:
+    case Opcode::rbaddr:
+    case Opcode::halt:
+      return (opcode >= 0 && opcode < 100);
+
+    default:
+      return false;
+  }
+}
+
+bool SetError(std::string* error_message, const char* message)
+{
+  if (error_message)
+    *error_message = message;
+
+  return false;
+}
+
+} // namespace
+
+std::shared_ptr<const ProgramImage> ProgramImage::Load(const char* filename, std::string* error_message)
+{
+  std::shared_ptr<ProgramImage> image(new ProgramImage());
+  if (!image->m_file.Open(filename))
+  {
+    SetError(error_message, "failed to open file");
+    return nullptr;
+  }
+
+  if (!image->Validate(error_message))
+    return nullptr;
+
+  return image;
+}
+
+bool ProgramImage::Validate(std::string* error_message)
+{
+  const u64 size = m_file.GetSize();
+  if (size < sizeof(Header))
+    return SetError(error_message, "file too small for header");
+
+  m_header = reinterpret_cast<const Header*>(m_file.GetData());
+  if (m_header->magic != MAGIC)
+    return SetError(error_message, "not a program image, or written on a machine with different byte order");
+  if (m_header->version != VERSION)
+    return SetError(error_message, "unsupported image version");
+
+  const Header& header = *m_header;
+  if ((header.cells_offset % alignof(MemoryCellType)) != 0 || header.cells_offset > size ||
+      header.num_cells > (size - header.cells_offset) / sizeof(MemoryCellType))
+  {
+    return SetError(error_message, "cells out of bounds");
+  }
+  if ((header.instructions_offset % alignof(DecodedInstruction)) != 0 || header.instructions_offset > size ||
+      header.num_instructions > (size - header.instructions_offset) / sizeof(DecodedInstruction))
+  {
+    return SetError(error_message, "instructions out of bounds");
+  }
+  if (header.metadata_offset > size || header.metadata_size > (size - header.metadata_offset))
+    return SetError(error_message, "metadata out of bounds");
+  if (header.num_cells == 0)
+    return SetError(error_message, "image has no code");
+
+  m_cells = reinterpret_cast<const MemoryCellType*>(m_file.GetData() + header.cells_offset);
+  m_instructions = reinterpret_cast<const DecodedInstruction*>(m_file.GetData() + header.instructions_offset);
+  m_metadata = std::string_view(m_file.GetData() + header.metadata_offset, static_cast<size_t>(header.metadata_size));
+
+  // The table is trusted to match the cells, but it must not be able to put the computer in an invalid state.
+  for (u32 i = 0; i < header.num_instructions; i++)
+  {
+    const DecodedInstruction& decoded = m_instructions[i];
+    if (!IsKnownOpcode(static_cast<MemoryCellType>(decoded.opcode)))
+      return SetError(error_message, "decoded instruction has unknown opcode");
+
+    const u32 num_operands = GetNumOperandsForOpcode(decoded.opcode);
+    for (u32 j = 0; j < MAX_OPERANDS_PER_INSTRUCTION; j++)
+    {
+      const OperandMode mode = decoded.operand_modes[j];
+      if ((j < num_operands) ? (mode > OperandMode::Relative) : (mode != OperandMode::None))
+        return SetError(error_message, "decoded instruction has invalid operand mode");
+    }
+  }
+
+  return true;
+}
+
+bool ProgramImage::Write(const char* filename, const CodeVector& code, u32 entry_pc, std::string_view metadata,
+                         bool include_decoded_instructions, std::string* error_message)
+{
+  if (code.empty())
+    return SetError(error_message, "no code to write");
+
+  const std::vector<DecodedInstruction> instructions =
+    include_decoded_instructions ? FindReachableInstructions(code, entry_pc) : std::vector<DecodedInstruction>();
+
+  Header header = {};
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.entry_pc = entry_pc;
+  header.num_instructions = static_cast<u32>(instructions.size());
+  header.num_cells = code.size();
+  header.cells_offset = AlignUp(sizeof(Header), CELLS_ALIGNMENT);
+  header.instructions_offset = header.cells_offset + code.size() * sizeof(MemoryCellType);
+  header.metadata_offset = header.instructions_offset + instructions.size() * sizeof(DecodedInstruction);
+  header.metadata_size = metadata.size();
+
+  std::vector<char> buffer(static_cast<size_t>(header.metadata_offset + header.metadata_size));
+  std::memcpy(buffer.data(), &header, sizeof(header));
+  std::memcpy(buffer.data() + header.cells_offset, code.data(), code.size() * sizeof(MemoryCellType));
+  if (!instructions.empty())
+  {
+    std::memcpy(buffer.data() + header.instructions_offset, instructions.data(),
+                instructions.size() * sizeof(DecodedInstruction));
+  }
+  if (!metadata.empty())
+    std::memcpy(buffer.data() + header.metadata_offset, metadata.data(), metadata.size());
+
+  std::FILE* fp = std::fopen(filename, "wb");
+  if (!fp)
+    return SetError(error_message, "failed to open file for writing");
+
+  const bool written = (std::fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size());
+  if (std::fclose(fp) != 0 || !written)
+    return SetError(error_message, "failed to write file");
+
+  return true;
+}
+
+std::vector<ProgramImage::DecodedInstruction> ProgramImage::FindReachableInstructions(const CodeVector& code,
+                                                                                        u32 entry_pc)
+{
+  const CodeAnalysis analysis(code, entry_pc);
+  std::vector<DecodedInstruction> instructions;
+  instructions.reserve(analysis.GetInstructions().size());
+  for (const CodeAnalysis::AnalyzedInstruction& ai : analysis.GetInstructions())
+    instructions.push_back({ai.pc, ai.instr.opcode, ai.instr.operand_modes, ai.instr.operand_values});
+
+  return instructions;
+}
+
+Instruction ProgramImage::ToInstruction(const DecodedInstruction& decoded)
+{
+  Instruction instr;
+  instr.opcode = decoded.opcode;
+  instr.operand_modes = decoded.operand_modes;
+  instr.operand_values = decoded.operand_values;
+  instr.length = 1 + GetNumOperandsForOpcode(decoded.opcode);
+  return instr;
+}
+
+} // namespace Intcode
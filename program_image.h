@@ -0,0 +1,76 @@
+#pragma once
+#include "intcode.h"
+#include "mapped_file.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Intcode {
+
+// Binary container for a program, loaded by mapping the file read-only. It holds the cells, the PC to start at, free
+// form metadata, and optionally the instructions reachable from the entry point already decoded, so a Computer built
+// from it neither parses nor decodes before it starts executing.
+//
+// Values are stored in host byte order, images are meant to be produced and consumed on the same kind of machine.
+class ProgramImage
+{
+public:
+  enum : u32
+  {
+    MAGIC = 0x4D494349, // "ICIM"
+    VERSION = 1
+  };
+
+  struct Header
+  {
+    u32 magic;
+    u32 version;
+    u32 entry_pc;
+    u32 num_instructions;
+    u64 num_cells;
+    u64 cells_offset;
+    u64 instructions_offset;
+    u64 metadata_offset;
+    u64 metadata_size;
+  };
+
+  struct DecodedInstruction
+  {
+    u32 pc;
+    Opcode opcode;
+    std::array<OperandMode, MAX_OPERANDS_PER_INSTRUCTION> operand_modes;
+    std::array<MemoryCellType, MAX_OPERANDS_PER_INSTRUCTION> operand_values;
+  };
+
+  static std::shared_ptr<const ProgramImage> Load(const char* filename, std::string* error_message = nullptr);
+
+  static bool Write(const char* filename, const CodeVector& code, u32 entry_pc = 0, std::string_view metadata = {},
+                    bool include_decoded_instructions = true, std::string* error_message = nullptr);
+
+  // Decodes every instruction CodeAnalysis finds reachable from entry_pc. Instructions only reached through branches
+  // it cannot follow are decoded when they first execute.
+  static std::vector<DecodedInstruction> FindReachableInstructions(const CodeVector& code, u32 entry_pc);
+
+  u32 GetEntryPC() const { return m_header->entry_pc; }
+  const MemoryCellType* GetCells() const { return m_cells; }
+  u64 GetNumCells() const { return m_header->num_cells; }
+  std::string_view GetMetadata() const { return m_metadata; }
+  const DecodedInstruction* GetDecodedInstructions() const { return m_instructions; }
+  u32 GetNumDecodedInstructions() const { return m_header->num_instructions; }
+
+  static Instruction ToInstruction(const DecodedInstruction& decoded);
+
+private:
+  ProgramImage() = default;
+
+  bool Validate(std::string* error_message);
+
+  MappedFile m_file;
+  const Header* m_header = nullptr;
+  const MemoryCellType* m_cells = nullptr;
+  const DecodedInstruction* m_instructions = nullptr;
+  std::string_view m_metadata;
+};
+
+} // namespace Intcode
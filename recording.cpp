@@ -0,0 +1,313 @@
+#include "recording.h"
+#include "snapshot.h"
+#include <cassert>
+#include <cstring>
+#include <string>
+
+namespace Intcode {
+
+static_assert(sizeof(RecordingHeader) == 24, "recording header layout");
+
+namespace {
+
+bool SetError(std::string* error_message, const char* message)
+{
+  if (error_message)
+    *error_message = message;
+
+  return false;
+}
+
+bool SetReplayError(std::string* error_message, u64 event_index, const std::string& message)
+{
+  if (error_message)
+    *error_message = "event " + std::to_string(event_index) + ": " + message;
+
+  return false;
+}
+
+MemoryCellType UnZigZag(u64 value)
+{
+  return static_cast<MemoryCellType>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+} // namespace
+
+Recorder::~Recorder()
+{
+  if (!m_file)
+    return;
+
+  Flush();
+  std::fclose(m_file);
+}
+
+bool Recorder::Open(const char* filename, const Computer& comp, Mode mode, std::string* error_message)
+{
+  assert(!m_file && "recorder already open");
+
+  std::vector<char> buffer(sizeof(RecordingHeader));
+  Snapshot::Write(comp, &buffer);
+
+  RecordingHeader header = {};
+  header.magic = RecordingHeader::MAGIC;
+  header.version = RecordingHeader::VERSION;
+  header.flags = (mode == Mode::Trace) ? static_cast<u32>(RecordingHeader::FLAG_TRACE) : 0;
+  header.start_pc = comp.GetPC();
+  header.snapshot_size = buffer.size() - sizeof(RecordingHeader);
+  std::memcpy(buffer.data(), &header, sizeof(header));
+
+  m_file = std::fopen(filename, "wb");
+  if (!m_file)
+    return SetError(error_message, "failed to open file for writing");
+
+  m_buffer.assign(buffer.begin(), buffer.end());
+  m_mode = mode;
+  m_instruction_count = 0;
+  m_event_instruction_count = 0;
+  m_last_pc = header.start_pc;
+  m_write_failed = false;
+  Flush();
+  return true;
+}
+
+bool Recorder::Close(const Computer& comp, std::string* error_message)
+{
+  assert(m_file);
+
+  WriteVarint((m_event_instruction_count << 2) | static_cast<u64>(RecordKind::End));
+  WriteVarint(static_cast<u64>(comp.GetState()));
+  Flush();
+
+  const bool failed = (std::fclose(m_file) != 0 || m_write_failed);
+  m_file = nullptr;
+  m_buffer.clear();
+  return failed ? SetError(error_message, "failed to write file") : true;
+}
+
+void Recorder::Flush()
+{
+  if (m_buffer.empty())
+    return;
+
+  if (std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size() || std::fflush(m_file) != 0)
+    m_write_failed = true;
+
+  m_buffer.clear();
+}
+
+bool Replayer::Open(const char* filename, std::string* error_message)
+{
+  m_file.Close();
+  m_header = nullptr;
+
+  if (!m_file.Open(filename))
+    return SetError(error_message, "failed to open file");
+
+  const u64 size = m_file.GetSize();
+  if (size < sizeof(RecordingHeader))
+    return SetError(error_message, "file too small for header");
+
+  const RecordingHeader* header = reinterpret_cast<const RecordingHeader*>(m_file.GetData());
+  if (header->magic != RecordingHeader::MAGIC)
+    return SetError(error_message, "not a recording, or written on a machine with different byte order");
+  if (header->version != RecordingHeader::VERSION)
+    return SetError(error_message, "unsupported recording version");
+  if (header->snapshot_size > (size - sizeof(RecordingHeader)))
+    return SetError(error_message, "snapshot out of bounds");
+
+  m_header = header;
+  m_records_start = reinterpret_cast<const u8*>(m_file.GetData()) + sizeof(RecordingHeader) + header->snapshot_size;
+  m_records_end = reinterpret_cast<const u8*>(m_file.GetData()) + size;
+  Rewind();
+  return true;
+}
+
+bool Replayer::Replay(Computer& comp, std::string* error_message)
+{
+  assert(m_header);
+
+  if (!Snapshot::Read(comp, m_file.GetData() + sizeof(RecordingHeader), m_header->snapshot_size, error_message))
+    return false;
+  if (comp.GetState() == Computer::State::Faulted)
+    return SetReplayError(error_message, 0, "recorded after the computer faulted");
+
+  // queued input is consumed before anything asks for more, and is recorded when it is, but queued output was
+  // produced before the recording started
+  u32 skip_inputs = comp.GetPendingInputCount();
+  u32 skip_outputs = comp.GetPendingOutputCount();
+  if (comp.GetOutputQueueCapacity() < REPLAY_OUTPUT_QUEUE_CAPACITY)
+    comp.SetOutputQueueCapacity(REPLAY_OUTPUT_QUEUE_CAPACITY);
+
+  Rewind();
+  Record record;
+  bool has_record = ReadEvent(&record, &skip_inputs);
+  u64 event_index = 0;
+
+  // a recording cut short, or closed while the computer could have carried on, says nothing about what comes next
+  const auto is_open_ended = [&]() {
+    return !has_record || (record.kind == RecordKind::End && record.state != Computer::State::Halted &&
+                           record.state != Computer::State::WaitingForInput);
+  };
+
+  std::vector<MemoryCellType> outputs(comp.GetOutputQueueCapacity());
+  for (;;)
+  {
+    const Computer::State state = comp.Run();
+
+    const u32 num_outputs = comp.DrainOutputs(outputs.data(), static_cast<u32>(outputs.size()));
+    for (u32 i = 0; i < num_outputs; i++)
+    {
+      if (skip_outputs > 0)
+      {
+        skip_outputs--;
+        continue;
+      }
+
+      if (is_open_ended())
+        return true;
+      if (record.kind != RecordKind::Output)
+      {
+        return SetReplayError(error_message, event_index,
+                              "output " + std::to_string(outputs[i]) + " where the recording has input");
+      }
+      if (record.value != outputs[i])
+      {
+        return SetReplayError(error_message, event_index,
+                              "output " + std::to_string(outputs[i]) + ", recorded " + std::to_string(record.value));
+      }
+
+      has_record = ReadEvent(&record, &skip_inputs);
+      event_index++;
+    }
+
+    if (state == Computer::State::WaitingForOutput)
+      continue;
+
+    if (is_open_ended())
+      return true;
+
+    if (record.kind == RecordKind::End)
+    {
+      if ((state == Computer::State::Halted) != (record.state == Computer::State::Halted))
+      {
+        return SetReplayError(error_message, event_index,
+                              (state == Computer::State::Halted) ? "halted where the recording did not" :
+                                                                   "did not halt where the recording did");
+      }
+
+      return true;
+    }
+
+    if (state == Computer::State::Faulted)
+      return SetReplayError(error_message, event_index, "faulted");
+    if (state == Computer::State::Halted)
+      return SetReplayError(error_message, event_index, "halted early");
+    if (record.kind != RecordKind::Input)
+      return SetReplayError(error_message, event_index, "asked for input where the recording has output");
+
+    // the recording shows consecutive inputs are consumed without output in between, so they can be queued together
+    while (has_record && record.kind == RecordKind::Input && comp.CanPushInput())
+    {
+      comp.SetInput(record.value);
+      has_record = ReadEvent(&record, &skip_inputs);
+      event_index++;
+    }
+  }
+}
+
+void Replayer::Rewind()
+{
+  assert(m_header);
+  m_read_ptr = m_records_start;
+  m_last_pc = m_header->start_pc;
+  m_ended = false;
+}
+
+bool Replayer::ReadRecord(Record* record)
+{
+  // a record cut off part way is left unread
+  const u8* const start = m_read_ptr;
+  const u32 last_pc = m_last_pc;
+  u64 tag;
+  if (m_ended || !ReadVarint(&tag))
+    return false;
+
+  *record = {};
+  record->kind = static_cast<RecordKind>(tag & 3);
+  tag >>= 2;
+
+  bool valid = true;
+  u64 value = 0;
+  switch (record->kind)
+  {
+    case RecordKind::Input:
+    case RecordKind::Output:
+      record->instruction_count = tag;
+      record->has_value = true;
+      valid = ReadVarint(&value);
+      record->value = UnZigZag(value);
+      break;
+
+    case RecordKind::Step:
+      m_last_pc = static_cast<u32>(static_cast<s64>(m_last_pc) + UnZigZag(tag >> 1));
+      record->pc = m_last_pc;
+      record->has_value = (tag & 1) != 0;
+      if (record->has_value)
+      {
+        valid = ReadVarint(&value);
+        record->value = UnZigZag(value);
+      }
+      break;
+
+    case RecordKind::End:
+      record->instruction_count = tag;
+      valid = ReadVarint(&value);
+      record->state = static_cast<Computer::State>(value);
+      m_ended = valid;
+      break;
+  }
+
+  if (!valid)
+  {
+    m_read_ptr = start;
+    m_last_pc = last_pc;
+    return false;
+  }
+
+  return true;
+}
+
+bool Replayer::ReadVarint(u64* value)
+{
+  *value = 0;
+  for (u32 shift = 0; shift < 64 && m_read_ptr != m_records_end; shift += 7)
+  {
+    const u8 byte = *(m_read_ptr++);
+    *value |= static_cast<u64>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+bool Replayer::ReadEvent(Record* record, u32* skip_inputs)
+{
+  while (ReadRecord(record))
+  {
+    if (record->kind == RecordKind::Step)
+      continue;
+    if (record->kind == RecordKind::Input && *skip_inputs > 0)
+    {
+      (*skip_inputs)--;
+      continue;
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+} // namespace Intcode
@@ -0,0 +1,223 @@
+#pragma once
+#include "intcode.h"
+#include "mapped_file.h"
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Intcode {
+
+// Record and replay of a computer's I/O. A recording starts with a snapshot of the computer, see snapshot.h, followed
+// by every input it consumed and every output it produced in order, each with the number of instructions run since the
+// previous one. That is enough to reproduce the run without the host which drove it.
+//
+// Records are varints: a tag holding the record kind in its low two bits, followed by the value for inputs, outputs
+// and written values, zigzag encoded. In trace mode every instruction adds a step record with its PC as a delta from
+// the previous one, and the value it wrote to memory, if any. Steps through straight-line code take a byte or two
+// plus the value.
+//
+// Like snapshots, recordings are stored in host byte order and only replay against the program they were made from.
+enum class RecordKind : u8
+{
+  Input,
+  Output,
+  Step,
+  End
+};
+
+struct Record
+{
+  RecordKind kind;
+  u64 instruction_count; // Input, Output and End: instructions since the previous input or output, including this one
+  u32 pc;                // Step
+  bool has_value;        // Step: whether the instruction wrote memory, always set for Input and Output
+  MemoryCellType value;  // Input and Output, or the value a step wrote
+  Computer::State state; // End: the state the computer was left in
+};
+
+struct RecordingHeader
+{
+  enum : u32
+  {
+    MAGIC = 0x4C524349, // "ICRL"
+    VERSION = 1,
+
+    FLAG_TRACE = (1 << 0)
+  };
+
+  u32 magic;
+  u32 version;
+  u32 flags;
+  u32 start_pc;
+  u64 snapshot_size; // the snapshot follows the header, then the records up to the end of the file
+};
+
+// Attach with Computer::SetRecorder(). Runs go through the interpreter while a recorder is attached, as with a
+// profiler, since the other engines do not count instructions.
+class Recorder
+{
+public:
+  enum class Mode : u32
+  {
+    Events,
+    Trace
+  };
+
+  Recorder() = default;
+  Recorder(const Recorder&) = delete;
+  ~Recorder();
+
+  Recorder& operator=(const Recorder&) = delete;
+
+  // Starts a recording of the computer as it is now. Host writes to memory or input queued before this point are part
+  // of the saved state, anything after has to go through Run() to be recorded.
+  bool Open(const char* filename, const Computer& comp, Mode mode = Mode::Events,
+            std::string* error_message = nullptr);
+
+  // Ends the recording with the computer's state. A recording which is never closed still replays up to its last
+  // flushed record.
+  bool Close(const Computer& comp, std::string* error_message = nullptr);
+
+  bool IsOpen() const { return m_file != nullptr; }
+  u64 GetInstructionCount() const { return m_instruction_count; }
+
+  // Writes out buffered records, for hosts which want to keep as much as possible if they crash.
+  void Flush();
+
+  // Called by the interpreter after each instruction.
+  void OnInstruction(const Computer& comp, u32 pc, const Instruction& instr)
+  {
+    assert(m_file);
+
+    if (!comp.DidInstructionRun(pc))
+      return;
+
+    m_instruction_count++;
+    m_event_instruction_count++;
+
+    if (m_mode == Mode::Trace)
+    {
+      const u64 pc_delta = ZigZag(static_cast<s64>(pc) - static_cast<s64>(m_last_pc));
+      m_last_pc = pc;
+
+      const int written_operand = GetWrittenOperand(instr.opcode);
+      WriteVarint((((pc_delta << 1) | ((written_operand >= 0) ? 1 : 0)) << 2) | static_cast<u64>(RecordKind::Step));
+      if (written_operand >= 0)
+        WriteVarint(ZigZag(comp.ReadMemory(GetOperandAddress(comp, instr, written_operand))));
+    }
+
+    if (instr.opcode == Opcode::in)
+      WriteEvent(RecordKind::Input, comp.ReadMemory(GetOperandAddress(comp, instr, 0)));
+    else if (instr.opcode == Opcode::out)
+      WriteEvent(RecordKind::Output, ReadOperand(comp, instr, 0));
+  }
+
+private:
+  enum : u32
+  {
+    FLUSH_SIZE = 64 * 1024
+  };
+
+  static u64 ZigZag(s64 value) { return (static_cast<u64>(value) << 1) ^ static_cast<u64>(value >> 63); }
+
+  static int GetWrittenOperand(Opcode opcode)
+  {
+    switch (opcode)
+    {
+      case Opcode::in:
+        return 0;
+      case Opcode::add:
+      case Opcode::mul:
+      case Opcode::slt:
+      case Opcode::seq:
+        return 2;
+      default:
+        return -1;
+    }
+  }
+
+  // Only valid after the instruction ran for instructions which do not change the relative base.
+  static u64 GetOperandAddress(const Computer& comp, const Instruction& instr, int index)
+  {
+    const MemoryCellType offset = instr.operand_values[index];
+    const bool relative = (instr.operand_modes[index] == OperandMode::Relative);
+    return static_cast<u64>(relative ? (comp.GetRelativeBase() + offset) : offset);
+  }
+
+  static MemoryCellType ReadOperand(const Computer& comp, const Instruction& instr, int index)
+  {
+    if (instr.operand_modes[index] == OperandMode::Immediate)
+      return instr.operand_values[index];
+
+    return comp.ReadMemory(GetOperandAddress(comp, instr, index));
+  }
+
+  void WriteEvent(RecordKind kind, MemoryCellType value)
+  {
+    WriteVarint((m_event_instruction_count << 2) | static_cast<u64>(kind));
+    WriteVarint(ZigZag(value));
+    m_event_instruction_count = 0;
+  }
+
+  void WriteVarint(u64 value)
+  {
+    while (value >= 0x80)
+    {
+      m_buffer.push_back(static_cast<u8>(value | 0x80));
+      value >>= 7;
+    }
+    m_buffer.push_back(static_cast<u8>(value));
+
+    if (m_buffer.size() >= FLUSH_SIZE)
+      Flush();
+  }
+
+  std::FILE* m_file = nullptr;
+  std::vector<u8> m_buffer;
+  Mode m_mode = Mode::Events;
+  u64 m_instruction_count = 0;
+  u64 m_event_instruction_count = 0;
+  u32 m_last_pc = 0;
+  bool m_write_failed = false;
+};
+
+// Replays recordings. Any engine reproduces the I/O, so long sessions replay at full speed.
+class Replayer
+{
+public:
+  bool Open(const char* filename, std::string* error_message = nullptr);
+
+  bool IsTrace() const { return (m_header->flags & RecordingHeader::FLAG_TRACE) != 0; }
+
+  // Restores the recorded starting state into the computer and runs it, feeding it the recorded input and checking
+  // its output against the recording. Returns false with the first difference, or if the snapshot does not match the
+  // computer's program. Once every record is reproduced, a recording which ended halted also has to halt.
+  bool Replay(Computer& comp, std::string* error_message = nullptr);
+
+  // Decodes the records in order from the first, or from where the last call left off. Returns false past the end
+  // record, or past the last complete record of a recording which was never closed.
+  void Rewind();
+  bool ReadRecord(Record* record);
+
+private:
+  enum : u32
+  {
+    REPLAY_OUTPUT_QUEUE_CAPACITY = 1024
+  };
+
+  bool ReadVarint(u64* value);
+
+  // Skips step records, and the first skip_inputs input records.
+  bool ReadEvent(Record* record, u32* skip_inputs);
+
+  MappedFile m_file;
+  const RecordingHeader* m_header = nullptr;
+  const u8* m_records_start = nullptr;
+  const u8* m_records_end = nullptr;
+  const u8* m_read_ptr = nullptr;
+  u32 m_last_pc = 0;
+  bool m_ended = false;
+};
+
+} // namespace Intcode
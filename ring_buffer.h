@@ -0,0 +1,91 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace Intcode {
+
+// Fixed-capacity FIFO used for the computer's input and output queues.
+template<typename T>
+class RingBuffer
+{
+public:
+  RingBuffer(size_t capacity = 1) : m_data(capacity) { assert(capacity > 0); }
+
+  size_t GetCapacity() const { return m_data.size(); }
+  size_t GetSize() const { return m_size; }
+  size_t GetSpace() const { return m_data.size() - m_size; }
+  bool IsEmpty() const { return m_size == 0; }
+  bool IsFull() const { return m_size == m_data.size(); }
+
+  void SetCapacity(size_t capacity)
+  {
+    assert(capacity > 0 && capacity >= m_size);
+    std::vector<T> data(capacity);
+    const size_t size = PopRange(data.data(), m_size);
+    m_data = std::move(data);
+    m_head = 0;
+    m_size = size;
+  }
+
+  void Clear()
+  {
+    m_head = 0;
+    m_size = 0;
+  }
+
+  const T& Front() const
+  {
+    assert(!IsEmpty());
+    return m_data[m_head];
+  }
+
+  void Push(const T& value)
+  {
+    assert(!IsFull());
+    m_data[Wrap(m_head + m_size)] = value;
+    m_size++;
+  }
+
+  T Pop()
+  {
+    assert(!IsEmpty());
+    const T value = m_data[m_head];
+    m_head = Wrap(m_head + 1);
+    m_size--;
+    return value;
+  }
+
+  // Pushes as many values as fit, returning the number pushed.
+  size_t PushRange(const T* values, size_t count)
+  {
+    count = std::min(count, GetSpace());
+    for (size_t i = 0; i < count; i++)
+      m_data[Wrap(m_head + m_size + i)] = values[i];
+
+    m_size += count;
+    return count;
+  }
+
+  // Pops up to count values, returning the number popped.
+  size_t PopRange(T* values, size_t count)
+  {
+    count = std::min(count, m_size);
+    for (size_t i = 0; i < count; i++)
+      values[i] = m_data[Wrap(m_head + i)];
+
+    m_head = Wrap(m_head + count);
+    m_size -= count;
+    return count;
+  }
+
+private:
+  size_t Wrap(size_t index) const { return (index >= m_data.size()) ? (index - m_data.size()) : index; }
+
+  std::vector<T> m_data;
+  size_t m_head = 0;
+  size_t m_size = 0;
+};
+
+} // namespace Intcode
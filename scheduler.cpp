@@ -0,0 +1,184 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Intcode {
+
+Scheduler::Scheduler(u32 num_threads)
+{
+  if (num_threads == 0)
+    num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  m_workers.resize(num_threads);
+  for (std::unique_ptr<Worker>& worker : m_workers)
+    worker = std::make_unique<Worker>();
+
+  // workers look at each other's queues, so only start them once all of them exist
+  for (u32 i = 0; i < num_threads; i++)
+    m_workers[i]->thread = std::thread(&Scheduler::WorkerMain, this, i);
+}
+
+Scheduler::~Scheduler()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+
+  m_work_available.notify_all();
+  for (std::unique_ptr<Worker>& worker : m_workers)
+    worker->thread.join();
+}
+
+Scheduler::TaskId Scheduler::Add(Computer* comp, InputProvider input, OutputSink output)
+{
+  assert(comp);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const TaskId id = static_cast<TaskId>(m_tasks.size());
+  m_tasks.push_back(std::make_unique<Task>(Task{comp, std::move(input), std::move(output), TaskState::Queued, false}));
+  Enqueue(m_tasks.back().get(), m_next_worker++ % GetNumThreads());
+  return id;
+}
+
+void Scheduler::Wake(TaskId id)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  assert(id < m_tasks.size());
+  Task* task = m_tasks[id].get();
+  switch (task->state)
+  {
+    case TaskState::Parked:
+      task->state = TaskState::Queued;
+      Enqueue(task, m_next_worker++ % GetNumThreads());
+      break;
+
+    case TaskState::Running:
+      // the provider may already have said it had nothing, make sure it is asked again
+      task->wake_pending = true;
+      break;
+
+    default:
+      break;
+  }
+}
+
+void Scheduler::Wait()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_all_idle.wait(lock, [this]() { return m_num_queued == 0 && m_num_running == 0; });
+}
+
+void Scheduler::WorkerMain(u32 worker_index)
+{
+  for (;;)
+  {
+    Task* task = PopTask(worker_index);
+    if (!task)
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_work_available.wait(lock, [this]() { return m_stopping || m_num_queued > 0; });
+      if (m_stopping)
+        return;
+
+      continue;
+    }
+
+    const bool halted = RunTask(task);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_num_running--;
+    if (halted)
+    {
+      task->state = TaskState::Halted;
+    }
+    else if (task->wake_pending)
+    {
+      task->state = TaskState::Queued;
+      Enqueue(task, worker_index);
+    }
+    else
+    {
+      task->state = TaskState::Parked;
+    }
+
+    if (m_num_queued == 0 && m_num_running == 0)
+      m_all_idle.notify_all();
+  }
+}
+
+Scheduler::Task* Scheduler::PopTask(u32 worker_index)
+{
+  // newest task from our own queue first, as its computer is most likely still in cache, then steal the oldest task
+  // from another worker
+  Task* task = nullptr;
+  const u32 num_workers = GetNumThreads();
+  for (u32 i = 0; i < num_workers && !task; i++)
+  {
+    Worker& worker = *m_workers[(worker_index + i) % num_workers];
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    if (worker.queue.empty())
+      continue;
+
+    if (i == 0)
+    {
+      task = worker.queue.back();
+      worker.queue.pop_back();
+    }
+    else
+    {
+      task = worker.queue.front();
+      worker.queue.pop_front();
+    }
+  }
+
+  if (!task)
+    return nullptr;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_num_queued--;
+  m_num_running++;
+  task->state = TaskState::Running;
+  task->wake_pending = false;
+  return task;
+}
+
+void Scheduler::Enqueue(Task* task, u32 worker_index)
+{
+  // m_mutex is held by the caller
+  {
+    Worker& worker = *m_workers[worker_index];
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    worker.queue.push_back(task);
+  }
+
+  m_num_queued++;
+  m_work_available.notify_one();
+}
+
+bool Scheduler::RunTask(Task* task)
+{
+  Computer& comp = *task->comp;
+  for (;;)
+  {
+    if (comp.GetState() == Computer::State::Halted || comp.GetState() == Computer::State::Faulted)
+      return true;
+
+    MemoryCellType value;
+    while (comp.CanPushInput() && task->input && task->input(&value))
+      comp.SetInput(value);
+
+    if (comp.GetState() == Computer::State::WaitingForInput && comp.GetPendingInputCount() == 0)
+      return false;
+
+    comp.Run();
+    while (comp.HasOutput())
+    {
+      value = comp.GetOutput();
+      if (task->output)
+        task->output(value);
+    }
+  }
+}
+
+} // namespace Intcode
@@ -0,0 +1,88 @@
+#pragma once
+#include "intcode.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Intcode {
+
+// Runs many computers concurrently on a work-stealing thread pool. Each computer is a task which is run until it
+// halts or blocks on input. A blocked task is parked until Wake() is called for it, so a thread is never tied up by a
+// computer waiting for data.
+class Scheduler
+{
+public:
+  // Called on a worker thread whenever the computer has room for input. Returns false when no input is available yet.
+  using InputProvider = std::function<bool(MemoryCellType* value)>;
+
+  // Called on a worker thread for each value the computer outputs, in order.
+  using OutputSink = std::function<void(MemoryCellType value)>;
+
+  using TaskId = u32;
+
+  // num_threads = 0 uses one thread per hardware thread.
+  Scheduler(u32 num_threads = 0);
+  ~Scheduler();
+
+  u32 GetNumThreads() const { return static_cast<u32>(m_workers.size()); }
+
+  // Queues a computer for execution. The computer must outlive the scheduler, or at least stay alive until Wait()
+  // has returned with it halted or parked. Providers and sinks for one task are never called concurrently.
+  TaskId Add(Computer* comp, InputProvider input, OutputSink output);
+
+  // Tells a parked task that its input provider has data again. Can be called from any thread, including from inside
+  // a provider or sink.
+  void Wake(TaskId id);
+
+  // Blocks until every task has either halted or is parked waiting for input.
+  void Wait();
+
+private:
+  enum class TaskState : u32
+  {
+    Queued,
+    Running,
+    Parked,
+    Halted
+  };
+
+  struct Task
+  {
+    Computer* comp;
+    InputProvider input;
+    OutputSink output;
+    TaskState state;
+    bool wake_pending;
+  };
+
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Task*> queue;
+    std::thread thread;
+  };
+
+  void WorkerMain(u32 worker_index);
+  Task* PopTask(u32 worker_index);
+  void Enqueue(Task* task, u32 worker_index);
+
+  // Returns true if the task halted or faulted, false if it is waiting for input.
+  bool RunTask(Task* task);
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+
+  // Guards the task list, task states and counters. Workers only take it when a task changes state.
+  std::mutex m_mutex;
+  std::condition_variable m_work_available;
+  std::condition_variable m_all_idle;
+  std::vector<std::unique_ptr<Task>> m_tasks;
+  u32 m_num_queued = 0;
+  u32 m_num_running = 0;
+  u32 m_next_worker = 0;
+  bool m_stopping = false;
+};
+
+} // namespace Intcode
@@ -1,31 +1,281 @@
 #include "scope_timer.h"
-#include <cstdio>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
-ScopeTimer::ScopeTimer(std::string_view scope_name) : m_scope_name(scope_name)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+
+using u64 = std::uint64_t;
+
+enum : unsigned
+{
+  // four buckets per power of two, so percentiles are within 25% of the real value
+  HISTOGRAM_SUB_BUCKET_BITS = 2,
+  HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BUCKET_BITS,
+  HISTOGRAM_BUCKETS = 64 * HISTOGRAM_SUB_BUCKETS
+};
+
+unsigned FloorLog2(u64 value)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, value);
+  return static_cast<unsigned>(index);
+#else
+  return 63 - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+}
+
+unsigned GetHistogramBucket(u64 ticks)
+{
+  if (ticks < HISTOGRAM_SUB_BUCKETS)
+    return static_cast<unsigned>(ticks);
+
+  const unsigned exponent = FloorLog2(ticks);
+  const unsigned sub_bucket =
+    static_cast<unsigned>(ticks >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+  return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+u64 GetHistogramBucketStart(unsigned bucket)
+{
+  if (bucket < HISTOGRAM_SUB_BUCKETS)
+    return bucket;
+
+  const unsigned exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKET_BITS - 1;
+  return static_cast<u64>(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS)
+         << (exponent - HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+} // namespace
+
+struct ScopeTimer::Node
+{
+  std::string name;
+  Node* parent = nullptr;
+  std::vector<std::unique_ptr<Node>> children;
+
+  u64 count = 0;
+  u64 total = 0;
+  u64 min = UINT64_MAX;
+  u64 max = 0;
+  std::array<u64, HISTOGRAM_BUCKETS> histogram = {};
+
+  Node* GetChild(std::string_view child_name)
+  {
+    for (const std::unique_ptr<Node>& child : children)
+    {
+      if (child->name == child_name)
+        return child.get();
+    }
+
+    children.push_back(std::make_unique<Node>());
+    children.back()->name = child_name;
+    children.back()->parent = this;
+    return children.back().get();
+  }
+
+  void Record(u64 ticks)
+  {
+    count++;
+    total += ticks;
+    min = (ticks < min) ? ticks : min;
+    max = (ticks > max) ? ticks : max;
+    histogram[GetHistogramBucket(ticks)]++;
+  }
+
+  void Merge(const Node& other)
+  {
+    count += other.count;
+    total += other.total;
+    min = (other.min < min) ? other.min : min;
+    max = (other.max > max) ? other.max : max;
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+      histogram[i] += other.histogram[i];
+    for (const std::unique_ptr<Node>& child : other.children)
+      GetChild(child->name)->Merge(*child);
+  }
+
+  u64 GetSelfTime() const
+  {
+    u64 self = total;
+    for (const std::unique_ptr<Node>& child : children)
+      self -= std::min(self, child->total);
+    return self;
+  }
+
+  // the middle of the bucket holding the requested fraction of the runs, clamped to the extremes seen
+  u64 GetPercentile(double fraction) const
+  {
+    const u64 target = static_cast<u64>(fraction * static_cast<double>(count));
+    u64 seen = 0;
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      seen += histogram[i];
+      if (seen > target)
+      {
+        const u64 start = GetHistogramBucketStart(i);
+        const u64 end = (i + 1 < HISTOGRAM_BUCKETS) ? GetHistogramBucketStart(i + 1) : max;
+        const u64 middle = start + (end - start) / 2;
+        return std::max(min, std::min(max, middle));
+      }
+    }
+
+    return max;
+  }
+};
+
+namespace {
+
+// Timings of threads which have exited. Never destroyed, threads may still exit while the process shuts down.
+struct GlobalTimers
+{
+  std::mutex mutex;
+  ScopeTimer::Node root;
+};
+
+GlobalTimers& GetGlobalTimers()
+{
+  static GlobalTimers* timers = new GlobalTimers();
+  return *timers;
+}
+
+struct ThreadTimers
+{
+  ScopeTimer::Node root;
+  ScopeTimer::Node* current = &root;
+
+  ~ThreadTimers();
+};
+
+thread_local ThreadTimers t_timers;
+
+// trivially destructible, so it can still be read after t_timers is gone
+thread_local bool t_timers_destroyed = false;
+
+ThreadTimers::~ThreadTimers()
+{
+  GlobalTimers& global = GetGlobalTimers();
+  {
+    std::lock_guard<std::mutex> guard(global.mutex);
+    global.root.Merge(root);
+  }
+
+  t_timers_destroyed = true;
+}
+
+ScopeTimer::Node* GetCurrentNode()
+{
+  // timers created while the thread is exiting are recorded nowhere
+  static thread_local ScopeTimer::Node discarded;
+  return t_timers_destroyed ? &discarded : t_timers.current;
+}
+
+void Snapshot(ScopeTimer::Node* snapshot)
+{
+  GlobalTimers& global = GetGlobalTimers();
+  std::lock_guard<std::mutex> guard(global.mutex);
+  snapshot->Merge(global.root);
+  if (!t_timers_destroyed)
+    snapshot->Merge(t_timers.root);
+}
+
+std::string GetPath(const ScopeTimer::Node& node)
 {
+  if (!node.parent || !node.parent->parent)
+    return node.name;
+
+  return GetPath(*node.parent) + "/" + node.name;
+}
+
+template<typename Callback>
+void VisitNodes(const ScopeTimer::Node& node, unsigned depth, const Callback& callback)
+{
+  for (const std::unique_ptr<ScopeTimer::Node>& child : node.children)
+  {
+    callback(*child, depth);
+    VisitNodes(*child, depth + 1, callback);
+  }
+}
+
+double TicksToMicroseconds(u64 ticks)
+{
+  return static_cast<double>(ticks) * 1000000.0 / ScopeTimer::GetTicksPerSecond();
+}
+
+std::string g_dump_filename;
+
+void DumpStatistics()
+{
+  const size_t length = g_dump_filename.size();
+  const bool csv = (length >= 4 && g_dump_filename.compare(length - 4, 4, ".csv") == 0);
+  const bool written =
+    csv ? ScopeTimer::WriteCSV(g_dump_filename.c_str()) : ScopeTimer::WriteJSON(g_dump_filename.c_str());
+  if (!written)
+    std::fprintf(stderr, "failed to write timer statistics to %s\n", g_dump_filename.c_str());
+}
+
+} // namespace
+
+ScopeTimer::ScopeTimer(std::string_view scope_name) : m_parent(GetCurrentNode())
+{
+  m_node = m_parent->GetChild(scope_name);
   Start();
 }
 
 ScopeTimer::~ScopeTimer()
 {
-  if (!m_printed)
-  {
+  if (m_started)
     Stop();
-    Print();
-  }
+}
+
+std::string_view ScopeTimer::GetScopeName() const
+{
+  return m_node->name;
+}
+
+void ScopeTimer::SetScopeName(std::string_view scope_name)
+{
+  assert(!m_started && "timer is not running");
+  m_node = m_parent->GetChild(scope_name);
 }
 
 void ScopeTimer::Start()
 {
-  m_start_time = clock::now();
-  m_printed = false;
+  if (!t_timers_destroyed)
+  {
+    assert(t_timers.current == m_parent && "timers on a thread start and stop in order");
+    t_timers.current = m_node;
+  }
+
   m_started = true;
+  m_start_time = GetTimestamp();
 }
 
 void ScopeTimer::Stop()
 {
-  m_end_time = clock::now();
+  m_elapsed_time = GetTimestamp() - m_start_time;
+  m_node->Record(m_elapsed_time);
   m_started = false;
+
+  if (!t_timers_destroyed)
+  {
+    assert(t_timers.current == m_node && "timers on a thread start and stop in order");
+    t_timers.current = m_parent;
+  }
 }
 
 void ScopeTimer::Print()
@@ -33,7 +283,121 @@ void ScopeTimer::Print()
   if (m_started)
     Stop();
 
-  const double ms = std::chrono::duration<double>(m_end_time - m_start_time).count() * 1000.0;
-  std::fprintf(stderr, "%s took %.4f msec\n", m_scope_name.c_str(), ms);
-  m_printed = true;
+  const double ms = TicksToMicroseconds(m_elapsed_time) / 1000.0;
+  std::fprintf(stderr, "%s took %.4f msec\n", m_node->name.c_str(), ms);
+}
+
+std::uint64_t ScopeTimer::GetTimestamp()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<u64>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+double ScopeTimer::GetTicksPerSecond()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+  // measured once against the steady clock, over long enough for the error to be well under a percent
+  static const double ticks_per_second = []() {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start_time = clock::now();
+    const u64 start_ticks = __rdtsc();
+    clock::time_point end_time;
+    do
+    {
+      end_time = clock::now();
+    } while ((end_time - start_time) < std::chrono::milliseconds(10));
+
+    const u64 end_ticks = __rdtsc();
+    return static_cast<double>(end_ticks - start_ticks) / std::chrono::duration<double>(end_time - start_time).count();
+  }();
+  return ticks_per_second;
+#else
+  return 1000000000.0;
+#endif
+}
+
+void ScopeTimer::PrintSummary(std::FILE* fp)
+{
+  Node snapshot;
+  Snapshot(&snapshot);
+
+  std::fprintf(fp, "%-40s %10s %12s %12s %10s %10s %10s %10s %10s\n", "scope", "count", "total ms", "self ms",
+               "mean us", "min us", "p50 us", "p99 us", "max us");
+  VisitNodes(snapshot, 0, [fp](const Node& node, unsigned depth) {
+    if (node.count == 0)
+      return;
+
+    const std::string name = std::string(depth * 2, ' ') + node.name;
+    std::fprintf(fp, "%-40s %10" PRIu64 " %12.3f %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", name.c_str(),
+                 node.count, TicksToMicroseconds(node.total) / 1000.0, TicksToMicroseconds(node.GetSelfTime()) / 1000.0,
+                 TicksToMicroseconds(node.total) / static_cast<double>(node.count), TicksToMicroseconds(node.min),
+                 TicksToMicroseconds(node.GetPercentile(0.5)), TicksToMicroseconds(node.GetPercentile(0.99)),
+                 TicksToMicroseconds(node.max));
+  });
+}
+
+bool ScopeTimer::WriteJSON(const char* filename)
+{
+  Node snapshot;
+  Snapshot(&snapshot);
+
+  std::FILE* fp = std::fopen(filename, "w");
+  if (!fp)
+    return false;
+
+  // names are written as given, scopes are expected to be named with plain identifiers
+  std::fprintf(fp, "{\n  \"ticks_per_second\": %.0f,\n  \"scopes\": [", GetTicksPerSecond());
+  bool first = true;
+  VisitNodes(snapshot, 0, [fp, &first](const Node& node, unsigned depth) {
+    if (node.count == 0)
+      return;
+
+    std::fprintf(fp,
+                 "%s\n    {\"path\": \"%s\", \"name\": \"%s\", \"depth\": %u, \"count\": %" PRIu64
+                 ", \"total_us\": %.3f, \"self_us\": %.3f, \"min_us\": %.3f, \"max_us\": %.3f, \"p50_us\": %.3f, "
+                 "\"p90_us\": %.3f, \"p99_us\": %.3f}",
+                 first ? "" : ",", GetPath(node).c_str(), node.name.c_str(), depth, node.count,
+                 TicksToMicroseconds(node.total), TicksToMicroseconds(node.GetSelfTime()),
+                 TicksToMicroseconds(node.min), TicksToMicroseconds(node.max),
+                 TicksToMicroseconds(node.GetPercentile(0.5)), TicksToMicroseconds(node.GetPercentile(0.9)),
+                 TicksToMicroseconds(node.GetPercentile(0.99)));
+    first = false;
+  });
+  std::fprintf(fp, "\n  ]\n}\n");
+  return (std::fclose(fp) == 0);
+}
+
+bool ScopeTimer::WriteCSV(const char* filename)
+{
+  Node snapshot;
+  Snapshot(&snapshot);
+
+  std::FILE* fp = std::fopen(filename, "w");
+  if (!fp)
+    return false;
+
+  std::fprintf(fp, "path,count,total_us,self_us,min_us,max_us,p50_us,p90_us,p99_us\n");
+  VisitNodes(snapshot, 0, [fp](const Node& node, unsigned /*depth*/) {
+    if (node.count == 0)
+      return;
+
+    std::fprintf(fp, "%s,%" PRIu64 ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", GetPath(node).c_str(), node.count,
+                 TicksToMicroseconds(node.total), TicksToMicroseconds(node.GetSelfTime()),
+                 TicksToMicroseconds(node.min), TicksToMicroseconds(node.max),
+                 TicksToMicroseconds(node.GetPercentile(0.5)), TicksToMicroseconds(node.GetPercentile(0.9)),
+                 TicksToMicroseconds(node.GetPercentile(0.99)));
+  });
+  return (std::fclose(fp) == 0);
+}
+
+void ScopeTimer::DumpAtExit(const char* filename)
+{
+  if (g_dump_filename.empty())
+    std::atexit(DumpStatistics);
+
+  g_dump_filename = filename;
 }
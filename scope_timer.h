@@ -1,27 +1,46 @@
 #pragma once
-#include <chrono>
-#include <string>
+#include <cstdint>
+#include <cstdio>
 #include <string_view>
 
+// Times a scope, from construction (or Start()) until destruction (or Stop()). Every run is recorded under the
+// timer's path, made of the names of the timers running on the same thread when it was created, e.g. a "run" timer
+// inside a "frame" timer is recorded as "frame/run". Runs are aggregated per path, and nothing is printed unless asked
+// for, so timers are cheap enough to place in hot loops.
 class ScopeTimer
 {
 public:
+  struct Node;
+
   ScopeTimer(std::string_view scope_name);
   ~ScopeTimer();
 
-  const std::string& GetScopeName() const { return m_scope_name; }
-  void SetScopeName(std::string_view scope_name) { m_scope_name = scope_name; }
+  std::string_view GetScopeName() const;
+  void SetScopeName(std::string_view scope_name);
 
   void Start();
   void Stop();
+
+  // Prints how long the last run took to stderr.
   void Print();
 
-private:
-  using clock = std::chrono::steady_clock;
+  // Timestamps are TSC ticks on x86, nanoseconds elsewhere.
+  static std::uint64_t GetTimestamp();
+  static double GetTicksPerSecond();
 
-  clock::time_point m_start_time;
-  clock::time_point m_end_time;
-  std::string m_scope_name;
+  // Statistics for every path: count, total, self time excluding nested timers, min, max and percentiles.
+  // Threads contribute their timings when they exit, the calling thread's are always included.
+  static void PrintSummary(std::FILE* fp = stderr);
+  static bool WriteJSON(const char* filename);
+  static bool WriteCSV(const char* filename);
+
+  // Writes the statistics when the process exits, as CSV if the filename ends in .csv, otherwise as JSON.
+  static void DumpAtExit(const char* filename);
+
+private:
+  Node* m_node;
+  Node* m_parent;
+  std::uint64_t m_start_time = 0;
+  std::uint64_t m_elapsed_time = 0;
   bool m_started = false;
-  bool m_printed = false;
 };
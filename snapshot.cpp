@@ -0,0 +1,297 @@
+#include "snapshot.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace Intcode {
+
+static_assert(sizeof(Snapshot::Header) == 80, "snapshot header layout");
+static_assert(sizeof(Snapshot::PageEntry) == 24, "snapshot page entry layout");
+
+namespace {
+
+enum : u64
+{
+  PAGE_SIZE = PagedMemory::PAGE_SIZE,
+  BITMAP_WORDS = PAGE_SIZE / 64,
+
+  // keeps raw pages cache line aligned in the mapping
+  PAGE_ALIGNMENT = 64
+};
+
+u64 AlignUp(u64 value, u64 alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+bool SetError(std::string* error_message, const char* message)
+{
+  if (error_message)
+    *error_message = message;
+
+  return false;
+}
+
+u64 GetPageDataSize(Snapshot::PageEncoding encoding, u64 num_values)
+{
+  return (encoding == Snapshot::PageEncoding::Raw) ? (PAGE_SIZE * sizeof(MemoryCellType)) :
+                                                     (BITMAP_WORDS * sizeof(u64) + num_values * sizeof(MemoryCellType));
+}
+
+void CopyQueue(RingBuffer<MemoryCellType> queue, std::vector<MemoryCellType>* values)
+{
+  const size_t start = values->size();
+  values->resize(start + queue.GetSize());
+  queue.PopRange(values->data() + start, queue.GetSize());
+}
+
+} // namespace
+
+bool Snapshot::Save(const Computer& comp, const char* filename, std::string* error_message)
+{
+  std::vector<char> buffer;
+  Write(comp, &buffer);
+
+  std::FILE* fp = std::fopen(filename, "wb");
+  if (!fp)
+    return SetError(error_message, "failed to open file for writing");
+
+  const bool written = (std::fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size());
+  if (std::fclose(fp) != 0 || !written)
+    return SetError(error_message, "failed to write file");
+
+  return true;
+}
+
+bool Snapshot::Load(Computer& comp, const char* filename, std::string* error_message)
+{
+  MappedFile file;
+  if (!file.Open(filename))
+    return SetError(error_message, "failed to open file");
+
+  return Read(comp, file.GetData(), file.GetSize(), error_message);
+}
+
+void Snapshot::Write(const Computer& comp, std::vector<char>* buffer)
+{
+  assert(comp.m_state != Computer::State::Executing);
+
+  std::vector<MemoryCellType> queued_values;
+  CopyQueue(comp.m_input_queue, &queued_values);
+  CopyQueue(comp.m_output_queue, &queued_values);
+
+  std::vector<u64> pages = comp.m_memory.GetDirtyPages();
+  std::sort(pages.begin(), pages.end());
+
+  Header header = {};
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.image_hash = comp.m_memory.GetImageHash();
+  header.pc = comp.m_pc;
+  header.state = comp.m_state;
+  header.relative_base = comp.m_relative_base;
+  header.input_queue_capacity = comp.GetInputQueueCapacity();
+  header.output_queue_capacity = comp.GetOutputQueueCapacity();
+  header.num_inputs = comp.GetPendingInputCount();
+  header.num_outputs = comp.GetPendingOutputCount();
+  header.fault = comp.m_fault;
+  header.queues_offset = sizeof(Header);
+  header.num_pages = pages.size();
+  header.pages_offset = header.queues_offset + queued_values.size() * sizeof(MemoryCellType);
+
+  // a page is only stored sparse when that at least halves it
+  std::vector<PageEntry> entries(pages.size());
+  u64 data_offset = header.pages_offset + entries.size() * sizeof(PageEntry);
+  for (size_t i = 0; i < pages.size(); i++)
+  {
+    const MemoryCellType* data = comp.m_memory.GetPageData(pages[i]);
+    const u32 num_values = static_cast<u32>(PAGE_SIZE - std::count(data, data + PAGE_SIZE, 0));
+    const bool sparse = GetPageDataSize(PageEncoding::Sparse, num_values) * 2 <= GetPageDataSize(PageEncoding::Raw, 0);
+
+    PageEntry& entry = entries[i];
+    entry.page = pages[i];
+    entry.encoding = sparse ? PageEncoding::Sparse : PageEncoding::Raw;
+    entry.num_values = sparse ? num_values : 0;
+    entry.data_offset = sparse ? data_offset : AlignUp(data_offset, PAGE_ALIGNMENT);
+    data_offset = entry.data_offset + GetPageDataSize(entry.encoding, entry.num_values);
+  }
+
+  // offsets are relative to the start of the snapshot, so it can be appended to other data
+  const size_t base = buffer->size();
+  buffer->resize(base + static_cast<size_t>(data_offset));
+  char* const out_base = buffer->data() + base;
+  std::memcpy(out_base, &header, sizeof(header));
+  if (!queued_values.empty())
+    std::memcpy(out_base + header.queues_offset, queued_values.data(), queued_values.size() * sizeof(MemoryCellType));
+  if (!entries.empty())
+    std::memcpy(out_base + header.pages_offset, entries.data(), entries.size() * sizeof(PageEntry));
+
+  for (const PageEntry& entry : entries)
+  {
+    const MemoryCellType* data = comp.m_memory.GetPageData(entry.page);
+    char* out = out_base + entry.data_offset;
+    if (entry.encoding == PageEncoding::Raw)
+    {
+      std::memcpy(out, data, PAGE_SIZE * sizeof(MemoryCellType));
+      continue;
+    }
+
+    u64 bitmap[BITMAP_WORDS] = {};
+    std::vector<MemoryCellType> values;
+    values.reserve(entry.num_values);
+    for (u64 cell = 0; cell < PAGE_SIZE; cell++)
+    {
+      if (data[cell] == 0)
+        continue;
+
+      bitmap[cell / 64] |= u64(1) << (cell % 64);
+      values.push_back(data[cell]);
+    }
+
+    std::memcpy(out, bitmap, sizeof(bitmap));
+    if (!values.empty())
+      std::memcpy(out + sizeof(bitmap), values.data(), values.size() * sizeof(MemoryCellType));
+  }
+}
+
+bool Snapshot::Read(Computer& comp, const char* data, u64 size, std::string* error_message)
+{
+  assert(comp.m_state != Computer::State::Executing);
+  assert((reinterpret_cast<std::uintptr_t>(data) % alignof(Header)) == 0);
+
+  // everything is checked before the computer is touched, so a bad snapshot leaves it as it was
+  if (size < sizeof(Header))
+    return SetError(error_message, "too small for header");
+
+  const Header& header = *reinterpret_cast<const Header*>(data);
+  if (header.magic != MAGIC)
+    return SetError(error_message, "not a snapshot, or written on a machine with different byte order");
+  if (header.version != VERSION)
+    return SetError(error_message, "unsupported snapshot version");
+  if (header.image_hash != comp.m_memory.GetImageHash())
+    return SetError(error_message, "snapshot was saved from a different program");
+
+  switch (header.state)
+  {
+    case Computer::State::Paused:
+    case Computer::State::Halted:
+    case Computer::State::WaitingForInput:
+    case Computer::State::WaitingForOutput:
+    case Computer::State::Faulted:
+      break;
+
+    default:
+      return SetError(error_message, "invalid computer state");
+  }
+
+  switch (header.fault)
+  {
+    case Computer::Fault::None:
+    case Computer::Fault::InvalidInstruction:
+    case Computer::Fault::InvalidAddress:
+    case Computer::Fault::InvalidJumpTarget:
+      break;
+
+    default:
+      return SetError(error_message, "invalid fault");
+  }
+  if ((header.state == Computer::State::Faulted) != (header.fault != Computer::Fault::None))
+    return SetError(error_message, "fault does not match the computer state");
+
+  if (header.input_queue_capacity == 0 || header.output_queue_capacity == 0 ||
+      header.num_inputs > header.input_queue_capacity || header.num_outputs > header.output_queue_capacity)
+  {
+    return SetError(error_message, "invalid queue sizes");
+  }
+
+  const u64 num_queued = u64(header.num_inputs) + header.num_outputs;
+  if ((header.queues_offset % alignof(MemoryCellType)) != 0 || header.queues_offset > size ||
+      num_queued > (size - header.queues_offset) / sizeof(MemoryCellType))
+  {
+    return SetError(error_message, "queued values out of bounds");
+  }
+  if ((header.pages_offset % alignof(PageEntry)) != 0 || header.pages_offset > size ||
+      header.num_pages > (size - header.pages_offset) / sizeof(PageEntry))
+  {
+    return SetError(error_message, "page table out of bounds");
+  }
+
+  const PageEntry* entries = reinterpret_cast<const PageEntry*>(data + header.pages_offset);
+  for (u64 i = 0; i < header.num_pages; i++)
+  {
+    const PageEntry& entry = entries[i];
+    if (i > 0 && entry.page <= entries[i - 1].page)
+      return SetError(error_message, "pages out of order");
+    if (entry.page > (~u64(0) >> PagedMemory::PAGE_SHIFT))
+      return SetError(error_message, "page out of range");
+    if (entry.encoding != PageEncoding::Raw && entry.encoding != PageEncoding::Sparse)
+      return SetError(error_message, "invalid page encoding");
+
+    const u64 data_size = GetPageDataSize(entry.encoding, entry.num_values);
+    if ((entry.data_offset % alignof(MemoryCellType)) != 0 || entry.data_offset > size ||
+        data_size > (size - entry.data_offset))
+    {
+      return SetError(error_message, "page data out of bounds");
+    }
+
+    if (entry.encoding == PageEncoding::Sparse)
+    {
+      const u64* bitmap = reinterpret_cast<const u64*>(data + entry.data_offset);
+      u64 num_bits = 0;
+      for (u64 word = 0; word < BITMAP_WORDS; word++)
+        num_bits += std::bitset<64>(bitmap[word]).count();
+      if (num_bits != entry.num_values)
+        return SetError(error_message, "sparse page does not match its value count");
+    }
+  }
+
+  // back to the program's initial memory, then every saved page replaces what was there
+  comp.Reset();
+
+  const u64 cache_size = comp.m_instruction_cache_flags.size();
+  for (u64 i = 0; i < header.num_pages; i++)
+  {
+    const PageEntry& entry = entries[i];
+    const u64 start = entry.page << PagedMemory::PAGE_SHIFT;
+    if (start < cache_size)
+    {
+      const u64 end = std::min<u64>(start + PAGE_SIZE, cache_size);
+      comp.InvalidateCachedInstructions(static_cast<u32>(start), static_cast<u32>(end));
+    }
+
+    MemoryCellType* page_data = comp.m_memory.RestorePage(entry.page);
+    const char* in = data + entry.data_offset;
+    if (entry.encoding == PageEncoding::Raw)
+    {
+      std::memcpy(page_data, in, PAGE_SIZE * sizeof(MemoryCellType));
+      continue;
+    }
+
+    const u64* bitmap = reinterpret_cast<const u64*>(in);
+    const MemoryCellType* values = reinterpret_cast<const MemoryCellType*>(in + BITMAP_WORDS * sizeof(u64));
+    for (u64 cell = 0; cell < PAGE_SIZE; cell++)
+    {
+      if (bitmap[cell / 64] & (u64(1) << (cell % 64)))
+        page_data[cell] = *(values++);
+    }
+  }
+
+  const MemoryCellType* queued_values = reinterpret_cast<const MemoryCellType*>(data + header.queues_offset);
+  comp.SetInputQueueCapacity(header.input_queue_capacity);
+  comp.SetOutputQueueCapacity(header.output_queue_capacity);
+  comp.m_input_queue.PushRange(queued_values, header.num_inputs);
+  comp.m_output_queue.PushRange(queued_values + header.num_inputs, header.num_outputs);
+
+  comp.m_pc = header.pc;
+  comp.m_relative_base = header.relative_base;
+  comp.m_state = header.state;
+  comp.m_fault = header.fault;
+  return true;
+}
+
+} // namespace Intcode
@@ -0,0 +1,70 @@
+#pragma once
+#include "intcode.h"
+#include <string>
+#include <vector>
+
+namespace Intcode {
+
+// File format for Computer::SaveState() and LoadState(). A snapshot holds the registers, state, pending input and
+// output, and every memory page which differs from the program, so it is only meaningful for the program it was saved
+// from. Loading resets the computer to the program, then restores the saved pages. Decoded instructions and compiled
+// blocks on pages which still match the program are kept. Those on a page the computer had written, or which the
+// snapshot restores, are dropped, and memoized calls are cleared if anything was dropped.
+//
+// Pages are stored raw and cache line aligned, so loading copies them straight out of the mapped file, unless most of
+// their cells are zero, as in stacks and freshly touched heaps. Those are stored as a bitmap of the non-zero cells
+// followed by their values.
+//
+// Like program images, values are stored in host byte order.
+class Snapshot
+{
+public:
+  enum : u32
+  {
+    MAGIC = 0x53534349, // "ICSS"
+    VERSION = 2
+  };
+
+  enum class PageEncoding : u32
+  {
+    Raw,
+    Sparse
+  };
+
+  struct Header
+  {
+    u32 magic;
+    u32 version;
+    u64 image_hash;
+    u32 pc;
+    Computer::State state;
+    s64 relative_base;
+    u32 input_queue_capacity;
+    u32 output_queue_capacity;
+    u32 num_inputs;
+    u32 num_outputs;
+    Computer::Fault fault; // why a faulted computer stopped, None in any other state
+    u32 reserved;
+    u64 queues_offset; // num_inputs pending input values, then num_outputs pending output values
+    u64 num_pages;
+    u64 pages_offset; // PageEntry per page, in ascending page order
+  };
+
+  struct PageEntry
+  {
+    u64 page;
+    u64 data_offset;
+    PageEncoding encoding;
+    u32 num_values; // non-zero cells of a sparse page
+  };
+
+  static bool Save(const Computer& comp, const char* filename, std::string* error_message = nullptr);
+  static bool Load(Computer& comp, const char* filename, std::string* error_message = nullptr);
+
+  // Same as Save() and Load(), for snapshots embedded in other files. data has to be 8-byte aligned, and page data is
+  // only cache line aligned if data is.
+  static void Write(const Computer& comp, std::vector<char>* buffer);
+  static bool Read(Computer& comp, const char* data, u64 size, std::string* error_message = nullptr);
+};
+
+} // namespace Intcode
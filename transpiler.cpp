@@ -0,0 +1,477 @@
+#include "transpiler.h"
+#include <cctype>
+#include <charconv>
+
+namespace Intcode {
+
+namespace {
+
+enum : u32
+{
+  NO_BLOCK = 0xFFFFFFFFu,
+  CODE_CELLS_PER_LINE = 16
+};
+
+void AppendNumber(std::string* str, u64 value)
+{
+  char buffer[32];
+  str->append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+// The most negative value has no positive literal to negate, so it is spelled out.
+void AppendLiteral(std::string* str, s64 value)
+{
+  if (value == INT64_MIN)
+  {
+    str->append("(-9223372036854775807 - 1)");
+    return;
+  }
+
+  char buffer[32];
+  str->append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+void AppendStringLiteral(std::string* str, std::string_view value)
+{
+  str->push_back('"');
+  for (const char ch : value)
+  {
+    if (ch == '"' || ch == '\\')
+      str->push_back('\\');
+
+    str->push_back(std::isprint(static_cast<unsigned char>(ch)) ? ch : '?');
+  }
+  str->push_back('"');
+}
+
+void AppendLabel(std::string* str, u32 pc)
+{
+  str->push_back('L');
+  AppendNumber(str, pc);
+}
+
+void AppendExit(std::string* str, u32 pc, const char* indent)
+{
+  str->append(indent);
+  str->append("return ctx.Exit(");
+  AppendNumber(str, pc);
+  str->append(", rb);\n");
+}
+
+class Transpiler
+{
+public:
+  Transpiler(const CodeAnalysis& analysis, std::string* str) : m_analysis(analysis), m_str(str) {}
+
+  void Transpile(std::string_view name, std::string_view symbol);
+
+private:
+  bool IsTranspiledCell(MemoryCellType address) const
+  {
+    return (address >= 0 && static_cast<u64>(address) < m_transpiled_cells.size() &&
+            m_transpiled_cells[static_cast<size_t>(address)]);
+  }
+
+  // Returns the index of the transpiled block starting at pc, or NO_BLOCK.
+  u32 GetTranspiledBlock(MemoryCellType pc) const
+  {
+    const u32 block = (pc >= 0 && pc <= UINT32_MAX) ? m_analysis.FindBlock(static_cast<u32>(pc)) : NO_BLOCK;
+    if (block == NO_BLOCK || m_analysis.GetBlocks()[block].start_pc != pc)
+      return NO_BLOCK;
+
+    return m_transpiled_index[block];
+  }
+
+  void AppendAddress(const Instruction& instr, u32 index);
+  void AppendRead(const Instruction& instr, u32 index);
+  void AppendWrite(u32 pc, const Instruction& instr, u32 index);
+  bool AppendInstruction(u32 pc, const Instruction& instr);
+  void AppendBlock(u32 block);
+  void AppendCode();
+  void AppendBlockTable();
+  void AppendRunFunction();
+
+  const CodeAnalysis& m_analysis;
+  std::string* m_str;
+
+  // analysis blocks in transpiled order, and the reverse mapping
+  std::vector<u32> m_transpiled_blocks;
+  std::vector<u32> m_transpiled_index;
+  std::vector<bool> m_transpiled_cells;
+};
+
+void Transpiler::Transpile(std::string_view name, std::string_view symbol)
+{
+  // blocks the program overwrites would be dropped the first time they ran
+  const std::vector<CodeAnalysis::Block>& blocks = m_analysis.GetBlocks();
+  m_transpiled_index.assign(blocks.size(), NO_BLOCK);
+  m_transpiled_cells.assign(m_analysis.GetCode().size(), false);
+  for (u32 i = 0; i < blocks.size(); i++)
+  {
+    if (blocks[i].is_written)
+      continue;
+
+    m_transpiled_index[i] = static_cast<u32>(m_transpiled_blocks.size());
+    m_transpiled_blocks.push_back(i);
+    for (u32 cell = blocks[i].start_pc; cell < blocks[i].end_pc; cell++)
+      m_transpiled_cells[cell] = true;
+  }
+
+  m_str->append("// Generated by intcode-transpile from ");
+  m_str->append(name);
+  m_str->append(", do not edit.\n#include \"native_program.h\"\n\nnamespace {\n\n");
+  m_str->append("using Intcode::MemoryCellType;\nusing Intcode::NativeContext;\nusing Intcode::NativeProgram;\n"
+                "using Intcode::s64;\nusing Intcode::u32;\n\n");
+
+  AppendCode();
+  AppendBlockTable();
+  AppendRunFunction();
+
+  m_str->append("} // namespace\n\nextern const Intcode::NativeProgram ");
+  m_str->append(symbol);
+  m_str->append(";\nconst Intcode::NativeProgram ");
+  m_str->append(symbol);
+  m_str->append(" = {");
+  AppendStringLiteral(m_str, name);
+  m_str->append(", s_code, ");
+  AppendNumber(m_str, m_analysis.GetCode().size());
+  m_str->append(", ");
+  AppendNumber(m_str, m_analysis.GetEntryPC());
+  m_str->append(", s_blocks, ");
+  AppendNumber(m_str, m_transpiled_blocks.size());
+  m_str->append(", &Run};\n");
+}
+
+void Transpiler::AppendCode()
+{
+  const CodeVector& code = m_analysis.GetCode();
+  m_str->append("const MemoryCellType s_code[] = {");
+  for (size_t i = 0; i < code.size(); i++)
+  {
+    m_str->append((i % CODE_CELLS_PER_LINE) ? " " : "\n  ");
+    AppendLiteral(m_str, code[i]);
+    m_str->push_back(',');
+  }
+  m_str->append("\n};\n\n");
+}
+
+void Transpiler::AppendBlockTable()
+{
+  if (m_transpiled_blocks.empty())
+  {
+    m_str->append("const NativeProgram::Block* const s_blocks = nullptr;\n\n");
+    return;
+  }
+
+  // indexed like the checks at the start of each block in Run()
+  m_str->append("const NativeProgram::Block s_blocks[] = {\n");
+  for (const u32 block : m_transpiled_blocks)
+  {
+    m_str->append("  {");
+    AppendNumber(m_str, m_analysis.GetBlocks()[block].start_pc);
+    m_str->append(", ");
+    AppendNumber(m_str, m_analysis.GetBlocks()[block].end_pc);
+    m_str->append("},\n");
+  }
+  m_str->append("};\n\n");
+}
+
+void Transpiler::AppendRunFunction()
+{
+  m_str->append("void Run(NativeContext& ctx)\n{\n  s64 rb = ctx.GetRelativeBase();\n"
+                "  MemoryCellType target = ctx.GetPC();\n  goto dispatch;\n");
+
+  for (u32 i = 0; i < m_transpiled_blocks.size(); i++)
+    AppendBlock(i);
+
+  m_str->append("\ndispatch:\n  switch (target)\n  {\n");
+  for (const u32 block : m_transpiled_blocks)
+  {
+    m_str->append("    case ");
+    AppendNumber(m_str, m_analysis.GetBlocks()[block].start_pc);
+    m_str->append(":\n      goto ");
+    AppendLabel(m_str, m_analysis.GetBlocks()[block].start_pc);
+    m_str->append(";\n");
+  }
+  m_str->append("    default:\n      assert(target >= 0 && \"jumping to positive pc\");\n"
+                "      return ctx.Exit(static_cast<u32>(target), rb);\n  }\n}\n\n");
+}
+
+void Transpiler::AppendBlock(u32 index)
+{
+  const CodeAnalysis::Block& block = m_analysis.GetBlocks()[m_transpiled_blocks[index]];
+  m_str->push_back('\n');
+  AppendLabel(m_str, block.start_pc);
+  m_str->append(":\n  if (!ctx.IsBlockValid(");
+  AppendNumber(m_str, index);
+  m_str->append("))\n");
+  AppendExit(m_str, block.start_pc, "    ");
+
+  const CodeAnalysis::AnalyzedInstruction* instructions = &m_analysis.GetInstructions()[block.first_instruction];
+  for (u32 i = 0; i < block.num_instructions; i++)
+  {
+    if (!AppendInstruction(instructions[i].pc, instructions[i].instr))
+      return;
+  }
+
+  // fall through into the next block, which is usually the next label anyway
+  const u32 next_block = GetTranspiledBlock(block.end_pc);
+  if (next_block == NO_BLOCK)
+  {
+    AppendExit(m_str, block.end_pc, "  ");
+  }
+  else if (next_block != (index + 1))
+  {
+    m_str->append("  goto ");
+    AppendLabel(m_str, block.end_pc);
+    m_str->append(";\n");
+  }
+}
+
+void Transpiler::AppendAddress(const Instruction& instr, u32 index)
+{
+  const MemoryCellType value = instr.operand_values[index];
+  if (instr.operand_modes[index] == OperandMode::Positional)
+  {
+    AppendLiteral(m_str, value);
+    return;
+  }
+
+  if (value < 0 && value != INT64_MIN)
+  {
+    m_str->append("rb - ");
+    AppendLiteral(m_str, -value);
+  }
+  else
+  {
+    m_str->append("rb + ");
+    AppendLiteral(m_str, value);
+  }
+}
+
+void Transpiler::AppendRead(const Instruction& instr, u32 index)
+{
+  if (instr.operand_modes[index] == OperandMode::Immediate)
+  {
+    AppendLiteral(m_str, instr.operand_values[index]);
+    return;
+  }
+
+  m_str->append("ctx.Read(");
+  AppendAddress(instr, index);
+  m_str->push_back(')');
+}
+
+void Transpiler::AppendWrite(u32 pc, const Instruction& instr, u32 index)
+{
+  // Writes through the relative base can land anywhere, those and writes into transpiled code stop right after.
+  const bool may_write_code = (instr.operand_modes[index] == OperandMode::Relative) ||
+                              IsTranspiledCell(instr.operand_values[index]);
+  m_str->append(may_write_code ? "  if (ctx.Write(" : "  ctx.Write(");
+  AppendAddress(instr, index);
+  m_str->append(", ");
+  if (instr.opcode == Opcode::in)
+  {
+    m_str->append("ctx.PopInput()");
+  }
+  else if (instr.operand_modes[0] == OperandMode::Immediate && instr.operand_modes[1] == OperandMode::Immediate)
+  {
+    // folded here, small literals would be int and overflow
+    const MemoryCellType lhs = instr.operand_values[0];
+    const MemoryCellType rhs = instr.operand_values[1];
+    MemoryCellType value;
+    switch (instr.opcode)
+    {
+      case Opcode::add:
+        value = static_cast<MemoryCellType>(static_cast<u64>(lhs) + static_cast<u64>(rhs));
+        break;
+      case Opcode::mul:
+        value = static_cast<MemoryCellType>(static_cast<u64>(lhs) * static_cast<u64>(rhs));
+        break;
+      case Opcode::slt:
+        value = (lhs < rhs) ? 1 : 0;
+        break;
+      default:
+        value = (lhs == rhs) ? 1 : 0;
+        break;
+    }
+
+    AppendLiteral(m_str, value);
+  }
+  else
+  {
+    const bool is_compare = (instr.opcode == Opcode::slt || instr.opcode == Opcode::seq);
+    if (is_compare)
+      m_str->push_back('(');
+    AppendRead(instr, 0);
+    switch (instr.opcode)
+    {
+      case Opcode::add:
+        m_str->append(" + ");
+        break;
+      case Opcode::mul:
+        m_str->append(" * ");
+        break;
+      case Opcode::slt:
+        m_str->append(" < ");
+        break;
+      default:
+        m_str->append(" == ");
+        break;
+    }
+    AppendRead(instr, 1);
+    if (is_compare)
+      m_str->append(") ? 1 : 0");
+  }
+
+  if (!may_write_code)
+  {
+    m_str->append(");\n");
+    return;
+  }
+
+  m_str->append("))\n");
+  AppendExit(m_str, pc + instr.length, "    ");
+}
+
+bool Transpiler::AppendInstruction(u32 pc, const Instruction& instr)
+{
+  m_str->append("  // ");
+  AppendNumber(m_str, pc);
+  m_str->append(": ");
+  instr.AppendDisassembly(m_str);
+  m_str->push_back('\n');
+
+  // immediate write operands are left to the interpreter to reject
+  const bool has_write_operand =
+    (instr.opcode == Opcode::add || instr.opcode == Opcode::mul || instr.opcode == Opcode::slt ||
+     instr.opcode == Opcode::seq || instr.opcode == Opcode::in);
+  const u32 write_operand = (instr.opcode == Opcode::in) ? 0 : 2;
+  if (has_write_operand && instr.operand_modes[write_operand] == OperandMode::Immediate)
+  {
+    AppendExit(m_str, pc, "  ");
+    return false;
+  }
+
+  switch (instr.opcode)
+  {
+    case Opcode::add:
+    case Opcode::mul:
+    case Opcode::slt:
+    case Opcode::seq:
+      AppendWrite(pc, instr, 2);
+      return true;
+
+    case Opcode::in:
+    {
+      // the interpreter puts the computer in WaitingForInput
+      m_str->append("  if (!ctx.HasInput())\n");
+      AppendExit(m_str, pc, "    ");
+      AppendWrite(pc, instr, 0);
+      return true;
+    }
+
+    case Opcode::out:
+    {
+      // the interpreter puts the computer in WaitingForOutput if the host did not drain the queue
+      m_str->append("  if (ctx.IsOutputFull())\n");
+      AppendExit(m_str, pc, "    ");
+      m_str->append("  if (!ctx.PushOutput(");
+      AppendRead(instr, 0);
+      m_str->append("))\n");
+      AppendExit(m_str, pc + instr.length, "    ");
+      return true;
+    }
+
+    case Opcode::jnz:
+    case Opcode::jz:
+    {
+      const bool jump_if_nonzero = (instr.opcode == Opcode::jnz);
+      const bool unconditional = (instr.operand_modes[0] == OperandMode::Immediate);
+      if (unconditional && (instr.operand_values[0] != 0) != jump_if_nonzero)
+        return true;
+
+      const char* indent = unconditional ? "  " : "    ";
+      if (!unconditional)
+      {
+        m_str->append("  if (");
+        AppendRead(instr, 0);
+        m_str->append(jump_if_nonzero ? " != 0)\n" : " == 0)\n");
+      }
+
+      const u32 target_block = (instr.operand_modes[1] == OperandMode::Immediate) ?
+                                 GetTranspiledBlock(instr.operand_values[1]) :
+                                 NO_BLOCK;
+      if (target_block != NO_BLOCK)
+      {
+        m_str->append(indent);
+        m_str->append("goto ");
+        AppendLabel(m_str, m_analysis.GetBlocks()[m_transpiled_blocks[target_block]].start_pc);
+        m_str->append(";\n");
+      }
+      else if (instr.operand_modes[1] == OperandMode::Immediate && instr.operand_values[1] >= 0 &&
+               instr.operand_values[1] <= UINT32_MAX)
+      {
+        AppendExit(m_str, static_cast<u32>(instr.operand_values[1]), indent);
+      }
+      else
+      {
+        if (!unconditional)
+          m_str->append("  {\n");
+        m_str->append(indent);
+        m_str->append("target = ");
+        AppendRead(instr, 1);
+        m_str->append(";\n");
+        m_str->append(indent);
+        m_str->append("goto dispatch;\n");
+        if (!unconditional)
+          m_str->append("  }\n");
+      }
+
+      return !unconditional;
+    }
+
+    case Opcode::rbaddr:
+    {
+      m_str->append("  rb += ");
+      AppendRead(instr, 0);
+      m_str->append(";\n");
+      return true;
+    }
+
+    default:
+    {
+      // halt
+      AppendExit(m_str, pc, "  ");
+      return false;
+    }
+  }
+}
+
+} // namespace
+
+void TranspileToCpp(const CodeAnalysis& analysis, std::string_view name, std::string_view symbol, std::string* str)
+{
+  Transpiler(analysis, str).Transpile(name, symbol);
+}
+
+std::string MakeSymbolName(std::string_view name)
+{
+  // strip the directory and extension
+  const size_t start = name.find_last_of("/\\");
+  if (start != std::string_view::npos)
+    name.remove_prefix(start + 1);
+  const size_t extension = name.find('.');
+  if (extension != std::string_view::npos)
+    name = name.substr(0, extension);
+
+  std::string symbol;
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name.front())))
+    symbol = "program_";
+  for (const char ch : name)
+    symbol.push_back(std::isalnum(static_cast<unsigned char>(ch)) ? ch : '_');
+
+  return symbol;
+}
+
+} // namespace Intcode
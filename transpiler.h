@@ -0,0 +1,21 @@
+#pragma once
+#include "code_analysis.h"
+#include <string>
+#include <string_view>
+
+namespace Intcode {
+
+// Translates a program to a C++ translation unit defining `extern const Intcode::NativeProgram <symbol>`, to be built
+// against native_program.h and run with Computer(const NativeProgram&).
+//
+// Every block the analysis found becomes a label in a single function, so jumps with immediate targets are plain
+// gotos the host compiler can optimize across, and jumps through memory go through a switch over the block starts.
+// Blocks the program is known to write to are left to the interpreter. Anything else the transpiled code cannot run
+// (I/O waits, halting, jumps to code the analysis did not find, writes into transpiled code) hands the instruction to
+// the interpreter, and execution returns to transpiled code at the next block start.
+void TranspileToCpp(const CodeAnalysis& analysis, std::string_view name, std::string_view symbol, std::string* str);
+
+// Turns a file name into something usable as a C++ identifier.
+std::string MakeSymbolName(std::string_view name);
+
+} // namespace Intcode